@@ -0,0 +1,343 @@
+/* gen-icons.c - Generate a synthetic icon corpus for benchmarks
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>		/* C89 */
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <sys/stat.h>		/* Gnulib/POSIX */
+#if HAVE_PNG_H
+# include <png.h>
+#else
+# if HAVE_LIBPNG_PNG_H
+#  include <libpng/png.h>
+# else
+#  if HAVE_LIBPNG10_PNG_H
+#   include <libpng10/png.h>
+#  else
+#   if HAVE_LIBPNG12_PNG_H
+#    include <libpng12/png.h>
+#   endif
+#  endif
+# endif
+#endif
+#include "minmax.h"		/* Gnulib */
+#include "progname.h"		/* Gnulib */
+#include "xalloc.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "common/error.h"
+#include "icotool/icoutils.h"
+
+/* The corpus is the same on every run and machine: all pixels come
+ * from a fixed-seed xorshift generator, not from rand(). */
+#define SEED UINT64_C(0x1c0751ede5eed)
+
+static const char *outdir;
+static uint64_t state;
+
+static uint32_t
+next_random(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (state * UINT64_C(0x2545f4914f6cdd1d)) >> 32;
+}
+
+static void
+fail_message(void *data, const char *message)
+{
+	die("%s", message);
+}
+
+/* Fill an image with a gradient and some noise. Images of 8 bits or
+ * less have at most that many colors, with fully transparent pixels in
+ * a corner. Images of 24 bits have only opaque or transparent pixels,
+ * and images of 32 bits have varying alpha.
+ */
+static void
+make_image(uint8_t *rgba, uint32_t width, uint32_t height, uint32_t bit_count)
+{
+	uint32_t palette[256];
+	uint32_t colors = 0;
+	uint32_t x, y;
+
+	if (bit_count <= 8) {
+		colors = (1 << bit_count) - 1;
+		for (x = 0; x < colors; x++)
+			palette[x] = next_random();
+	}
+
+	for (y = 0; y < height; y++) {
+		for (x = 0; x < width; x++) {
+			uint8_t *p = rgba + (y * width + x) * 4;
+			uint32_t noise = next_random();
+			bool transparent = (x + y < MIN(width, height) / 4);
+
+			if (colors != 0) {
+				uint32_t color = palette[((x * 7 + y * 3) / 5 + (noise & 1)) % colors];
+
+				p[0] = color;
+				p[1] = color >> 8;
+				p[2] = color >> 16;
+				p[3] = 255;
+			} else {
+				p[0] = x * 255 / width + (noise & 15);
+				p[1] = y * 255 / height + (noise >> 4 & 15);
+				p[2] = (x ^ y) + (noise >> 8 & 15);
+				p[3] = (bit_count == 32 ? (x + y) * 255 / (width + height) + 128 : 255);
+			}
+			if (transparent)
+				p[0] = p[1] = p[2] = p[3] = 0;
+		}
+	}
+}
+
+static void
+png_write_mem(png_structp png_ptr, png_bytep data, png_size_t size)
+{
+	IcoBuffer *buffer = png_get_io_ptr(png_ptr);
+
+	if (buffer->size + size > buffer->alloc) {
+		buffer->alloc = MAX(buffer->alloc * 2, buffer->size + size);
+		buffer->data = xrealloc(buffer->data, buffer->alloc);
+	}
+	memcpy(buffer->data + buffer->size, data, size);
+	buffer->size += size;
+}
+
+static void
+png_flush_mem(png_structp png_ptr)
+{
+}
+
+static void
+make_png(IcoBuffer *buffer, uint32_t width, uint32_t height)
+{
+	uint8_t *rgba = xnmalloc(height, width * 4);
+	png_structp png_ptr;
+	png_infop info_ptr;
+	uint32_t y;
+
+	make_image(rgba, width, height, 32);
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	info_ptr = (png_ptr != NULL ? png_create_info_struct(png_ptr) : NULL);
+	if (info_ptr == NULL || setjmp(png_jmpbuf(png_ptr)))
+		die("cannot encode PNG image");
+	png_set_write_fn(png_ptr, buffer, png_write_mem, png_flush_mem);
+	png_set_IHDR(png_ptr, info_ptr, width, height, 8, PNG_COLOR_TYPE_RGB_ALPHA,
+			PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+	for (y = 0; y < height; y++)
+		png_write_row(png_ptr, rgba + y * width * 4);
+	png_write_end(png_ptr, info_ptr);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	free(rgba);
+}
+
+static void
+write_file(const char *name, const void *data, size_t size)
+{
+	char *path = xasprintf("%s/%s", outdir, name);
+	FILE *out = fopen(path, "wb");
+
+	if (out == NULL)
+		die_errno("%s: cannot create file", path);
+	if ((size != 0 && fwrite(data, size, 1, out) != 1) || fclose(out) != 0)
+		die_errno("%s: cannot write to file", path);
+	free(path);
+}
+
+static IcoWriter *
+new_writer(int32_t bit_count, bool cursor)
+{
+	IcoWriterOptions options;
+
+	options.cursor = cursor;
+	options.hotspot_x = 3;
+	options.hotspot_y = 5;
+	options.alpha_threshold = 127;
+	options.bit_count = bit_count;
+	options.compression = ICO_COMPRESSION_BMP;
+	options.png_size = 256;
+	options.png_min_size = 0;
+	options.png_level = -1;
+	options.png_filters = -1;
+	return ico_writer_new(&options, fail_message, NULL);
+}
+
+static void
+add_image(IcoWriter *writer, uint32_t size, uint32_t bit_count)
+{
+	uint8_t *rgba = xnmalloc(size, size * 4);
+
+	make_image(rgba, size, size, bit_count);
+	ico_writer_add_rgba(writer, size, size, rgba, size * 4);
+	free(rgba);
+}
+
+static void
+add_png(IcoWriter *writer, uint32_t size)
+{
+	IcoBuffer png = { NULL, 0, 0 };
+
+	make_png(&png, size, size);
+	ico_writer_add_png(writer, png.data, png.size);
+	free(png.data);
+}
+
+static void
+finish_file(IcoWriter *writer, const char *name, IcoBuffer *keep)
+{
+	IcoBuffer buffer = { NULL, 0, 0 };
+
+	ico_writer_finish(writer, &buffer);
+	ico_writer_free(writer);
+	write_file(name, buffer.data, buffer.size);
+	if (keep != NULL)
+		*keep = buffer;
+	else
+		free(buffer.data);
+}
+
+static void
+put_le32(uint8_t *p, uint32_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+	p[2] = value >> 16;
+	p[3] = value >> 24;
+}
+
+/* Write broken variants of a valid icon file with at least three
+ * images, each with one thing wrong that readers must cope with. */
+static void
+write_malformed(const IcoBuffer *base)
+{
+	uint8_t *data = xmalloc(base->size);
+	uint8_t *entry1 = data + 6 + 16;
+	uint8_t *entry2 = data + 6 + 2 * 16;
+	uint32_t offset0 = base->data[18] | base->data[19] << 8 | base->data[20] << 16 | (uint32_t) base->data[21] << 24;
+
+#define VARIANT(name, change) \
+	do { \
+		memcpy(data, base->data, base->size); \
+		change; \
+		write_file("malformed-" name ".ico", data, base->size); \
+	} while (0)
+
+	VARIANT("offset-past-end", put_le32(entry2 + 12, base->size + 100));
+	VARIANT("shared-offset", put_le32(entry1 + 12, offset0));
+	VARIANT("huge-size", put_le32(entry1 + 8, 0x7fffffff));
+	VARIANT("bad-count", data[4] = 200);
+	VARIANT("zero-count", data[4] = 0);
+	VARIANT("bad-bit-count", data[offset0 + 14] = 7);
+	VARIANT("bad-header-size", put_le32(data + offset0, 12345));
+#undef VARIANT
+
+	write_file("malformed-truncated.ico", base->data, base->size * 3 / 5);
+	write_file("malformed-header-only.ico", base->data, 6 + 8);
+	free(data);
+}
+
+int
+main(int argc, char **argv)
+{
+	static const uint32_t bit_counts[] = { 1, 4, 8, 24, 32 };
+	static const uint32_t sizes[] = { 16, 24, 32, 48, 64, 128, 256 };
+	IcoBuffer base;
+	IcoWriter *writer;
+	char *name;
+	size_t c, d;
+
+	set_program_name(argv[0]);
+	if (argc != 2) {
+		fprintf(stderr, "Usage: %s DIRECTORY\n", program_name);
+		exit(1);
+	}
+	outdir = argv[1];
+	if (mkdir(outdir, 0777) < 0 && errno != EEXIST)
+		die_errno("%s: cannot create directory", outdir);
+	state = SEED;
+
+	/* One file per bit depth with every DIB size, and one file per
+	 * depth and size. */
+	for (c = 0; c < sizeof(bit_counts) / sizeof(*bit_counts); c++) {
+		writer = new_writer(bit_counts[c], false);
+		for (d = 0; d < sizeof(sizes) / sizeof(*sizes); d++)
+			add_image(writer, sizes[d], bit_counts[c]);
+		name = xasprintf("depth-%u.ico", bit_counts[c]);
+		finish_file(writer, name, NULL);
+		free(name);
+
+		for (d = 0; d < sizeof(sizes) / sizeof(*sizes); d++) {
+			writer = new_writer(bit_counts[c], false);
+			add_image(writer, sizes[d], bit_counts[c]);
+			name = xasprintf("single-%u-%u.ico", bit_counts[c], sizes[d]);
+			finish_file(writer, name, NULL);
+			free(name);
+		}
+	}
+
+	/* Vista icons mix DIBs with PNG images, which may be larger than
+	 * 256 pixels. */
+	writer = new_writer(32, false);
+	add_image(writer, 16, 32);
+	add_image(writer, 32, 32);
+	add_image(writer, 48, 32);
+	add_png(writer, 256);
+	add_png(writer, 512);
+	finish_file(writer, "vista.ico", &base);
+	free(base.data);
+
+	writer = new_writer(-1, true);
+	add_image(writer, 32, 32);
+	add_image(writer, 48, 8);
+	add_png(writer, 128);
+	finish_file(writer, "cursor.cur", NULL);
+
+	/* Large directories of small images of every depth. */
+	writer = new_writer(-1, false);
+	for (c = 0; c < 4096; c++)
+		add_image(writer, (c % 2 == 0 ? 16 : 32), bit_counts[c % 5]);
+	finish_file(writer, "many-4096.ico", NULL);
+
+	writer = new_writer(32, false);
+	add_image(writer, 16, 32);
+	add_image(writer, 32, 32);
+	add_image(writer, 48, 32);
+	finish_file(writer, "base.ico", &base);
+	write_malformed(&base);
+	free(base.data);
+
+	/* PNG images to create icons from. */
+	for (d = 0; d < sizeof(sizes) / sizeof(*sizes); d++) {
+		IcoBuffer png = { NULL, 0, 0 };
+
+		make_png(&png, sizes[d], sizes[d]);
+		name = xasprintf("source-%u.png", sizes[d]);
+		write_file(name, png.data, png.size);
+		free(png.data);
+		free(name);
+	}
+
+	return 0;
+}
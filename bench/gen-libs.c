@@ -0,0 +1,860 @@
+/* gen-libs.c - Generate PE and NE libraries with resources for benchmarks
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>		/* C89 */
+#include <getopt.h>		/* Gnulib/GNU Libc */
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <sys/stat.h>		/* Gnulib/POSIX */
+#include "minmax.h"		/* Gnulib */
+#include "progname.h"		/* Gnulib */
+#include "xalloc.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "common/error.h"
+#include "common/intutil.h"
+
+/* The files are written byte by byte rather than with the structures
+ * of win32.h, so that they do not share mistakes with wrestool. Like
+ * gen-icons, all data comes from a fixed-seed xorshift generator.
+ */
+#define SEED UINT64_C(0x1c0751ede5eed)
+
+#define RT_BITMAP	2
+#define RT_ICON		3
+#define RT_GROUP_ICON	14
+#define RT_CUSTOM	256	/* the first type of generated resources */
+#define LANG_BASE	1033
+
+#define PE_FILE_ALIGN	0x200
+#define PE_SECTION_ALIGN 0x1000
+#define NE_HEADER_OFFSET 0x80
+#define NE_MIN_SHIFT	4
+
+typedef enum {
+	FORMAT_PE32,
+	FORMAT_PE32_PLUS,
+	FORMAT_NE,
+} LibraryFormat;
+
+/* What goes into a library. Generated types each have `names'
+ * resources in `languages' languages of `data_size' bytes. Icons,
+ * bitmaps and languages other than the first are only in PE files. */
+typedef struct {
+	LibraryFormat format;
+	uint32_t types;
+	uint32_t names;
+	uint32_t languages;
+	bool string_names;	/* names are strings rather than numbers */
+	uint32_t data_size;
+	uint32_t icon_groups;	/* each with images of 16 to `icon_size' pixels */
+	uint32_t icon_size;
+	uint32_t bitmaps;	/* 24-bit, `bitmap_size' pixels square */
+	uint32_t bitmap_size;
+	uint32_t overlay;	/* bytes after the last section */
+	uint32_t virtual_size;	/* of the data section */
+} LibrarySpec;
+
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	size_t alloc;
+} Buffer;
+
+/* The resource tree, with the nodes of each level in one array. The
+ * children of a node follow those of the node before it. */
+typedef struct {
+	uint32_t id;
+	uint32_t count;
+} TypeNode;
+
+typedef struct {
+	uint32_t id;		/* number, or index of the string name */
+	bool string;
+	uint32_t count;
+} NameNode;
+
+typedef struct {
+	uint16_t lang;
+	size_t offset;		/* in the data buffer */
+	uint32_t size;
+} Leaf;
+
+typedef struct {
+	TypeNode *types;
+	size_t type_count;
+	size_t type_alloc;
+	NameNode *names;
+	size_t name_count;
+	size_t name_alloc;
+	Leaf *leaves;
+	size_t leaf_count;
+	size_t leaf_alloc;
+	Buffer data;
+} ResourceTree;
+
+static const char *format_names[] = { "pe32", "pe32+", "ne" };
+static const uint32_t icon_sizes[] = { 16, 24, 32, 48, 64, 128, 256 };
+static uint64_t state;
+
+static uint32_t
+next_random(void)
+{
+	state ^= state >> 12;
+	state ^= state << 25;
+	state ^= state >> 27;
+	return (state * UINT64_C(0x2545f4914f6cdd1d)) >> 32;
+}
+
+static uint8_t *
+buffer_grow(Buffer *buffer, size_t size)
+{
+	uint8_t *p;
+
+	if (buffer->size + size > buffer->alloc) {
+		buffer->alloc = MAX(buffer->alloc * 2, buffer->size + size);
+		buffer->data = xrealloc(buffer->data, buffer->alloc);
+	}
+	p = buffer->data + buffer->size;
+	memset(p, 0, size);
+	buffer->size += size;
+	return p;
+}
+
+static void
+buffer_align(Buffer *buffer, size_t align)
+{
+	if (buffer->size % align != 0)
+		buffer_grow(buffer, align - buffer->size % align);
+}
+
+static void
+put_le16(uint8_t *p, uint16_t value)
+{
+	p[0] = value;
+	p[1] = value >> 8;
+}
+
+static void
+put_le32(uint8_t *p, uint32_t value)
+{
+	put_le16(p, value);
+	put_le16(p + 2, value >> 16);
+}
+
+static void
+put_le64(uint8_t *p, uint64_t value)
+{
+	put_le32(p, value);
+	put_le32(p + 4, value >> 32);
+}
+
+static size_t
+align_up(size_t value, size_t align)
+{
+	return (value + align - 1) / align * align;
+}
+
+static void
+add_type(ResourceTree *tree, uint32_t id)
+{
+	if (tree->type_count >= tree->type_alloc)
+		tree->types = x2nrealloc(tree->types, &tree->type_alloc, sizeof(TypeNode));
+	tree->types[tree->type_count].id = id;
+	tree->types[tree->type_count].count = 0;
+	tree->type_count++;
+}
+
+static void
+add_name(ResourceTree *tree, uint32_t id, bool string)
+{
+	if (tree->name_count >= tree->name_alloc)
+		tree->names = x2nrealloc(tree->names, &tree->name_alloc, sizeof(NameNode));
+	tree->names[tree->name_count].id = id;
+	tree->names[tree->name_count].string = string;
+	tree->names[tree->name_count].count = 0;
+	tree->name_count++;
+	tree->types[tree->type_count - 1].count++;
+}
+
+/* Add a resource of `size' bytes, returning its data to be filled in. */
+static uint8_t *
+add_leaf(ResourceTree *tree, uint16_t lang, uint32_t size)
+{
+	Leaf *leaf;
+
+	if (tree->leaf_count >= tree->leaf_alloc)
+		tree->leaves = x2nrealloc(tree->leaves, &tree->leaf_alloc, sizeof(Leaf));
+	leaf = &tree->leaves[tree->leaf_count++];
+	tree->names[tree->name_count - 1].count++;
+	buffer_align(&tree->data, 8);
+	leaf->lang = lang;
+	leaf->offset = tree->data.size;
+	leaf->size = size;
+	return buffer_grow(&tree->data, size);
+}
+
+static char *
+string_name(uint32_t index)
+{
+	return xasprintf("RES%05u", index);
+}
+
+/* Write a 32-bit icon image with a gradient, and a mask with a
+ * transparent border. */
+static void
+make_icon_image(uint8_t *p, uint32_t size)
+{
+	uint32_t mask_row = (size + 31) / 32 * 4;
+	uint32_t x, y;
+
+	put_le32(p, 40);
+	put_le32(p + 4, size);
+	put_le32(p + 8, size * 2);
+	put_le16(p + 12, 1);
+	put_le16(p + 14, 32);
+	put_le32(p + 20, size * size * 4 + size * mask_row);
+	p += 40;
+	for (y = 0; y < size; y++) {
+		for (x = 0; x < size; x++, p += 4) {
+			bool border = (x == 0 || y == 0 || x == size - 1 || y == size - 1);
+
+			p[0] = x * 255 / size;
+			p[1] = y * 255 / size;
+			p[2] = next_random();
+			p[3] = (border ? 0 : 255);
+		}
+	}
+	for (y = 0; y < size; y++, p += mask_row) {
+		if (y == 0 || y == size - 1) {
+			memset(p, 0xff, mask_row);
+		} else {
+			p[0] |= 0x80;
+			p[(size - 1) / 8] |= 0x80 >> ((size - 1) % 8);
+		}
+	}
+}
+
+static void
+make_bitmap(uint8_t *p, uint32_t size)
+{
+	uint32_t row = align_up(size * 3, 4);
+	uint32_t x, y;
+
+	put_le32(p, 40);
+	put_le32(p + 4, size);
+	put_le32(p + 8, size);
+	put_le16(p + 12, 1);
+	put_le16(p + 14, 24);
+	put_le32(p + 20, row * size);
+	p += 40;
+	for (y = 0; y < size; y++, p += row) {
+		for (x = 0; x < size; x++) {
+			p[x * 3] = x ^ y;
+			p[x * 3 + 1] = next_random();
+			p[x * 3 + 2] = y;
+		}
+	}
+}
+
+/* Build the resource tree of a library, with types, names and
+ * languages in the order they are stored: by number, and with string
+ * names first and in order. */
+static void
+build_tree(ResourceTree *tree, const LibrarySpec *spec)
+{
+	uint32_t languages = (spec->format == FORMAT_NE ? 1 : spec->languages);
+	uint32_t image_count = 0;
+	uint32_t t, n, l, c;
+
+	memset(tree, 0, sizeof(ResourceTree));
+	for (c = 0; c < sizeof(icon_sizes) / sizeof(*icon_sizes) && icon_sizes[c] <= spec->icon_size; c++)
+		image_count++;
+
+	if (spec->bitmaps != 0) {
+		uint32_t size = 40 + align_up(spec->bitmap_size * 3, 4) * spec->bitmap_size;
+
+		add_type(tree, RT_BITMAP);
+		for (n = 0; n < spec->bitmaps; n++) {
+			add_name(tree, n + 1, false);
+			make_bitmap(add_leaf(tree, LANG_BASE, size), spec->bitmap_size);
+		}
+	}
+
+	if (spec->icon_groups != 0 && image_count != 0) {
+		add_type(tree, RT_ICON);
+		for (n = 0; n < spec->icon_groups * image_count; n++) {
+			uint32_t size = icon_sizes[n % image_count];
+			uint32_t bytes = 40 + size * size * 4 + (size + 31) / 32 * 4 * size;
+
+			add_name(tree, n + 1, false);
+			make_icon_image(add_leaf(tree, LANG_BASE, bytes), size);
+		}
+
+		add_type(tree, RT_GROUP_ICON);
+		for (n = 0; n < spec->icon_groups; n++) {
+			uint8_t *p;
+
+			add_name(tree, n + 1, false);
+			p = add_leaf(tree, LANG_BASE, 6 + 14 * image_count);
+			put_le16(p + 2, 1);
+			put_le16(p + 4, image_count);
+			for (c = 0, p += 6; c < image_count; c++, p += 14) {
+				uint32_t size = icon_sizes[c];
+
+				p[0] = (size >= 256 ? 0 : size);
+				p[1] = (size >= 256 ? 0 : size);
+				put_le16(p + 4, 1);
+				put_le16(p + 6, 32);
+				put_le32(p + 8, 40 + size * size * 4 + (size + 31) / 32 * 4 * size);
+				put_le16(p + 12, n * image_count + c + 1);
+			}
+		}
+	}
+
+	for (t = 0; t < spec->types; t++) {
+		add_type(tree, RT_CUSTOM + t);
+		for (n = 0; n < spec->names; n++) {
+			add_name(tree, n + 1, spec->string_names);
+			for (l = 0; l < languages; l++) {
+				uint8_t *p = add_leaf(tree, LANG_BASE + l, spec->data_size);
+
+				for (c = 0; c < spec->data_size; c++)
+					p[c] = next_random();
+			}
+		}
+	}
+}
+
+static void
+free_tree(ResourceTree *tree)
+{
+	free(tree->types);
+	free(tree->names);
+	free(tree->leaves);
+	free(tree->data.data);
+}
+
+/* Write the resource section of a PE file, for a section at virtual
+ * address `rva'. Directories come first, then data entries, then
+ * string names, then the data of the resources. */
+static void
+write_pe_resources(Buffer *out, const ResourceTree *tree, uint32_t rva)
+{
+	size_t dir_size = 16 + 8 * tree->type_count + 16 * tree->type_count + 8 * tree->name_count
+			+ 16 * tree->name_count + 8 * tree->leaf_count;
+	size_t entries = dir_size;
+	size_t strings = entries + 16 * tree->leaf_count;
+	size_t data;
+	size_t type_dir = 16 + 8 * tree->type_count;
+	size_t name_dir = type_dir + 16 * tree->type_count + 8 * tree->name_count;
+	size_t name = 0;
+	size_t leaf = 0;
+	size_t t, n, l;
+	uint8_t *base;
+	Buffer names = { NULL, 0, 0 };
+	size_t *name_offsets = xnmalloc(tree->name_count + 1, sizeof(size_t));
+
+	for (n = 0; n < tree->name_count; n++) {
+		name_offsets[n] = strings + names.size;
+		if (tree->names[n].string) {
+			char *str = string_name(tree->names[n].id);
+			size_t len = strlen(str);
+			uint8_t *p = buffer_grow(&names, 2 + 2 * len);
+
+			put_le16(p, len);
+			for (l = 0; l < len; l++)
+				put_le16(p + 2 + 2 * l, (unsigned char) str[l]);
+			free(str);
+		}
+	}
+	data = align_up(strings + names.size, 8);
+
+	base = buffer_grow(out, data + tree->data.size);
+	if (names.size != 0)
+		memcpy(base + strings, names.data, names.size);
+	if (tree->data.size != 0)
+		memcpy(base + data, tree->data.data, tree->data.size);
+	free(names.data);
+
+	put_le16(base + 14, tree->type_count);
+	for (t = 0; t < tree->type_count; t++) {
+		const TypeNode *type = &tree->types[t];
+		uint8_t *dir = base + type_dir;
+		size_t named = 0;
+
+		put_le32(base + 16 + 8 * t, type->id);
+		put_le32(base + 16 + 8 * t + 4, 0x80000000 | type_dir);
+		for (n = 0; n < type->count; n++)
+			named += tree->names[name + n].string;
+		put_le16(dir + 12, named);
+		put_le16(dir + 14, type->count - named);
+
+		for (n = 0; n < type->count; n++, name++) {
+			const NameNode *node = &tree->names[name];
+			uint8_t *ldir = base + name_dir;
+
+			put_le32(dir + 16 + 8 * n, (node->string ? 0x80000000 | name_offsets[name] : node->id));
+			put_le32(dir + 16 + 8 * n + 4, 0x80000000 | name_dir);
+			put_le16(ldir + 14, node->count);
+			for (l = 0; l < node->count; l++, leaf++) {
+				uint8_t *entry = base + entries + 16 * leaf;
+
+				put_le32(ldir + 16 + 8 * l, tree->leaves[leaf].lang);
+				put_le32(ldir + 16 + 8 * l + 4, entries + 16 * leaf);
+				put_le32(entry, rva + data + tree->leaves[leaf].offset);
+				put_le32(entry + 4, tree->leaves[leaf].size);
+			}
+			name_dir += 16 + 8 * node->count;
+		}
+		type_dir += 16 + 8 * type->count;
+	}
+	free(name_offsets);
+}
+
+static void
+write_section_header(uint8_t *p, const char *name, uint32_t virtual_size, uint32_t rva,
+		uint32_t raw_size, uint32_t raw_offset, uint32_t characteristics)
+{
+	memcpy(p, name, strlen(name));
+	put_le32(p + 8, virtual_size);
+	put_le32(p + 12, rva);
+	put_le32(p + 16, raw_size);
+	put_le32(p + 20, raw_offset);
+	put_le32(p + 36, characteristics);
+}
+
+static void
+write_dos_header(Buffer *out, uint32_t lfanew)
+{
+	uint8_t *p = buffer_grow(out, lfanew);
+
+	p[0] = 'M';
+	p[1] = 'Z';
+	put_le16(p + 2, 0x90);
+	put_le16(p + 4, 3);
+	put_le16(p + 8, 4);
+	put_le16(p + 12, 0xffff);
+	put_le16(p + 16, 0xb8);
+	put_le16(p + 24, 0x40);
+	put_le32(p + 0x3c, lfanew);
+}
+
+/* Write a PE file with the sections .text, .rsrc and .data, each at a
+ * different offset in the file than in memory. */
+static void
+write_pe(Buffer *out, const LibrarySpec *spec, const ResourceTree *tree)
+{
+	bool plus = (spec->format == FORMAT_PE32_PLUS);
+	uint32_t optional_size = (plus ? 240 : 224);
+	uint32_t header_size = align_up(0x80 + 24 + optional_size + 3 * 40, PE_FILE_ALIGN);
+	uint32_t text_rva = PE_SECTION_ALIGN;
+	uint32_t rsrc_rva = text_rva + PE_SECTION_ALIGN;
+	uint32_t rsrc_size, rsrc_raw, data_rva, data_virtual;
+	uint32_t text_offset = header_size;
+	uint32_t rsrc_offset = text_offset + PE_FILE_ALIGN;
+	uint32_t data_offset;
+	uint8_t *p, *opt;
+	Buffer rsrc = { NULL, 0, 0 };
+
+	write_pe_resources(&rsrc, tree, rsrc_rva);
+	rsrc_size = rsrc.size;
+	rsrc_raw = align_up(rsrc_size, PE_FILE_ALIGN);
+	data_rva = align_up(rsrc_rva + rsrc_size, PE_SECTION_ALIGN);
+	data_offset = rsrc_offset + rsrc_raw;
+	data_virtual = MAX(spec->virtual_size, PE_FILE_ALIGN);
+
+	write_dos_header(out, 0x80);
+	p = buffer_grow(out, header_size - 0x80);
+	memcpy(p, "PE\0\0", 4);
+	put_le16(p + 4, (plus ? 0x8664 : 0x14c));
+	put_le16(p + 6, 3);
+	put_le16(p + 20, optional_size);
+	put_le16(p + 22, (plus ? 0x2022 : 0x2102));
+
+	opt = p + 24;
+	put_le16(opt, (plus ? 0x20b : 0x10b));
+	opt[2] = 6;
+	put_le32(opt + 4, PE_FILE_ALIGN);
+	put_le32(opt + 8, rsrc_raw + PE_FILE_ALIGN);
+	put_le32(opt + 20, text_rva);
+	if (plus) {
+		put_le64(opt + 24, UINT64_C(0x180000000));
+	} else {
+		put_le32(opt + 24, data_rva);
+		put_le32(opt + 28, 0x10000000);
+	}
+	put_le32(opt + 32, PE_SECTION_ALIGN);
+	put_le32(opt + 36, PE_FILE_ALIGN);
+	put_le16(opt + 40, 4);
+	put_le16(opt + 48, 4);
+	put_le32(opt + 56, align_up((uint64_t) data_rva + data_virtual, PE_SECTION_ALIGN));
+	put_le32(opt + 60, header_size);
+	put_le16(opt + 68, 2);
+	if (plus) {
+		put_le64(opt + 72, 0x100000);
+		put_le64(opt + 80, 0x1000);
+		put_le64(opt + 88, 0x100000);
+		put_le64(opt + 96, 0x1000);
+		put_le32(opt + 108, 16);
+		opt += 112;
+	} else {
+		put_le32(opt + 72, 0x100000);
+		put_le32(opt + 76, 0x1000);
+		put_le32(opt + 80, 0x100000);
+		put_le32(opt + 84, 0x1000);
+		put_le32(opt + 92, 16);
+		opt += 96;
+	}
+	put_le32(opt + 2 * 8, rsrc_rva);
+	put_le32(opt + 2 * 8 + 4, rsrc_size);
+
+	p += 24 + optional_size;
+	write_section_header(p, ".text", PE_FILE_ALIGN, text_rva, PE_FILE_ALIGN, text_offset, 0x60000020);
+	write_section_header(p + 40, ".rsrc", rsrc_size, rsrc_rva, rsrc_raw, rsrc_offset, 0x40000040);
+	write_section_header(p + 80, ".data", data_virtual, data_rva, PE_FILE_ALIGN, data_offset, 0xc0000040);
+
+	p = buffer_grow(out, PE_FILE_ALIGN);
+	memset(p, 0xcc, PE_FILE_ALIGN);
+	p[0] = 0xc3;
+	p = buffer_grow(out, rsrc_raw);
+	memcpy(p, rsrc.data, rsrc_size);
+	buffer_grow(out, PE_FILE_ALIGN);
+	free(rsrc.data);
+}
+
+/* Write an NE file, with the resource table right after the header
+ * and each resource aligned to the alignment shift. The shift is the
+ * smallest that lets the offsets of all resources fit in 16 bits. */
+static void
+write_ne(Buffer *out, const LibrarySpec *spec, const ResourceTree *tree)
+{
+	static const char module_name[] = "BENCH";
+	size_t table_size, strings_size = 0, restab_size, header_end;
+	uint32_t shift, data_start, limit;
+	uint8_t *ne, *p, *names;
+	size_t t, n, leaf, name;
+
+	for (n = 0; n < tree->name_count; n++) {
+		if (tree->names[n].string) {
+			char *str = string_name(tree->names[n].id);
+
+			strings_size += 1 + strlen(str);
+			free(str);
+		}
+	}
+	table_size = 2 + 8 * tree->type_count + 12 * tree->leaf_count + 2 + strings_size + 1;
+	restab_size = 1 + strlen(module_name) + 2 + 1;
+	if (0x40 + table_size + restab_size > 0x8000)
+		die("resource table of %zu bytes is too large for an NE file", table_size);
+	header_end = NE_HEADER_OFFSET + 0x40 + table_size + restab_size + 2 + 1;
+
+	for (shift = NE_MIN_SHIFT; ; shift++) {
+		data_start = align_up(header_end, 1 << shift);
+		limit = data_start;
+		for (leaf = 0; leaf < tree->leaf_count; leaf++)
+			limit += align_up(tree->leaves[leaf].size, 1 << shift);
+		if ((limit >> shift) <= 0xffff || shift == 15)
+			break;
+	}
+	if ((limit >> shift) > 0xffff)
+		die("resource data of %zu bytes is too large for an NE file", tree->data.size);
+
+	write_dos_header(out, NE_HEADER_OFFSET);
+	ne = buffer_grow(out, limit - NE_HEADER_OFFSET);
+	ne[0] = 'N';
+	ne[1] = 'E';
+	ne[2] = 5;
+	ne[3] = 10;
+	put_le16(ne + 0x0c, 0x8300);
+	put_le16(ne + 0x22, 0x40);
+	put_le16(ne + 0x24, 0x40);
+	put_le16(ne + 0x26, 0x40 + table_size);
+	put_le16(ne + 0x28, 0x40 + table_size + restab_size);
+	put_le16(ne + 0x2a, 0x40 + table_size + restab_size);
+	put_le16(ne + 0x04, 0x40 + table_size + restab_size);
+	put_le16(ne + 0x06, 2);
+	put_le32(ne + 0x2c, NE_HEADER_OFFSET + 0x40 + table_size + restab_size + 2);
+	put_le16(ne + 0x32, shift);
+	put_le16(ne + 0x34, tree->leaf_count);
+	ne[0x36] = 2;
+	put_le16(ne + 0x3e, 0x030a);
+
+	p = ne + 0x40;
+	put_le16(p, shift);
+	p += 2;
+	names = ne + 0x40 + 2 + 8 * tree->type_count + 12 * tree->leaf_count + 2;
+	for (t = 0, name = 0, leaf = 0; t < tree->type_count; t++) {
+		const TypeNode *type = &tree->types[t];
+
+		put_le16(p, 0x8000 | type->id);
+		put_le16(p + 2, type->count);
+		p += 8;
+		for (n = 0; n < type->count; n++, name++, leaf++, p += 12) {
+			const NameNode *node = &tree->names[name];
+			const Leaf *res = &tree->leaves[leaf];
+
+			memcpy(ne - NE_HEADER_OFFSET + data_start, tree->data.data + res->offset, res->size);
+			put_le16(p, data_start >> shift);
+			put_le16(p + 2, align_up(res->size, 1 << shift) >> shift);
+			data_start += align_up(res->size, 1 << shift);
+			put_le16(p + 4, 0x30);
+			if (node->string) {
+				char *str = string_name(node->id);
+
+				put_le16(p + 6, names - (ne + 0x40));
+				names[0] = strlen(str);
+				memcpy(names + 1, str, names[0]);
+				names += 1 + names[0];
+				free(str);
+			} else {
+				put_le16(p + 6, 0x8000 | node->id);
+			}
+		}
+	}
+
+	p = ne + 0x40 + table_size;
+	p[0] = strlen(module_name);
+	memcpy(p + 1, module_name, p[0]);
+}
+
+static void
+write_library(const char *filename, const LibrarySpec *spec)
+{
+	ResourceTree tree;
+	Buffer out = { NULL, 0, 0 };
+	FILE *file;
+	size_t c;
+
+	state = SEED;
+	build_tree(&tree, spec);
+	if (spec->format == FORMAT_NE)
+		write_ne(&out, spec, &tree);
+	else
+		write_pe(&out, spec, &tree);
+	free_tree(&tree);
+
+	if (spec->overlay != 0) {
+		uint8_t *p = buffer_grow(&out, spec->overlay);
+
+		for (c = 0; c + 4 <= spec->overlay; c += 4)
+			put_le32(p + c, next_random());
+	}
+
+	file = fopen(filename, "wb");
+	if (file == NULL)
+		die_errno("%s: cannot create file", filename);
+	if (fwrite(out.data, out.size, 1, file) != 1 || fclose(file) != 0)
+		die_errno("%s: cannot write to file", filename);
+	free(out.data);
+}
+
+static void
+init_spec(LibrarySpec *spec, LibraryFormat format)
+{
+	memset(spec, 0, sizeof(LibrarySpec));
+	spec->format = format;
+	spec->types = 1;
+	spec->names = 4;
+	spec->languages = 1;
+	spec->data_size = 256;
+	spec->icon_groups = 1;
+	spec->icon_size = 48;
+	spec->bitmaps = 1;
+	spec->bitmap_size = 64;
+}
+
+/* Write the default corpus. Each file varies one thing of a small
+ * library, so that its cost can be seen on its own. */
+static void
+write_corpus(const char *dirname)
+{
+	LibrarySpec spec;
+	char *name;
+	int f;
+
+	if (mkdir(dirname, 0777) < 0 && errno != EEXIST)
+		die_errno("%s: cannot create directory", dirname);
+
+#define LIBRARY(filename, format, change) \
+	do { \
+		init_spec(&spec, format); \
+		change; \
+		name = xasprintf("%s/%s", dirname, filename); \
+		write_library(name, &spec); \
+		free(name); \
+	} while (0)
+
+	for (f = FORMAT_PE32; f <= FORMAT_NE; f++) {
+		const char *prefix = (f == FORMAT_PE32 ? "pe32" : (f == FORMAT_PE32_PLUS ? "pe32plus" : "ne"));
+		char *filename;
+
+#define FORMAT_LIBRARY(suffix, change) \
+	do { \
+		filename = xasprintf("%s-%s.dll", prefix, suffix); \
+		LIBRARY(filename, f, change); \
+		free(filename); \
+	} while (0)
+
+		FORMAT_LIBRARY("small", (void) 0);
+		FORMAT_LIBRARY("names-2000", spec.names = 2000);
+		FORMAT_LIBRARY("types-1000", (spec.types = 1000, spec.names = 2));
+		FORMAT_LIBRARY("strings-1000", (spec.names = 1000, spec.string_names = true));
+		if (f != FORMAT_NE) {
+			FORMAT_LIBRARY("languages-10000", (spec.types = 10, spec.names = 100, spec.languages = 10));
+			FORMAT_LIBRARY("icons-256", (spec.icon_groups = 16, spec.icon_size = 256));
+			FORMAT_LIBRARY("bitmaps-512", (spec.bitmaps = 8, spec.bitmap_size = 512));
+		}
+#undef FORMAT_LIBRARY
+	}
+
+	LIBRARY("pe32-overlay-64m.exe", FORMAT_PE32, spec.overlay = 64 << 20);
+	LIBRARY("pe32-vsize-256m.dll", FORMAT_PE32, spec.virtual_size = 256 << 20);
+#undef LIBRARY
+}
+
+static struct option long_options[] = {
+	{ "output",		required_argument,	NULL, 'o' },
+	{ "format",		required_argument,	NULL, 'f' },
+	{ "types",		required_argument,	NULL, 't' },
+	{ "names",		required_argument,	NULL, 'n' },
+	{ "languages",		required_argument,	NULL, 'l' },
+	{ "string-names",	no_argument,		NULL, 's' },
+	{ "data-size",		required_argument,	NULL, 'd' },
+	{ "icon-groups",	required_argument,	NULL, 'g' },
+	{ "icon-size",		required_argument,	NULL, 'i' },
+	{ "bitmaps",		required_argument,	NULL, 'b' },
+	{ "bitmap-size",	required_argument,	NULL, 'B' },
+	{ "overlay",		required_argument,	NULL, 'O' },
+	{ "virtual-size",	required_argument,	NULL, 'V' },
+	{ "help",		no_argument,		NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+static void
+display_help(void)
+{
+	printf("Usage: %s DIRECTORY\n", program_name);
+	printf("  or:  %s --output=FILE [OPTION]...\n", program_name);
+	printf("Write a corpus of PE and NE libraries with resources to DIRECTORY, or one\n"
+	       "library to FILE.\n\n");
+	printf("  -o, --output=FILE        write one library to FILE\n"
+	       "  -f, --format=FORMAT      pe32, pe32+ or ne (default pe32)\n"
+	       "  -t, --types=N            number of generated resource types (1)\n"
+	       "  -n, --names=N            number of names of each type (4)\n"
+	       "  -l, --languages=N        number of languages of each name (1)\n"
+	       "  -s, --string-names       use string names instead of numbers\n"
+	       "  -d, --data-size=BYTES    size of each generated resource (256)\n"
+	       "  -g, --icon-groups=N      number of group icons (1)\n"
+	       "  -i, --icon-size=PIXELS   size of the largest image of each group (48)\n"
+	       "  -b, --bitmaps=N          number of bitmaps (1)\n"
+	       "  -B, --bitmap-size=PIXELS width and height of each bitmap (64)\n"
+	       "  -O, --overlay=BYTES      data to append after the last section (0)\n"
+	       "  -V, --virtual-size=BYTES virtual size of the data section (0)\n"
+	       "      --help               display this help and exit\n");
+}
+
+static uint32_t
+parse_count(const char *value)
+{
+	uint32_t count;
+
+	if (!parse_uint32(value, &count))
+		die("invalid number: %s", value);
+	return count;
+}
+
+int
+main(int argc, char **argv)
+{
+	LibrarySpec spec;
+	const char *output = NULL;
+	int c;
+
+	set_program_name(argv[0]);
+	init_spec(&spec, FORMAT_PE32);
+	while ((c = getopt_long(argc, argv, "o:f:t:n:l:sd:g:i:b:B:O:V:", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'o':
+			output = optarg;
+			break;
+		case 'f':
+			for (spec.format = FORMAT_PE32; spec.format <= FORMAT_NE; spec.format++) {
+				if (strcmp(optarg, format_names[spec.format]) == 0)
+					break;
+			}
+			if (spec.format > FORMAT_NE)
+				die("invalid format: %s", optarg);
+			break;
+		case 't':
+			spec.types = parse_count(optarg);
+			break;
+		case 'n':
+			spec.names = parse_count(optarg);
+			break;
+		case 'l':
+			spec.languages = parse_count(optarg);
+			break;
+		case 's':
+			spec.string_names = true;
+			break;
+		case 'd':
+			spec.data_size = parse_count(optarg);
+			break;
+		case 'g':
+			spec.icon_groups = parse_count(optarg);
+			break;
+		case 'i':
+			spec.icon_size = parse_count(optarg);
+			break;
+		case 'b':
+			spec.bitmaps = parse_count(optarg);
+			break;
+		case 'B':
+			spec.bitmap_size = parse_count(optarg);
+			break;
+		case 'O':
+			spec.overlay = parse_count(optarg);
+			break;
+		case 'V':
+			spec.virtual_size = parse_count(optarg);
+			break;
+		case 'h':
+			display_help();
+			exit(0);
+		default:
+			fprintf(stderr, "Try `%s --help' for more information.\n", program_name);
+			exit(1);
+		}
+	}
+
+	if (output != NULL && optind == argc) {
+		if (spec.types > 0x8000 - RT_CUSTOM || spec.names > 0x7fff)
+			die("too many types or names");
+		write_library(output, &spec);
+	} else if (output == NULL && argc - optind == 1) {
+		write_corpus(argv[optind]);
+	} else {
+		fprintf(stderr, "Try `%s --help' for more information.\n", program_name);
+		exit(1);
+	}
+	return 0;
+}
@@ -0,0 +1,333 @@
+/* icobench.c - Time icotool operations on a corpus of icon files
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <dirent.h>		/* POSIX */
+#include <getopt.h>		/* Gnulib/GNU Libc */
+#include <inttypes.h>		/* C99 */
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <time.h>		/* POSIX */
+#include <sys/resource.h>	/* POSIX */
+#include <sys/stat.h>		/* POSIX */
+#include "progname.h"		/* Gnulib */
+#include "xalloc.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "common/error.h"
+#include "common/intutil.h"
+#include "common/string-utils.h"
+#include "icotool/icotool.h"
+
+/* Each benchmark runs in full over the corpus until at least
+ * `min_time' seconds have passed, and at least once. Output is one
+ * JSON object per benchmark on a line of its own, so that the results
+ * of different builds can be compared with a script.
+ */
+typedef struct {
+	const char *name;
+	uint64_t bytes;		/* input bytes processed per iteration */
+	uint64_t images;	/* images read or written per iteration */
+	uint64_t messages;	/* warnings from the icon library per iteration */
+} Benchmark;
+
+static char **icon_files;
+static size_t icon_file_count;
+static char **png_files;
+static size_t png_file_count;
+static double min_time = 1.0;
+static ThreadPool *pool = NULL;
+static uint64_t message_count;
+
+static struct option long_options[] = {
+	{ "jobs",	required_argument,	NULL, 'j' },
+	{ "min-time",	required_argument,	NULL, 't' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+/* Messages about the malformed files of the corpus are expected, and
+ * only counted. This replaces the function in icotool's main.c. */
+void
+warn_message(void *data, const char *message)
+{
+	message_count++;
+}
+
+static double
+clock_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Reset the peak resident set size, if the system supports it, so that
+ * each benchmark reports its own peak rather than the largest so far.
+ */
+static void
+reset_peak_rss(void)
+{
+	FILE *file = fopen("/proc/self/clear_refs", "w");
+
+	if (file != NULL) {
+		fputs("5", file);
+		fclose(file);
+	}
+}
+
+/* Return the peak resident set size in kilobytes. */
+static long
+peak_rss(void)
+{
+	struct rusage usage;
+	FILE *file;
+	char line[256];
+	long kb = -1;
+
+	file = fopen("/proc/self/status", "r");
+	if (file != NULL) {
+		while (fgets(line, sizeof(line), file) != NULL) {
+			if (strncmp(line, "VmHWM:", 6) == 0) {
+				kb = strtol(line + 6, NULL, 10);
+				break;
+			}
+		}
+		fclose(file);
+	}
+	if (kb < 0 && getrusage(RUSAGE_SELF, &usage) == 0)
+		kb = usage.ru_maxrss;
+	return kb;
+}
+
+static uint64_t
+file_size(const char *name)
+{
+	struct stat statbuf;
+
+	if (stat(name, &statbuf) < 0)
+		die_errno("%s: cannot get file size", name);
+	return statbuf.st_size;
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+/* Find the icon and cursor files of the corpus, and the PNG files to
+ * create icons from, in name order. */
+static void
+read_corpus(const char *dirname)
+{
+	size_t icon_alloc = 0;
+	size_t png_alloc = 0;
+	struct dirent *dirent;
+	DIR *dir;
+
+	dir = opendir(dirname);
+	if (dir == NULL)
+		die_errno("%s: cannot open directory", dirname);
+	while ((dirent = readdir(dir)) != NULL) {
+		char *name = dirent->d_name;
+
+		if (ends_with_nocase(name, ".ico") || ends_with_nocase(name, ".cur")) {
+			if (icon_file_count >= icon_alloc)
+				icon_files = x2nrealloc(icon_files, &icon_alloc, sizeof(char *));
+			icon_files[icon_file_count++] = xasprintf("%s/%s", dirname, name);
+		} else if (ends_with_nocase(name, ".png")) {
+			if (png_file_count >= png_alloc)
+				png_files = x2nrealloc(png_files, &png_alloc, sizeof(char *));
+			png_files[png_file_count++] = xasprintf("%s/%s", dirname, name);
+		}
+	}
+	closedir(dir);
+	if (icon_file_count == 0)
+		die("%s: no icon files found (run gen-icons first)", dirname);
+	qsort(icon_files, icon_file_count, sizeof(char *), compare_names);
+	qsort(png_files, png_file_count, sizeof(char *), compare_names);
+}
+
+/* Read the directory and headers of every icon file, like --list. */
+static void
+run_list(Benchmark *bench)
+{
+	size_t c;
+
+	for (c = 0; c < icon_file_count; c++) {
+		FILE *in = fopen(icon_files[c], "rb");
+		IconFile icf;
+		IcoEntry entry;
+
+		if (in == NULL)
+			die_errno("%s: cannot open file", icon_files[c]);
+		if (icon_file_open(&icf, in)) {
+			while (ico_reader_next(icf.reader, &entry) > 0)
+				bench->images++;
+			icon_file_close(&icf);
+		}
+		bench->bytes += file_size(icon_files[c]);
+		fclose(in);
+	}
+}
+
+/* Extract every image as PNG into a tar archive written to /dev/null,
+ * so that the time of creating output files is not counted. */
+static void
+run_extract(Benchmark *bench)
+{
+	ExtractOptions options;
+	Archive *archive;
+	FILE *out;
+	size_t c;
+
+	memset(&options, 0, sizeof(options));
+	options.format = EXTRACT_FORMAT_PNG;
+	png_options_set_profile(&options.png, "balanced");
+	out = fopen("/dev/null", "wb");
+	if (out == NULL)
+		die_errno("/dev/null: cannot open file");
+	archive = archive_new(out, "/dev/null", ARCHIVE_FORMAT_TAR);
+
+	for (c = 0; c < icon_file_count; c++) {
+		FILE *in = fopen(icon_files[c], "rb");
+		Extractor *ex;
+		IconFile icf;
+		IcoEntry entry;
+
+		if (in == NULL)
+			die_errno("%s: cannot open file", icon_files[c]);
+		if (icon_file_open(&icf, in)) {
+			ex = extractor_new(&icf, icon_files[c], &options, pool, archive, NULL);
+			while (ico_reader_next(icf.reader, &entry) > 0) {
+				if (!extractor_add(ex, &icf, &entry, xasprintf("%d.png", entry.index)))
+					break;
+				bench->images++;
+			}
+			extractor_finish(ex);
+			icon_file_close(&icf);
+		}
+		bench->bytes += file_size(icon_files[c]);
+		fclose(in);
+	}
+	archive_finish(archive);
+	fclose(out);
+}
+
+static FILE *
+null_outfile_gen(char **outname)
+{
+	*outname = xstrdup("/dev/null");
+	return fopen("/dev/null", "wb");
+}
+
+/* Create one icon from all PNG files, converting each to a DIB. */
+static void
+run_create(Benchmark *bench)
+{
+	IcoWriterOptions options;
+	size_t c;
+
+	memset(&options, 0, sizeof(options));
+	options.alpha_threshold = 127;
+	options.bit_count = -1;
+	options.compression = ICO_COMPRESSION_BMP;
+	options.png_level = -1;
+	options.png_filters = -1;
+	if (!create_icon(png_file_count, png_files, 0, NULL, null_outfile_gen, &options, pool, false))
+		die("cannot create icon");
+	for (c = 0; c < png_file_count; c++)
+		bench->bytes += file_size(png_files[c]);
+	bench->images += png_file_count;
+}
+
+static void
+run_benchmark(const char *name, void (*run)(Benchmark *))
+{
+	Benchmark bench;
+	uint64_t iterations = 0;
+	double start, seconds;
+
+	reset_peak_rss();
+	start = clock_seconds();
+	do {
+		memset(&bench, 0, sizeof(bench));
+		message_count = 0;
+		run(&bench);
+		bench.messages = message_count;
+		iterations++;
+		seconds = clock_seconds() - start;
+	} while (seconds < min_time);
+
+	printf("{\"benchmark\":\"%s\",\"version\":\"%s\",\"files\":%zu,\"bytes\":%" PRIu64
+			",\"images\":%" PRIu64 ",\"messages\":%" PRIu64 ",\"iterations\":%" PRIu64
+			",\"seconds\":%.6f,\"mb_per_s\":%.3f,\"images_per_s\":%.1f,\"peak_rss_kb\":%ld}\n",
+			name, VERSION, (run == run_create ? png_file_count : icon_file_count),
+			bench.bytes, bench.images, bench.messages, iterations, seconds,
+			bench.bytes * iterations / seconds / 1e6, bench.images * iterations / seconds,
+			peak_rss());
+	fflush(stdout);
+}
+
+int
+main(int argc, char **argv)
+{
+	uint32_t jobs = 1;
+	int c;
+
+	set_program_name(argv[0]);
+	while ((c = getopt_long(argc, argv, "j:t:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 'j':
+			if (!parse_uint32(optarg, &jobs) || jobs == 0)
+				die("invalid jobs value: %s", optarg);
+			break;
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'h':
+			printf("Usage: %s [-j JOBS] [-t SECONDS] DIRECTORY\n", program_name);
+			printf("Time listing, extracting and creating icons with the files in DIRECTORY.\n");
+			exit(0);
+		default:
+			fprintf(stderr, "Try `%s --help' for more information.\n", program_name);
+			exit(1);
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: %s [-j JOBS] [-t SECONDS] DIRECTORY\n", program_name);
+		exit(1);
+	}
+
+	read_corpus(argv[optind]);
+	if (jobs > 1)
+		pool = threadpool_new(jobs);
+
+	run_benchmark("list", run_list);
+	run_benchmark("extract", run_extract);
+	if (png_file_count != 0)
+		run_benchmark("create", run_create);
+
+	if (pool != NULL)
+		threadpool_free(pool);
+	return 0;
+}
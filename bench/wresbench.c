@@ -0,0 +1,313 @@
+/* wresbench.c - Time wrestool operations on a corpus of libraries
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <dirent.h>		/* POSIX */
+#include <getopt.h>		/* Gnulib/GNU Libc */
+#include <inttypes.h>		/* C99 */
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <time.h>		/* POSIX */
+#include <sys/stat.h>		/* POSIX */
+#include "minmax.h"		/* Gnulib */
+#include "progname.h"		/* Gnulib */
+#include "xalloc.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "common/error.h"
+#include "common/intutil.h"
+#include "common/string-utils.h"
+#include "wrestool/wrestool.h"
+
+/* Each library is read, opened with read_library, listed with
+ * do_resources and searched with find_resource, over and over until
+ * at least `min_time' seconds have passed. The time of each step is
+ * summed separately, so that the cost of reading the whole file, of
+ * moving the sections into place and of listing and finding resources
+ * can be told apart. Allocations are counted with the --stats hooks
+ * when they are built in.
+ */
+typedef enum {
+	STEP_READ,
+	STEP_READ_LIBRARY,
+	STEP_LIST,
+	STEP_FIND,
+	STEP_COUNT
+} Step;
+
+typedef struct {
+	char type[WINRES_ID_MAXLEN + 1];	/* with a - or + prefix */
+	char name[WINRES_ID_MAXLEN + 1];	/* with a - or + prefix */
+	char lang[WINRES_ID_MAXLEN + 1];	/* with a - or + prefix */
+} ResourceId;
+
+typedef struct {
+	double time[STEP_COUNT];
+	uint64_t allocs[STEP_COUNT];
+	uint64_t iterations;
+	uint64_t vma_size;
+	uint64_t resources;
+	uint64_t lookups;
+	bool ok;
+} Result;
+
+static const char *const step_names[STEP_COUNT] = {
+	"read", "read_library", "list", "find",
+};
+
+static double min_time = 0.5;
+static uint32_t max_lookups = 1000;
+static bool count_allocs;
+static ResourceId *resource_ids;
+static size_t resource_count;
+static size_t resource_alloc;
+
+static struct option long_options[] = {
+	{ "min-time",	required_argument,	NULL, 't' },
+	{ "lookups",	required_argument,	NULL, 'n' },
+	{ "help",	no_argument,		NULL, 'h' },
+	{ 0, 0, 0, 0 }
+};
+
+/* This replaces the function in wrestool's main.c, which is needed by
+ * print_resources_callback. */
+const char *
+res_type_id_to_string(int id)
+{
+	return NULL;
+}
+
+static double
+clock_seconds(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t
+alloc_count(void)
+{
+	return (count_allocs ? stats_total()->count[STATS_ALLOCS] : 0);
+}
+
+/* Remember the ids of each resource listed, to look them up later. */
+static void
+collect_resource_callback(WinLibrary *fi, WinResource *wr, WinResource *type_wr,
+		WinResource *name_wr, WinResource *lang_wr)
+{
+	ResourceId *id;
+
+	if (resource_count >= resource_alloc)
+		resource_ids = x2nrealloc(resource_ids, &resource_alloc, sizeof(ResourceId));
+	id = &resource_ids[resource_count++];
+	snprintf(id->type, sizeof(id->type), "%s%s", (type_wr->numeric_id ? "-" : "+"), type_wr->id);
+	snprintf(id->name, sizeof(id->name), "%s%s", (name_wr->numeric_id ? "-" : "+"), name_wr->id);
+	if (lang_wr->id[0] != '\0')
+		snprintf(id->lang, sizeof(id->lang), "%s%s", (lang_wr->numeric_id ? "-" : "+"), lang_wr->id);
+	else
+		id->lang[0] = '\0';
+}
+
+static void
+read_file(WinLibrary *fi, const char *name)
+{
+	struct stat statbuf;
+
+	memset(fi, 0, sizeof(WinLibrary));
+	fi->name = (char *) name;
+	if (stat(name, &statbuf) < 0)
+		die_errno("%s", name);
+	fi->total_size = statbuf.st_size;
+	fi->file = fopen(name, "rb");
+	if (fi->file == NULL)
+		die_errno("%s", name);
+	fi->memory = xmalloc(fi->total_size);
+	if (fread(fi->memory, fi->total_size, 1, fi->file) != 1)
+		die_errno("%s", name);
+	fclose(fi->file);
+	fi->file = NULL;
+}
+
+/* Run each step once, adding to the times and counts of `result'.
+ * Returns false if the library could not be opened. */
+static bool
+run_once(const char *name, Result *result)
+{
+	WinLibrary fi;
+	double start, end;
+	uint64_t allocs;
+	size_t c, step;
+
+	start = clock_seconds();
+	allocs = alloc_count();
+	read_file(&fi, name);
+	end = clock_seconds();
+	result->time[STEP_READ] += end - start;
+	result->allocs[STEP_READ] += alloc_count() - allocs;
+
+	start = end;
+	allocs = alloc_count();
+	if (!read_library(&fi)) {
+		free(fi.memory);
+		return false;
+	}
+	end = clock_seconds();
+	result->time[STEP_READ_LIBRARY] += end - start;
+	result->allocs[STEP_READ_LIBRARY] += alloc_count() - allocs;
+	result->vma_size = fi.total_size;
+
+	resource_count = 0;
+	start = end;
+	allocs = alloc_count();
+	do_resources(&fi, NULL, NULL, NULL, collect_resource_callback);
+	end = clock_seconds();
+	result->time[STEP_LIST] += end - start;
+	result->allocs[STEP_LIST] += alloc_count() - allocs;
+	result->resources = resource_count;
+
+	/* Look up resources spread evenly over the listing. */
+	step = MAX(1, resource_count / max_lookups);
+	result->lookups = 0;
+	start = end;
+	allocs = alloc_count();
+	for (c = 0; c < resource_count; c += step) {
+		ResourceId *id = &resource_ids[c];
+		WinResource *wr;
+		int level;
+
+		wr = find_resource(&fi, id->type, id->name, (id->lang[0] != '\0' ? id->lang : NULL), &level);
+		if (wr == NULL)
+			die("%s: cannot find resource %s/%s/%s", name, id->type, id->name, id->lang);
+		free(wr);
+		result->lookups++;
+	}
+	end = clock_seconds();
+	result->time[STEP_FIND] += end - start;
+	result->allocs[STEP_FIND] += alloc_count() - allocs;
+
+	free(fi.memory);
+	return true;
+}
+
+static void
+run_benchmark(const char *name)
+{
+	Result result;
+	struct stat statbuf;
+	double start;
+	int c;
+
+	if (stat(name, &statbuf) < 0)
+		die_errno("%s", name);
+	memset(&result, 0, sizeof(result));
+	start = clock_seconds();
+	do {
+		result.ok = run_once(name, &result);
+		result.iterations++;
+	} while (result.ok && clock_seconds() - start < min_time);
+
+	printf("{\"file\":\"%s\",\"version\":\"%s\",\"bytes\":%" PRIu64 ",\"ok\":%s",
+			name, VERSION, (uint64_t) statbuf.st_size, (result.ok ? "true" : "false"));
+	if (result.ok) {
+		printf(",\"vma_bytes\":%" PRIu64 ",\"resources\":%" PRIu64 ",\"lookups\":%" PRIu64
+				",\"iterations\":%" PRIu64, result.vma_size, result.resources,
+				result.lookups, result.iterations);
+		for (c = 0; c < STEP_COUNT; c++)
+			printf(",\"%s_s\":%.9f", step_names[c], result.time[c] / result.iterations);
+		if (count_allocs) {
+			for (c = 0; c < STEP_COUNT; c++)
+				printf(",\"%s_allocs\":%" PRIu64, step_names[c], result.allocs[c] / result.iterations);
+		}
+		printf(",\"read_mb_per_s\":%.3f,\"resources_per_s\":%.1f,\"lookups_per_s\":%.1f",
+				statbuf.st_size * result.iterations / result.time[STEP_READ] / 1e6,
+				result.resources * result.iterations / result.time[STEP_LIST],
+				(result.lookups != 0 ? result.lookups * result.iterations / result.time[STEP_FIND] : 0));
+	}
+	printf("}\n");
+	fflush(stdout);
+}
+
+static int
+compare_names(const void *a, const void *b)
+{
+	return strcmp(*(char *const *) a, *(char *const *) b);
+}
+
+int
+main(int argc, char **argv)
+{
+	char **files = NULL;
+	size_t file_count = 0;
+	size_t file_alloc = 0;
+	struct dirent *dirent;
+	DIR *dir;
+	size_t f;
+	int c;
+
+	set_program_name(argv[0]);
+	while ((c = getopt_long(argc, argv, "t:n:h", long_options, NULL)) != -1) {
+		switch (c) {
+		case 't':
+			min_time = atof(optarg);
+			break;
+		case 'n':
+			if (!parse_uint32(optarg, &max_lookups) || max_lookups == 0)
+				die("invalid lookups value: %s", optarg);
+			break;
+		case 'h':
+			printf("Usage: %s [-t SECONDS] [-n LOOKUPS] DIRECTORY\n", program_name);
+			printf("Time reading, listing and finding resources of the libraries in DIRECTORY.\n");
+			exit(0);
+		default:
+			fprintf(stderr, "Try `%s --help' for more information.\n", program_name);
+			exit(1);
+		}
+	}
+	if (argc - optind != 1) {
+		fprintf(stderr, "Usage: %s [-t SECONDS] [-n LOOKUPS] DIRECTORY\n", program_name);
+		exit(1);
+	}
+
+	dir = opendir(argv[optind]);
+	if (dir == NULL)
+		die_errno("%s: cannot open directory", argv[optind]);
+	while ((dirent = readdir(dir)) != NULL) {
+		if (ends_with_nocase(dirent->d_name, ".dll") || ends_with_nocase(dirent->d_name, ".exe")) {
+			if (file_count >= file_alloc)
+				files = x2nrealloc(files, &file_alloc, sizeof(char *));
+			files[file_count++] = xasprintf("%s/%s", argv[optind], dirent->d_name);
+		}
+	}
+	closedir(dir);
+	if (file_count == 0)
+		die("%s: no libraries found (run gen-libs first)", argv[optind]);
+	qsort(files, file_count, sizeof(char *), compare_names);
+
+	count_allocs = stats_enable();
+	for (f = 0; f < file_count; f++) {
+		run_benchmark(files[f]);
+		free(files[f]);
+	}
+	free(files);
+	free(resource_ids);
+	return 0;
+}
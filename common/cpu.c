@@ -0,0 +1,56 @@
+/* cpu.c - Run-time detection of processor features.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+#include <stdlib.h>	/* C89 */
+#include "cpu.h"
+
+/**
+ * Return the set of SIMD instruction set extensions (CPU_FEATURE_*)
+ * that are both supported by the processor and usable by the kernels
+ * compiled into this program.
+ *
+ * If the environment variable ICOUTILS_NO_SIMD is set, no features
+ * are reported, which selects the portable reference code paths.
+ */
+uint32_t
+cpu_features(void)
+{
+	uint32_t features = 0;
+
+	if (getenv("ICOUTILS_NO_SIMD") != NULL)
+		return 0;
+
+#if CPU_X86_SIMD
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("sse2"))
+		features |= CPU_FEATURE_SSE2;
+	if (__builtin_cpu_supports("ssse3"))
+		features |= CPU_FEATURE_SSSE3;
+	if (__builtin_cpu_supports("avx2"))
+		features |= CPU_FEATURE_AVX2;
+#endif
+#if CPU_ARM_NEON
+	features |= CPU_FEATURE_NEON;
+#endif
+
+	return features;
+}
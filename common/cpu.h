@@ -0,0 +1,41 @@
+/* cpu.h - Run-time detection of processor features.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_CPU_H
+#define COMMON_CPU_H
+
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+
+/* x86 SIMD kernels are compiled with per-function target attributes,
+ * so they are available whenever the compiler provides the intrinsics.
+ */
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__) && HAVE_IMMINTRIN_H
+# define CPU_X86_SIMD 1
+#endif
+#if defined(__ARM_NEON) && HAVE_ARM_NEON_H
+# define CPU_ARM_NEON 1
+#endif
+
+#define CPU_FEATURE_SSE2	(1 << 0)
+#define CPU_FEATURE_SSSE3	(1 << 1)
+#define CPU_FEATURE_AVX2	(1 << 2)
+#define CPU_FEATURE_NEON	(1 << 3)
+
+uint32_t cpu_features(void);
+
+#endif
@@ -0,0 +1,212 @@
+/* digest.c - Hashes of blocks of data.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+#include <string.h>	/* C89 */
+#include "digest.h"
+
+/* Bytes are always read in little-endian order, so that digests are
+ * the same on every machine. */
+static uint64_t
+get_le64(const uint8_t *p)
+{
+	return (uint64_t) p[0] | (uint64_t) p[1] << 8 | (uint64_t) p[2] << 16 | (uint64_t) p[3] << 24
+		| (uint64_t) p[4] << 32 | (uint64_t) p[5] << 40 | (uint64_t) p[6] << 48 | (uint64_t) p[7] << 56;
+}
+
+static void
+put_le64(uint8_t *p, uint64_t value)
+{
+	int c;
+
+	for (c = 0; c < 8; c++)
+		p[c] = value >> (8 * c);
+}
+
+#define ROTL64(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static uint64_t
+fmix64(uint64_t k)
+{
+	k ^= k >> 33;
+	k *= UINT64_C(0xff51afd7ed558ccd);
+	k ^= k >> 33;
+	k *= UINT64_C(0xc4ceb9fe1a85ec53);
+	k ^= k >> 33;
+	return k;
+}
+
+/**
+ * Compute a fast 128-bit hash of a block of data. This is MurmurHash3
+ * (x64, 128-bit variant) with a 64-bit seed. It is not a cryptographic
+ * hash, but collisions are unlikely enough to address content by it.
+ */
+void
+digest128(const void *data, size_t size, uint64_t seed, uint8_t digest[DIGEST128_SIZE])
+{
+	const uint64_t c1 = UINT64_C(0x87c37b91114253d5);
+	const uint64_t c2 = UINT64_C(0x4cf5ad432745937f);
+	const uint8_t *bytes = data;
+	const uint8_t *tail;
+	uint64_t h1 = seed;
+	uint64_t h2 = seed;
+	uint64_t k1, k2;
+	size_t rest;
+	size_t c;
+
+	for (c = 0; c < size / 16; c++) {
+		k1 = get_le64(bytes + 16 * c);
+		k2 = get_le64(bytes + 16 * c + 8);
+
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+		h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+		h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+	}
+
+	/* Mix in the last 1-15 bytes. */
+	tail = bytes + 16 * (size / 16);
+	rest = size % 16;
+	k1 = 0;
+	k2 = 0;
+	if (rest > 8) {
+		for (c = rest; c > 8; c--)
+			k2 ^= (uint64_t) tail[c - 1] << (8 * (c - 9));
+		k2 *= c2; k2 = ROTL64(k2, 33); k2 *= c1; h2 ^= k2;
+	}
+	if (rest > 0) {
+		for (c = (rest > 8 ? 8 : rest); c > 0; c--)
+			k1 ^= (uint64_t) tail[c - 1] << (8 * (c - 1));
+		k1 *= c1; k1 = ROTL64(k1, 31); k1 *= c2; h1 ^= k1;
+	}
+
+	h1 ^= size;
+	h2 ^= size;
+	h1 += h2;
+	h2 += h1;
+	h1 = fmix64(h1);
+	h2 = fmix64(h2);
+	h1 += h2;
+	h2 += h1;
+
+	put_le64(digest, h1);
+	put_le64(digest + 8, h2);
+}
+
+static const uint32_t sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+#define ROTR32(x, r) (((x) >> (r)) | ((x) << (32 - (r))))
+
+static void
+sha256_block(uint32_t state[8], const uint8_t *block)
+{
+	uint32_t w[64];
+	uint32_t a, b, c, d, e, f, g, h;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = (uint32_t) block[4*i] << 24 | (uint32_t) block[4*i+1] << 16 | (uint32_t) block[4*i+2] << 8 | block[4*i+3];
+	for (i = 16; i < 64; i++) {
+		uint32_t s0 = ROTR32(w[i-15], 7) ^ ROTR32(w[i-15], 18) ^ (w[i-15] >> 3);
+		uint32_t s1 = ROTR32(w[i-2], 17) ^ ROTR32(w[i-2], 19) ^ (w[i-2] >> 10);
+		w[i] = w[i-16] + s0 + w[i-7] + s1;
+	}
+
+	a = state[0]; b = state[1]; c = state[2]; d = state[3];
+	e = state[4]; f = state[5]; g = state[6]; h = state[7];
+	for (i = 0; i < 64; i++) {
+		uint32_t s1 = ROTR32(e, 6) ^ ROTR32(e, 11) ^ ROTR32(e, 25);
+		uint32_t t1 = h + s1 + ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+		uint32_t s0 = ROTR32(a, 2) ^ ROTR32(a, 13) ^ ROTR32(a, 22);
+		uint32_t t2 = s0 + ((a & b) ^ (a & c) ^ (b & c));
+
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+	state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+	state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+/**
+ * Compute the SHA-256 digest of a block of data.
+ */
+void
+sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE])
+{
+	uint32_t state[8] = {
+		0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+		0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+	};
+	const uint8_t *bytes = data;
+	uint8_t block[128];
+	uint64_t bits = (uint64_t) size * 8;
+	size_t rest = size % 64;
+	size_t tail_size;
+	size_t c;
+
+	for (c = 0; c + 64 <= size; c += 64)
+		sha256_block(state, bytes + c);
+
+	/* Pad with a one bit, zeros, and the length in bits. */
+	tail_size = (rest < 56 ? 64 : 128);
+	memset(block, 0, tail_size);
+	memcpy(block, bytes + size - rest, rest);
+	block[rest] = 0x80;
+	for (c = 0; c < 8; c++)
+		block[tail_size - 1 - c] = bits >> (8 * c);
+	sha256_block(state, block);
+	if (tail_size == 128)
+		sha256_block(state, block + 64);
+
+	for (c = 0; c < 8; c++) {
+		digest[4*c] = state[c] >> 24;
+		digest[4*c+1] = state[c] >> 16;
+		digest[4*c+2] = state[c] >> 8;
+		digest[4*c+3] = state[c];
+	}
+}
+
+/**
+ * Write a digest as lower-case hexadecimal digits into `hex', which
+ * must have room for 2 * `size' + 1 characters. Returns `hex'.
+ */
+char *
+digest_to_hex(const uint8_t *digest, size_t size, char *hex)
+{
+	static const char digits[] = "0123456789abcdef";
+	size_t c;
+
+	for (c = 0; c < size; c++) {
+		hex[2*c] = digits[digest[c] >> 4];
+		hex[2*c+1] = digits[digest[c] & 0x0f];
+	}
+	hex[2*size] = '\0';
+	return hex;
+}
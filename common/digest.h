@@ -0,0 +1,32 @@
+/* digest.h - Hashes of blocks of data.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_DIGEST_H
+#define COMMON_DIGEST_H
+
+#include <stddef.h>	/* C89 */
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+
+#define DIGEST128_SIZE	16
+#define SHA256_SIZE	32
+
+void digest128(const void *data, size_t size, uint64_t seed, uint8_t digest[DIGEST128_SIZE]);
+void sha256(const void *data, size_t size, uint8_t digest[SHA256_SIZE]);
+char *digest_to_hex(const uint8_t *digest, size_t size, char *hex);
+
+#endif
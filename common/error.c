@@ -36,9 +36,22 @@ struct MessageHeader {
 	char *message;
 };
 
+/* The message header and error message are per thread, so that
+ * threads working on different files report their own file names.
+ */
+#if HAVE_PTHREAD
+# define THREAD_LOCAL __thread
+# define lock_stderr() flockfile(stderr)
+# define unlock_stderr() funlockfile(stderr)
+#else
+# define THREAD_LOCAL
+# define lock_stderr()
+# define unlock_stderr()
+#endif
+
 void (*program_termination_hook)(void) = NULL;
-static char *error_message = NULL;
-static struct MessageHeader *message_header = NULL;
+static THREAD_LOCAL char *error_message = NULL;
+static THREAD_LOCAL struct MessageHeader *message_header = NULL;
 
 static inline const char *
 get_message_header(void)
@@ -51,21 +64,27 @@ get_message_header(void)
 static void
 v_warn(const char *msg, va_list ap)
 {
+	lock_stderr();
 	fprintf(stderr, "%s: ", get_message_header());
 	if (msg != NULL)
 		vfprintf(stderr, msg, ap);
 	fprintf(stderr, "\n");
+	unlock_stderr();
 }
 
 static void
 v_warn_errno(const char *msg, va_list ap)
 {
+	int errnum = errno;
+
+	lock_stderr();
 	fprintf(stderr, "%s: ", get_message_header());
 	if (msg != NULL) {
 		vfprintf(stderr, msg, ap);
 		fprintf(stderr, ": ");
 	}
-	fprintf(stderr, "%s\n", strerror(errno));
+	fprintf(stderr, "%s\n", strerror(errnum));
+	unlock_stderr();
 }
 
 /**
@@ -56,6 +56,13 @@
 #include <stdio.h>		/* C89 */
 #include <stdlib.h>		/* C89 */
 #include <errno.h>		/* C89 */
+#if HAVE_SYS_MMAN_H
+# include <sys/mman.h>		/* POSIX */
+#endif
+#if HAVE_SYS_SENDFILE_H
+# include <sys/sendfile.h>	/* Linux */
+#endif
+#include "minmax.h"		/* Gnulib */
 #include "xalloc.h"		/* Gnulib */
 #include "xvasprintf.h"		/* Gnulib */
 #include "strbuf.h"		/* common */
@@ -63,6 +70,10 @@
 #include "string-utils.h"	/* common */
 #include "llist.h"		/* common */
 
+/* The size of the blocks that copy_file_data reads and writes when the
+ * system cannot copy or map the file. */
+#define COPY_BLOCK_SIZE (64 * 1024)
+
 /**
  * Return true if the file exists, even if it may be a symbolic
  * link that refers to a non-existing file.
@@ -291,3 +302,188 @@ fpad(FILE *file, char byte, uint32_t bytes)
 	}
 	return 0;
 }
+
+/**
+ * Make the whole contents of a stream available in memory.
+ * Regular files are mapped read-only with mmap, when that is
+ * supported and the stream is positioned at its beginning.
+ * Other streams (such as pipes) are read until end of file
+ * into an allocated buffer.
+ *
+ * @param size
+ *   Where to store the number of bytes available.
+ * @param mapped
+ *   Set to true if the memory was mapped, false if allocated.
+ * @returns
+ *   The data, which should be released with unmap_file.
+ *   NULL is returned if there was a read error (errno will
+ *   contain an error code).
+ */
+void *
+map_file(FILE *file, size_t *size, bool *mapped)
+{
+	uint8_t *data;
+	size_t alloc;
+	size_t len;
+
+#if HAVE_MMAP
+	struct stat statbuf;
+
+	if (fstat(fileno(file), &statbuf) == 0
+	    && S_ISREG(statbuf.st_mode)
+	    && statbuf.st_size > 0
+	    && (uintmax_t) statbuf.st_size <= SIZE_MAX
+	    && ftello(file) == 0) {
+		data = mmap(NULL, statbuf.st_size, PROT_READ, MAP_PRIVATE, fileno(file), 0);
+		if (data != MAP_FAILED) {
+			*size = statbuf.st_size;
+			*mapped = true;
+			return data;
+		}
+	}
+#endif
+
+	alloc = 8192;
+	len = 0;
+	data = xmalloc(alloc);
+	for (;;) {
+		len += fread(data + len, 1, alloc - len, file);
+		if (len < alloc)
+			break;
+		data = x2realloc(data, &alloc);
+	}
+	if (ferror(file)) {
+		int saved_errno = errno;
+		free(data);
+		errno = saved_errno;
+		return NULL;
+	}
+
+	*size = len;
+	*mapped = false;
+	return data;
+}
+
+/**
+ * Release memory returned by map_file.
+ */
+void
+unmap_file(void *data, size_t size, bool mapped)
+{
+#if HAVE_MMAP
+	if (mapped) {
+		munmap(data, size);
+		return;
+	}
+#endif
+	free(data);
+}
+
+#if HAVE_COPY_FILE_RANGE || HAVE_SYS_SENDFILE_H
+/* Whether a failed copy_file_range or sendfile call only means that
+ * the files are of a kind that it cannot copy between. */
+static bool
+copy_unsupported(int err)
+{
+	return err == EINVAL || err == ENOSYS || err == EXDEV || err == EBADF
+		|| err == EOPNOTSUPP || err == ENOTSUP;
+}
+#endif
+
+static bool
+write_all(int fd, const uint8_t *data, size_t size)
+{
+	while (size > 0) {
+		ssize_t len = write(fd, data, size);
+
+		if (len < 0) {
+			if (errno == EINTR)
+				continue;
+			return false;
+		}
+		data += len;
+		size -= len;
+	}
+	return true;
+}
+
+/**
+ * Copy the first `size' bytes of the regular file `in_fd' to the
+ * current position of `out_fd', leaving the position of `in_fd' as it
+ * is. Where the system allows it, the data is copied without passing
+ * through this process: with copy_file_range between files, or with
+ * sendfile to other kinds of output. Otherwise the file is mapped (or
+ * read a block at a time) and written.
+ *
+ * @returns
+ *   false if there was an error (errno will contain an error code),
+ *   including if `in_fd' holds less than `size' bytes.
+ */
+bool
+copy_file_data(int in_fd, int out_fd, off_t size)
+{
+	off_t offset = 0;
+	ssize_t len = 0;
+	uint8_t *data;
+#if HAVE_MMAP
+	struct stat statbuf;
+#endif
+
+#if HAVE_COPY_FILE_RANGE
+	while (offset < size) {
+		len = copy_file_range(in_fd, &offset, out_fd, NULL, size - offset, 0);
+		if (len <= 0)
+			break;
+	}
+	if (offset == size)
+		return true;
+	if (len == 0 || !copy_unsupported(errno))
+		goto error;
+#endif
+
+#if HAVE_SYS_SENDFILE_H
+	while (offset < size) {
+		len = sendfile(out_fd, in_fd, &offset, MIN(size - offset, 0x7ffff000));
+		if (len <= 0)
+			break;
+	}
+	if (offset == size)
+		return true;
+	if (len == 0 || !copy_unsupported(errno))
+		goto error;
+#endif
+
+#if HAVE_MMAP
+	/* Pages past the end of the file cannot be told from zeros. */
+	if (fstat(in_fd, &statbuf) == 0 && statbuf.st_size < size) {
+		len = 0;
+		goto error;
+	}
+	data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, in_fd, 0);
+	if (data != MAP_FAILED) {
+		bool success = write_all(out_fd, data + offset, size - offset);
+		int saved_errno = errno;
+
+		munmap(data, size);
+		errno = saved_errno;
+		return success;
+	}
+#endif
+	data = xmalloc(COPY_BLOCK_SIZE);
+	while (offset < size) {
+		len = pread(in_fd, data, MIN(size - offset, COPY_BLOCK_SIZE), offset);
+		if (len <= 0 || !write_all(out_fd, data, len)) {
+			free(data);
+			goto error;
+		}
+		offset += len;
+	}
+	free(data);
+	return true;
+
+error:
+	/* A file that ends too early sets no errno of its own. */
+	if (len == 0)
+		errno = EIO;
+	return false;
+}
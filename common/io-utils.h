@@ -39,5 +39,8 @@ LList *read_directory(const char *dir);
 /* ssize_t xwrite(int fd, const void *buf, size_t count); */
 int fskip(FILE *file, uint32_t bytes);
 int fpad(FILE *file, char byte, uint32_t bytes);
+void *map_file(FILE *file, size_t *size, bool *mapped);
+void unmap_file(void *data, size_t size, bool mapped);
+bool copy_file_data(int in_fd, int out_fd, off_t size);
 
 #endif
@@ -0,0 +1,238 @@
+/* stats.c - Timing and counters for --stats
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <inttypes.h>	/* C99 */
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdio.h>	/* C89 */
+#include <string.h>	/* C89 */
+#include <time.h>	/* POSIX */
+#include "gettext.h"	/* Gnulib */
+#define _(s) gettext(s)
+#include "xalloc.h"	/* Gnulib */
+#include "stats.h"
+
+/* Counters are shared by the threads working on a file, and the
+ * phases being timed are per thread.
+ */
+#if HAVE_PTHREAD
+# define THREAD_LOCAL __thread
+# define atomic_add(p, n) __atomic_add_fetch(p, n, __ATOMIC_RELAXED)
+#else
+# define THREAD_LOCAL
+# define atomic_add(p, n) (*(p) += (n))
+#endif
+
+#define STATS_MAX_DEPTH 8
+
+static const char *const phase_names[STATS_PHASE_COUNT] = {
+	"read", "parse", "decode", "encode", "write", "resources",
+};
+
+bool stats_enabled = false;
+static Stats total_stats;
+static THREAD_LOCAL Stats *current_stats = NULL;
+static THREAD_LOCAL StatsPhase phase_stack[STATS_MAX_DEPTH];
+static THREAD_LOCAL int phase_depth = 0;
+static THREAD_LOCAL uint64_t phase_start;
+
+#if ENABLE_STATS
+static void
+count_alloc(size_t size)
+{
+	stats_add(STATS_ALLOCS, 1);
+	stats_add(STATS_ALLOC_BYTES, size);
+}
+#endif
+
+/**
+ * Start counting time and allocations. Returns false if the program
+ * was built without --stats support.
+ */
+bool
+stats_enable(void)
+{
+#if ENABLE_STATS
+	stats_enabled = true;
+	xalloc_count_hook = count_alloc;
+	return true;
+#else
+	return false;
+#endif
+}
+
+/**
+ * Parse the name of a --stats output format.
+ */
+bool
+stats_parse_format(const char *name, StatsFormat *format)
+{
+	if (strcmp(name, "text") == 0)
+		*format = STATS_FORMAT_TEXT;
+	else if (strcmp(name, "json") == 0)
+		*format = STATS_FORMAT_JSON;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Return the statistics that the calling thread counts into.
+ */
+Stats *
+stats_current(void)
+{
+	return current_stats;
+}
+
+/**
+ * Make the calling thread count into `stats' as well as the totals,
+ * or only into the totals if `stats' is NULL. Returns the previous
+ * statistics of the thread, to be restored afterwards.
+ */
+Stats *
+stats_set_current(Stats *stats)
+{
+	Stats *old = current_stats;
+
+	current_stats = stats;
+	return old;
+}
+
+static uint64_t
+clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+add_time(uint64_t now)
+{
+	StatsPhase phase = phase_stack[phase_depth - 1];
+
+	atomic_add(&total_stats.time[phase], now - phase_start);
+	if (current_stats != NULL)
+		atomic_add(&current_stats->time[phase], now - phase_start);
+	phase_start = now;
+}
+
+/**
+ * Start timing a phase in the calling thread. The phase that was
+ * being timed is paused until stats_end is called.
+ */
+void
+stats_begin(StatsPhase phase)
+{
+	uint64_t now = clock_ns();
+
+	if (phase_depth > 0)
+		add_time(now);
+	if (phase_depth < STATS_MAX_DEPTH)
+		phase_stack[phase_depth] = phase;
+	phase_depth++;
+	phase_start = now;
+}
+
+/**
+ * Stop timing the phase started by the last stats_begin.
+ */
+void
+stats_end(StatsPhase phase)
+{
+	if (phase_depth <= STATS_MAX_DEPTH)
+		add_time(clock_ns());
+	else
+		phase_start = clock_ns();
+	phase_depth--;
+}
+
+void
+stats_add(StatsCounter counter, uint64_t value)
+{
+	atomic_add(&total_stats.count[counter], value);
+	if (current_stats != NULL)
+		atomic_add(&current_stats->count[counter], value);
+}
+
+/**
+ * Return the statistics of all threads together.
+ */
+const Stats *
+stats_total(void)
+{
+	return &total_stats;
+}
+
+static void
+print_json_string(FILE *out, const char *str)
+{
+	putc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char) *str);
+		else
+			putc(*str, out);
+	}
+	putc('"', out);
+}
+
+/**
+ * Print statistics for the file called `name', or the totals if
+ * `name' is NULL. In JSON format, each call prints one object on a
+ * line of its own.
+ */
+void
+stats_print(FILE *out, const char *name, const Stats *stats, StatsFormat format)
+{
+	int c;
+
+	if (format == STATS_FORMAT_JSON) {
+		fputs("{\"file\":", out);
+		if (name != NULL)
+			print_json_string(out, name);
+		else
+			fputs("null", out);
+		fputs(",\"time\":{", out);
+		for (c = 0; c < STATS_PHASE_COUNT; c++)
+			fprintf(out, "%s\"%s\":%.6f", (c == 0 ? "" : ","), phase_names[c], stats->time[c] / 1e9);
+		fprintf(out, "},\"entries\":%" PRIu64 ",\"bytes_read\":%" PRIu64 ",\"bytes_written\":%" PRIu64
+				",\"allocations\":%" PRIu64 ",\"allocated_bytes\":%" PRIu64 "}\n",
+				stats->count[STATS_ENTRIES], stats->count[STATS_BYTES_READ],
+				stats->count[STATS_BYTES_WRITTEN], stats->count[STATS_ALLOCS],
+				stats->count[STATS_ALLOC_BYTES]);
+	} else {
+		if (name != NULL)
+			fprintf(out, _("Statistics for %s:\n"), name);
+		else
+			fprintf(out, _("Total statistics:\n"));
+		for (c = 0; c < STATS_PHASE_COUNT; c++)
+			fprintf(out, "  %-14s %12.6f s\n", phase_names[c], stats->time[c] / 1e9);
+		fprintf(out, "  %-14s %12" PRIu64 "\n", "entries", stats->count[STATS_ENTRIES]);
+		fprintf(out, "  %-14s %12" PRIu64 "\n", "bytes read", stats->count[STATS_BYTES_READ]);
+		fprintf(out, "  %-14s %12" PRIu64 "\n", "bytes written", stats->count[STATS_BYTES_WRITTEN]);
+		fprintf(out, "  %-14s %12" PRIu64 " (%" PRIu64 " bytes)\n", "allocations",
+				stats->count[STATS_ALLOCS], stats->count[STATS_ALLOC_BYTES]);
+	}
+}
@@ -0,0 +1,83 @@
+/* stats.h - Timing and counters for --stats
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_STATS_H
+#define COMMON_STATS_H
+
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+#include <stdio.h>	/* C89 */
+
+typedef enum {
+    STATS_READ,
+    STATS_PARSE,
+    STATS_DECODE,
+    STATS_ENCODE,
+    STATS_WRITE,
+    STATS_RESOURCES,
+    STATS_PHASE_COUNT
+} StatsPhase;
+
+typedef enum {
+    STATS_ENTRIES,
+    STATS_BYTES_READ,
+    STATS_BYTES_WRITTEN,
+    STATS_ALLOCS,
+    STATS_ALLOC_BYTES,
+    STATS_COUNTER_COUNT
+} StatsCounter;
+
+typedef enum {
+    STATS_FORMAT_TEXT,
+    STATS_FORMAT_JSON,
+} StatsFormat;
+
+/* Time spent in each phase, in nanoseconds, and counters. Time is
+ * only counted for the innermost phase, so phases add up to at most
+ * the running time.
+ */
+typedef struct {
+    uint64_t time[STATS_PHASE_COUNT];
+    uint64_t count[STATS_COUNTER_COUNT];
+} Stats;
+
+/* The STATS_ macros are used where time is spent, and compile to
+ * nothing with --disable-stats.
+ */
+#if ENABLE_STATS
+extern bool stats_enabled;
+# define STATS_BEGIN(phase)	do { if (stats_enabled) stats_begin(phase); } while (0)
+# define STATS_END(phase)	do { if (stats_enabled) stats_end(phase); } while (0)
+# define STATS_ADD(counter, n)	do { if (stats_enabled) stats_add(counter, n); } while (0)
+#else
+# define STATS_BEGIN(phase)	((void) 0)
+# define STATS_END(phase)	((void) 0)
+# define STATS_ADD(counter, n)	((void) 0)
+#endif
+
+bool stats_enable(void);
+bool stats_parse_format(const char *name, StatsFormat *format);
+Stats *stats_current(void);
+Stats *stats_set_current(Stats *stats);
+void stats_begin(StatsPhase phase);
+void stats_end(StatsPhase phase);
+void stats_add(StatsCounter counter, uint64_t value);
+const Stats *stats_total(void);
+void stats_print(FILE *out, const char *name, const Stats *stats, StatsFormat format);
+
+#endif
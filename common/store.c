@@ -0,0 +1,305 @@
+/* store.c - A content-addressed store for extracted files.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <errno.h>	/* C89 */
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdio.h>	/* C89 */
+#include <stdlib.h>	/* C89 */
+#include <string.h>	/* C89 */
+#include <sys/stat.h>	/* Gnulib/POSIX */
+#include <unistd.h>	/* Gnulib/POSIX */
+#if HAVE_PTHREAD
+#include <pthread.h>	/* POSIX */
+#endif
+#include "gettext.h"	/* Gnulib */
+#define _(s) gettext(s)
+#include "xalloc.h"	/* Gnulib */
+#include "xvasprintf.h"	/* Gnulib */
+#include "error.h"
+#include "hmap.h"
+#include "io-utils.h"
+#include "store.h"
+
+/* Objects are stored as DIR/KK/REST.EXT, where KK is the first two
+ * digits of the key and REST the others, so that no directory gets
+ * too large. Every object that is added is recorded in DIR/index as a
+ * line of tab-separated fields: the object name relative to DIR, the
+ * SHA-256 digest of the object or `-', and the fields given by the
+ * caller, which say where the object came from.
+ *
+ * Objects are written to a temporary file first and renamed, so an
+ * object that exists is always complete. All functions may be called
+ * from several threads at once.
+ */
+struct _ContentStore {
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	char *dir;
+	FILE *index;
+	bool sha256;
+	HMap *objects;		/* names of known objects -> SHA-256 or NULL */
+};
+
+/**
+ * Open a store in the directory `dir', creating it if necessary. If
+ * `sha256' is true, the SHA-256 digests of objects are included in the
+ * index. Returns NULL after printing a warning if the store cannot be
+ * opened.
+ */
+ContentStore *
+store_open(const char *dir, bool sha256)
+{
+	ContentStore *store;
+	char *name;
+	FILE *index;
+
+	if (mkdir(dir, 0777) < 0 && errno != EEXIST) {
+		warn_errno(_("%s: cannot create directory"), dir);
+		return NULL;
+	}
+	name = xasprintf("%s/index", dir);
+	index = fopen(name, "a");
+	if (index == NULL) {
+		warn_errno(_("%s: cannot open file"), name);
+		free(name);
+		return NULL;
+	}
+	free(name);
+
+	store = xzalloc(sizeof(ContentStore));
+#if HAVE_PTHREAD
+	pthread_mutex_init(&store->lock, NULL);
+#endif
+	store->dir = xstrdup(dir);
+	store->index = index;
+	store->sha256 = sha256;
+	store->objects = hmap_new();
+	return store;
+}
+
+/**
+ * Close a store and free it. Returns false after printing a warning
+ * if the index could not be written.
+ */
+bool
+store_close(ContentStore *store)
+{
+	bool success = true;
+
+	if (fclose(store->index) != 0) {
+		warn_errno(_("%s/index: cannot write to file"), store->dir);
+		success = false;
+	}
+	hmap_foreach_key(store->objects, free);
+	hmap_foreach_value(store->objects, free);
+	hmap_free(store->objects);
+#if HAVE_PTHREAD
+	pthread_mutex_destroy(&store->lock);
+#endif
+	free(store->dir);
+	free(store);
+	return success;
+}
+
+/**
+ * Compute the key of an object from `size' bytes of `data'. The seed
+ * can be used to tell apart objects of different kinds.
+ */
+void
+store_key(const void *data, size_t size, uint64_t seed, char key[STORE_KEY_LENGTH + 1])
+{
+	uint8_t digest[DIGEST128_SIZE];
+
+	digest128(data, size, seed, digest);
+	digest_to_hex(digest, DIGEST128_SIZE, key);
+}
+
+static char *
+object_name(const char *key, const char *extension)
+{
+	return xasprintf("%.2s/%s%s", key, key + 2, extension);
+}
+
+/* Return true if an object is in the store, remembering it if it was
+ * found on disk. The store must be locked. */
+static bool
+find_object(ContentStore *store, char *name)
+{
+	struct stat statbuf;
+	char *path;
+	bool found;
+
+	if (hmap_contains_key(store->objects, name))
+		return true;
+	path = xasprintf("%s/%s", store->dir, name);
+	found = (stat(path, &statbuf) == 0);
+	free(path);
+	if (found)
+		hmap_put(store->objects, xstrdup(name), NULL);
+	return found;
+}
+
+/**
+ * Return true if the object with `key' and `extension' is already in
+ * the store, so that it need not be made again before store_add.
+ */
+bool
+store_contains(ContentStore *store, const char *key, const char *extension)
+{
+	char *name = object_name(key, extension);
+	bool found;
+
+#if HAVE_PTHREAD
+	pthread_mutex_lock(&store->lock);
+#endif
+	found = find_object(store, name);
+#if HAVE_PTHREAD
+	pthread_mutex_unlock(&store->lock);
+#endif
+	free(name);
+	return found;
+}
+
+static bool
+write_object(ContentStore *store, const char *name, const void *data, size_t size)
+{
+	char *path = xasprintf("%s/%s", store->dir, name);
+	char *temp;
+	int fd;
+	bool success = false;
+
+	/* Create the directory of the object. */
+	temp = xasprintf("%s/%.2s", store->dir, name);
+	if (mkdir(temp, 0777) < 0 && errno != EEXIST) {
+		warn_errno(_("%s: cannot create directory"), temp);
+		free(temp);
+		free(path);
+		return false;
+	}
+	free(temp);
+
+	temp = xasprintf("%s/%.2s/.tmpXXXXXX", store->dir, name);
+	fd = mkstemp(temp);
+	if (fd < 0) {
+		warn_errno(_("%s: cannot create file"), temp);
+		goto cleanup;
+	}
+	if (fchmod(fd, 0644) < 0 || (size != 0 && write(fd, data, size) != (ssize_t) size)) {
+		warn_errno(_("%s: cannot write to file"), temp);
+		close(fd);
+		unlink(temp);
+		goto cleanup;
+	}
+	if (close(fd) < 0 || rename(temp, path) < 0) {
+		warn_errno(_("%s: cannot write to file"), path);
+		unlink(temp);
+		goto cleanup;
+	}
+	success = true;
+
+cleanup:
+	free(temp);
+	free(path);
+	return success;
+}
+
+/* Get the SHA-256 digest of an object, computing it from `data' or,
+ * if that is NULL, from the stored file. */
+static const char *
+object_sha256(ContentStore *store, const char *name, const void *data, size_t size)
+{
+	uint8_t digest[SHA256_SIZE];
+	char *sha = hmap_get(store->objects, name);
+
+	if (sha != NULL)
+		return sha;
+	if (data != NULL) {
+		sha256(data, size, digest);
+	} else {
+		char *path = xasprintf("%s/%s", store->dir, name);
+		FILE *file = fopen(path, "rb");
+		void *memory = NULL;
+		bool mapped;
+
+		if (file != NULL)
+			memory = map_file(file, &size, &mapped);
+		if (memory == NULL) {
+			warn_errno(_("%s: cannot read file"), path);
+			if (file != NULL)
+				fclose(file);
+			free(path);
+			return NULL;
+		}
+		sha256(memory, size, digest);
+		unmap_file(memory, size, mapped);
+		fclose(file);
+		free(path);
+	}
+	sha = xmalloc(2 * SHA256_SIZE + 1);
+	digest_to_hex(digest, SHA256_SIZE, sha);
+	/* The object is known, so only its value is replaced. */
+	hmap_put(store->objects, (void *) name, sha);
+	return sha;
+}
+
+/**
+ * Add an object to the store, unless it is already there, and record
+ * it in the index with the tab-separated `fields'. `data' may be NULL
+ * if store_contains has returned true for the object. Returns false
+ * after printing a warning if the object or index could not be written.
+ */
+bool
+store_add(ContentStore *store, const char *key, const char *extension, const void *data, size_t size, const char *fields)
+{
+	char *name = object_name(key, extension);
+	const char *sha = "-";
+	bool success = true;
+
+#if HAVE_PTHREAD
+	pthread_mutex_lock(&store->lock);
+#endif
+	if (!find_object(store, name)) {
+		if (data == NULL || !write_object(store, name, data, size)) {
+			success = false;
+			goto done;
+		}
+		hmap_put(store->objects, xstrdup(name), NULL);
+	}
+	if (store->sha256) {
+		sha = object_sha256(store, name, data, size);
+		if (sha == NULL) {
+			success = false;
+			goto done;
+		}
+	}
+	if (fprintf(store->index, "%s\t%s\t%s\n", name, sha, fields) < 0) {
+		warn_errno(_("%s/index: cannot write to file"), store->dir);
+		success = false;
+	}
+
+done:
+#if HAVE_PTHREAD
+	pthread_mutex_unlock(&store->lock);
+#endif
+	free(name);
+	return success;
+}
@@ -0,0 +1,38 @@
+/* store.h - A content-addressed store for extracted files.
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_STORE_H
+#define COMMON_STORE_H
+
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stddef.h>	/* C89 */
+#include <stdint.h>	/* Gnulib/C99/POSIX */
+#include "digest.h"
+
+/* A key is the hexadecimal digest128 of an object's content. */
+#define STORE_KEY_LENGTH	(2 * DIGEST128_SIZE)
+
+typedef struct _ContentStore ContentStore;
+
+ContentStore *store_open(const char *dir, bool sha256);
+bool store_close(ContentStore *store);
+void store_key(const void *data, size_t size, uint64_t seed, char key[STORE_KEY_LENGTH + 1]);
+bool store_contains(ContentStore *store, const char *key, const char *extension);
+bool store_add(ContentStore *store, const char *key, const char *extension, const void *data, size_t size, const char *fields);
+
+#endif
@@ -0,0 +1,327 @@
+/* threadpool.c - A work-stealing pool of worker threads
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdlib.h>	/* C89 */
+#if HAVE_PTHREAD
+#include <pthread.h>	/* POSIX */
+#endif
+#include "xalloc.h"	/* Gnulib */
+#include "error.h"
+#include "threadpool.h"
+
+/* Every thread has a deque of tasks. A thread pushes the tasks it
+ * submits onto the back of its own deque and takes work from the back
+ * as well, so the most recently split work stays on the same thread.
+ * Idle workers steal from the front of the other deques, where the
+ * oldest and usually largest tasks are. Threads outside the pool
+ * share the first deque.
+ */
+
+typedef struct _ThreadPoolTask ThreadPoolTask;
+typedef struct _TaskDeque TaskDeque;
+
+struct _ThreadPoolTask {
+	ThreadPoolFunc func;
+	void *arg;
+	ThreadPoolGroup *group;
+};
+
+struct _TaskDeque {
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+#endif
+	ThreadPool *pool;
+	ThreadPoolTask *tasks;
+	size_t alloc;
+	size_t head;
+	size_t count;
+};
+
+struct _ThreadPool {
+#if HAVE_PTHREAD
+	pthread_mutex_t lock;
+	pthread_cond_t work_cond;	/* signalled when tasks are queued */
+	pthread_cond_t done_cond;	/* broadcast when a group completes */
+	pthread_t *threads;
+#endif
+	size_t thread_count;
+	TaskDeque *deques;
+	size_t deque_count;
+	size_t queued;
+	bool shutdown;
+};
+
+#if HAVE_PTHREAD
+
+static __thread TaskDeque *current_deque = NULL;
+
+static TaskDeque *
+get_own_deque(ThreadPool *pool)
+{
+	if (current_deque != NULL && current_deque->pool == pool)
+		return current_deque;
+	return &pool->deques[0];
+}
+
+static void
+deque_push_back(TaskDeque *deque, const ThreadPoolTask *task)
+{
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count == deque->alloc) {
+		size_t alloc = (deque->alloc == 0 ? 16 : 2 * deque->alloc);
+		ThreadPoolTask *tasks = xnmalloc(alloc, sizeof(ThreadPoolTask));
+		size_t c;
+
+		/* Unwrap the ring buffer into the larger array. */
+		for (c = 0; c < deque->count; c++)
+			tasks[c] = deque->tasks[(deque->head + c) % deque->alloc];
+		free(deque->tasks);
+		deque->tasks = tasks;
+		deque->alloc = alloc;
+		deque->head = 0;
+	}
+	deque->tasks[(deque->head + deque->count) % deque->alloc] = *task;
+	deque->count++;
+	pthread_mutex_unlock(&deque->lock);
+}
+
+/* Take the task at the back of the deque, if it belongs to `group'
+ * or if `group' is NULL. */
+static bool
+deque_pop_back(TaskDeque *deque, ThreadPoolGroup *group, ThreadPoolTask *task)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		ThreadPoolTask *back = &deque->tasks[(deque->head + deque->count - 1) % deque->alloc];
+		if (group == NULL || back->group == group) {
+			*task = *back;
+			deque->count--;
+			found = true;
+		}
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static bool
+deque_steal_front(TaskDeque *deque, ThreadPoolTask *task)
+{
+	bool found = false;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->count > 0) {
+		*task = deque->tasks[deque->head];
+		deque->head = (deque->head + 1) % deque->alloc;
+		deque->count--;
+		found = true;
+	}
+	pthread_mutex_unlock(&deque->lock);
+	return found;
+}
+
+static bool
+find_task(ThreadPool *pool, TaskDeque *own, ThreadPoolTask *task)
+{
+	size_t start = own - pool->deques;
+	size_t c;
+
+	if (deque_pop_back(own, NULL, task))
+		goto found;
+	for (c = 1; c < pool->deque_count; c++) {
+		if (deque_steal_front(&pool->deques[(start + c) % pool->deque_count], task))
+			goto found;
+	}
+	return false;
+
+found:
+	__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+	return true;
+}
+
+static void
+run_task(ThreadPool *pool, ThreadPoolTask *task)
+{
+	task->func(task->arg);
+	if (__atomic_sub_fetch(&task->group->pending, 1, __ATOMIC_SEQ_CST) == 0) {
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_broadcast(&pool->done_cond);
+		pthread_mutex_unlock(&pool->lock);
+	}
+}
+
+static void *
+worker_main(void *data)
+{
+	TaskDeque *own = data;
+	ThreadPool *pool = own->pool;
+	ThreadPoolTask task;
+
+	current_deque = own;
+	for (;;) {
+		bool stop;
+
+		if (find_task(pool, own, &task)) {
+			run_task(pool, &task);
+			continue;
+		}
+		pthread_mutex_lock(&pool->lock);
+		while (__atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0 && !pool->shutdown)
+			pthread_cond_wait(&pool->work_cond, &pool->lock);
+		stop = pool->shutdown && __atomic_load_n(&pool->queued, __ATOMIC_SEQ_CST) == 0;
+		pthread_mutex_unlock(&pool->lock);
+		if (stop)
+			break;
+	}
+	return NULL;
+}
+
+#endif
+
+/**
+ * Create a pool that runs tasks on `jobs' threads in total. Since
+ * a thread waiting for a group runs that group's tasks itself, jobs-1
+ * worker threads are started. With jobs <= 1, or if threads are not
+ * supported, tasks are run by threadpool_submit directly.
+ */
+ThreadPool *
+threadpool_new(size_t jobs)
+{
+	ThreadPool *pool = xzalloc(sizeof(ThreadPool));
+
+#if HAVE_PTHREAD
+	size_t c;
+
+	pthread_mutex_init(&pool->lock, NULL);
+	pthread_cond_init(&pool->work_cond, NULL);
+	pthread_cond_init(&pool->done_cond, NULL);
+	if (jobs > 1) {
+		pool->deques = xcalloc(jobs, sizeof(TaskDeque));
+		pool->deque_count = jobs;
+		for (c = 0; c < jobs; c++) {
+			pthread_mutex_init(&pool->deques[c].lock, NULL);
+			pool->deques[c].pool = pool;
+		}
+		pool->threads = xnmalloc(jobs - 1, sizeof(pthread_t));
+		for (; pool->thread_count < jobs - 1; pool->thread_count++) {
+			c = pool->thread_count + 1;
+			if (pthread_create(&pool->threads[pool->thread_count], NULL, worker_main, &pool->deques[c]) != 0) {
+				warn_errno("pthread_create");
+				break;
+			}
+		}
+	}
+#endif
+
+	return pool;
+}
+
+/**
+ * Stop the worker threads and free the pool. All groups must
+ * have been waited for.
+ */
+void
+threadpool_free(ThreadPool *pool)
+{
+#if HAVE_PTHREAD
+	size_t c;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->shutdown = true;
+	pthread_cond_broadcast(&pool->work_cond);
+	pthread_mutex_unlock(&pool->lock);
+	for (c = 0; c < pool->thread_count; c++)
+		pthread_join(pool->threads[c], NULL);
+	if (pool->deques != NULL) {
+		for (c = 0; c < pool->deque_count; c++) {
+			pthread_mutex_destroy(&pool->deques[c].lock);
+			free(pool->deques[c].tasks);
+		}
+		free(pool->deques);
+	}
+	free(pool->threads);
+	pthread_cond_destroy(&pool->work_cond);
+	pthread_cond_destroy(&pool->done_cond);
+	pthread_mutex_destroy(&pool->lock);
+#endif
+	free(pool);
+}
+
+/**
+ * Queue a call to func(arg) as part of `group'. The task may run on
+ * any thread, and tasks may complete in any order. Tasks may submit
+ * and wait for further tasks.
+ */
+void
+threadpool_submit(ThreadPool *pool, ThreadPoolGroup *group, ThreadPoolFunc func, void *arg)
+{
+#if HAVE_PTHREAD
+	ThreadPoolTask task;
+
+	if (pool->thread_count > 0) {
+		task.func = func;
+		task.arg = arg;
+		task.group = group;
+		__atomic_add_fetch(&group->pending, 1, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+		deque_push_back(get_own_deque(pool), &task);
+
+		pthread_mutex_lock(&pool->lock);
+		pthread_cond_signal(&pool->work_cond);
+		pthread_mutex_unlock(&pool->lock);
+		return;
+	}
+#endif
+	func(arg);
+}
+
+/**
+ * Wait until all tasks in `group' have completed. Tasks of the group
+ * that have not been stolen by other threads yet are run by the
+ * calling thread. Other work is not taken on while waiting, so that
+ * nested waits cannot pile up unrelated work on the stack.
+ */
+void
+threadpool_wait(ThreadPool *pool, ThreadPoolGroup *group)
+{
+#if HAVE_PTHREAD
+	TaskDeque *own;
+	ThreadPoolTask task;
+
+	if (pool->thread_count == 0)
+		return;
+
+	/* Tasks of the group can only be in the deque of the thread that
+	 * submitted them, which is this one. */
+	own = get_own_deque(pool);
+	while (deque_pop_back(own, group, &task)) {
+		__atomic_sub_fetch(&pool->queued, 1, __ATOMIC_SEQ_CST);
+		run_task(pool, &task);
+	}
+
+	pthread_mutex_lock(&pool->lock);
+	while (__atomic_load_n(&group->pending, __ATOMIC_SEQ_CST) > 0)
+		pthread_cond_wait(&pool->done_cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+#endif
+}
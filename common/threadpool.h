@@ -0,0 +1,43 @@
+/* threadpool.h - A work-stealing pool of worker threads
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_THREADPOOL_H
+#define COMMON_THREADPOOL_H
+
+#include <stddef.h>	/* C89 */
+
+typedef struct _ThreadPool ThreadPool;
+typedef struct _ThreadPoolGroup ThreadPoolGroup;
+
+typedef void (*ThreadPoolFunc)(void *arg);
+
+/* A set of tasks that can be waited for together. Groups are
+ * usually automatic variables, initialized with THREADPOOL_GROUP_INIT.
+ */
+struct _ThreadPoolGroup {
+    size_t pending;
+};
+
+#define THREADPOOL_GROUP_INIT { 0 }
+
+ThreadPool *threadpool_new(size_t jobs);
+void threadpool_free(ThreadPool *pool);
+void threadpool_submit(ThreadPool *pool, ThreadPoolGroup *group, ThreadPoolFunc func, void *arg);
+void threadpool_wait(ThreadPool *pool, ThreadPoolGroup *group);
+
+#endif
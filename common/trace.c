@@ -0,0 +1,233 @@
+/* trace.c - Chrome trace event output for --trace
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+#include <inttypes.h>	/* C99 */
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+#include <stdio.h>	/* C89 */
+#include <stdlib.h>	/* C89 */
+#include <time.h>	/* POSIX */
+#if HAVE_PTHREAD
+#include <pthread.h>	/* POSIX */
+#endif
+#include "gettext.h"	/* Gnulib */
+#define _(s) gettext(s)
+#include "xalloc.h"	/* Gnulib */
+#include "error.h"
+#include "trace.h"
+
+#define TRACE_BUFFER_SIZE 4096
+
+/* The file of a `file' event is copied, since it may not live until
+ * the event is written. */
+typedef struct {
+	uint64_t time;
+	const char *name;
+	char *file;
+	long index;
+	char type;
+} TraceEvent;
+
+/* Each thread records its events into a buffer of its own, without
+ * locking, and writes them out under the lock only when the buffer is
+ * full. Buffers are kept in a list until the trace is closed, also
+ * after their threads have exited.
+ */
+typedef struct _TraceBuffer TraceBuffer;
+struct _TraceBuffer {
+	TraceBuffer *next;
+	int tid;
+	size_t count;
+	TraceEvent events[TRACE_BUFFER_SIZE];
+};
+
+#if HAVE_PTHREAD
+# define THREAD_LOCAL __thread
+static pthread_mutex_t trace_lock = PTHREAD_MUTEX_INITIALIZER;
+# define lock_trace() pthread_mutex_lock(&trace_lock)
+# define unlock_trace() pthread_mutex_unlock(&trace_lock)
+#else
+# define THREAD_LOCAL
+# define lock_trace()
+# define unlock_trace()
+#endif
+
+bool trace_enabled = false;
+static FILE *trace_file;
+static char *trace_filename;
+static uint64_t trace_start;
+static bool trace_first;
+static TraceBuffer *buffers = NULL;
+static int buffer_count = 0;
+static THREAD_LOCAL TraceBuffer *thread_buffer = NULL;
+
+static uint64_t
+clock_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/**
+ * Start writing trace events to `filename'. Returns false after
+ * printing a warning if the file cannot be created, or if the program
+ * was built without --trace support.
+ */
+bool
+trace_open(const char *filename)
+{
+#if ENABLE_STATS
+	trace_file = fopen(filename, "w");
+	if (trace_file == NULL) {
+		warn_errno(_("%s: cannot create file"), filename);
+		return false;
+	}
+	fputs("{\"traceEvents\":[", trace_file);
+	trace_filename = xstrdup(filename);
+	trace_start = clock_ns();
+	trace_first = true;
+	trace_enabled = true;
+	return true;
+#else
+	warn(_("--trace is not supported by this build"));
+	return false;
+#endif
+}
+
+static void
+print_json_string(FILE *out, const char *str)
+{
+	putc('"', out);
+	for (; *str != '\0'; str++) {
+		if (*str == '"' || *str == '\\')
+			fprintf(out, "\\%c", *str);
+		else if ((unsigned char) *str < 0x20)
+			fprintf(out, "\\u%04x", (unsigned char) *str);
+		else
+			putc(*str, out);
+	}
+	putc('"', out);
+}
+
+/* Write out the events of a buffer. The trace must be locked. */
+static void
+flush_buffer(TraceBuffer *buffer)
+{
+	size_t c;
+
+	for (c = 0; c < buffer->count; c++) {
+		TraceEvent *event = &buffer->events[c];
+		uint64_t time = event->time - trace_start;
+
+		fprintf(trace_file, "%s\n{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%" PRIu64 ".%03u,\"pid\":1,\"tid\":%d",
+				(trace_first ? "" : ","), event->name, event->type,
+				time / 1000, (unsigned) (time % 1000), buffer->tid);
+		if (event->file != NULL) {
+			fputs(",\"args\":{\"file\":", trace_file);
+			print_json_string(trace_file, event->file);
+			fputs("}", trace_file);
+			free(event->file);
+		} else if (event->index >= 0) {
+			fprintf(trace_file, ",\"args\":{\"index\":%ld}", event->index);
+		}
+		fputs("}", trace_file);
+		trace_first = false;
+	}
+	buffer->count = 0;
+}
+
+static void
+add_event(const char *name, const char *file, long index, char type)
+{
+	TraceBuffer *buffer = thread_buffer;
+	TraceEvent *event;
+
+	if (buffer == NULL) {
+		buffer = xmalloc(sizeof(TraceBuffer));
+		buffer->count = 0;
+		lock_trace();
+		buffer->tid = ++buffer_count;
+		buffer->next = buffers;
+		buffers = buffer;
+		unlock_trace();
+		thread_buffer = buffer;
+	}
+	if (buffer->count == TRACE_BUFFER_SIZE) {
+		lock_trace();
+		flush_buffer(buffer);
+		unlock_trace();
+	}
+
+	event = &buffer->events[buffer->count++];
+	event->time = clock_ns();
+	event->name = name;
+	event->file = (file != NULL ? xstrdup(file) : NULL);
+	event->index = index;
+	event->type = type;
+}
+
+/**
+ * Record the beginning of an event in the calling thread, with either
+ * a file name or an index (if not -1) as argument.
+ */
+void
+trace_begin(const char *name, const char *file, long index)
+{
+	add_event(name, file, index, 'B');
+}
+
+/**
+ * Record the end of the last event begun in the calling thread.
+ */
+void
+trace_end(const char *name)
+{
+	add_event(name, NULL, -1, 'E');
+}
+
+/**
+ * Write out the remaining events and close the trace file. All other
+ * threads must have finished. Returns false after printing a warning
+ * if the file could not be written.
+ */
+bool
+trace_close(void)
+{
+	TraceBuffer *buffer;
+	bool success = true;
+
+	trace_enabled = false;
+	while (buffers != NULL) {
+		buffer = buffers;
+		buffers = buffer->next;
+		flush_buffer(buffer);
+		free(buffer);
+	}
+	thread_buffer = NULL;
+	fputs("\n]}\n", trace_file);
+	if (fclose(trace_file) != 0) {
+		warn_errno(_("%s: cannot write to file"), trace_filename);
+		success = false;
+	}
+	free(trace_filename);
+	return success;
+}
@@ -0,0 +1,46 @@
+/* trace.h - Chrome trace event output for --trace
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMMON_TRACE_H
+#define COMMON_TRACE_H
+
+#include <stdbool.h>	/* Gnulib/C99/POSIX */
+
+/* Events are begun and ended in the same thread, properly nested.
+ * Names must be string constants. The TRACE_ macros compile to nothing
+ * with --disable-stats.
+ */
+#if ENABLE_STATS
+extern bool trace_enabled;
+# define TRACE_BEGIN(name)		do { if (trace_enabled) trace_begin(name, NULL, -1); } while (0)
+# define TRACE_BEGIN_FILE(name, file)	do { if (trace_enabled) trace_begin(name, file, -1); } while (0)
+# define TRACE_BEGIN_INDEX(name, index)	do { if (trace_enabled) trace_begin(name, NULL, index); } while (0)
+# define TRACE_END(name)		do { if (trace_enabled) trace_end(name); } while (0)
+#else
+# define TRACE_BEGIN(name)		((void) 0)
+# define TRACE_BEGIN_FILE(name, file)	((void) 0)
+# define TRACE_BEGIN_INDEX(name, index)	((void) 0)
+# define TRACE_END(name)		((void) 0)
+#endif
+
+bool trace_open(const char *filename);
+bool trace_close(void);
+void trace_begin(const char *name, const char *file, long index);
+void trace_end(const char *name);
+
+#endif
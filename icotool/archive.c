@@ -0,0 +1,237 @@
+/* archive.c - Write extracted images into a tar or cpio archive
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdio.h>		/* C89 */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <time.h>		/* C89 */
+#include "gettext.h"		/* Gnulib */
+#define _(s) gettext(s)
+#define N_(s) gettext_noop(s)
+#include "xalloc.h"		/* Gnulib */
+#include "xstrndup.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "common/error.h"
+#include "icotool.h"
+
+#define TAR_BLOCK_SIZE		512
+#define TAR_NAME_SIZE		100
+#define TAR_PREFIX_SIZE		155
+#define CPIO_HEADER_SIZE	110
+#define CPIO_TRAILER		"TRAILER!!!"
+
+/* An archive that extracted images are written into, one entry per
+ * image, all with the same time. `failed' is set after the first write
+ * error, so that it is only reported once. */
+struct _Archive {
+	ArchiveFormat format;
+	FILE *out;
+	char *name;
+	uint32_t mtime;
+	uint32_t ino;
+	bool failed;
+};
+
+/**
+ * Parse the name of an archive format. Returns false if the name is
+ * not known.
+ */
+bool
+archive_format_parse(const char *name, ArchiveFormat *format)
+{
+	if (strcmp(name, "tar") == 0)
+		*format = ARCHIVE_FORMAT_TAR;
+	else if (strcmp(name, "cpio") == 0)
+		*format = ARCHIVE_FORMAT_CPIO;
+	else
+		return false;
+	return true;
+}
+
+/**
+ * Start an archive written to `out', called `name' in messages.
+ * archive_finish flushes `out' but does not close it.
+ */
+Archive *
+archive_new(FILE *out, const char *name, ArchiveFormat format)
+{
+	Archive *archive = xzalloc(sizeof(Archive));
+
+	archive->format = format;
+	archive->out = out;
+	archive->name = xstrdup(name);
+	archive->mtime = time(NULL);
+	return archive;
+}
+
+static bool
+archive_write(Archive *archive, const void *data, size_t size)
+{
+	if (archive->failed)
+		return false;
+	if (size != 0 && fwrite(data, size, 1, archive->out) != 1) {
+		set_message_header(archive->name);
+		warn_errno(_("cannot write to file"));
+		restore_message_header();
+		archive->failed = true;
+		return false;
+	}
+	return true;
+}
+
+static bool
+archive_pad(Archive *archive, size_t size, size_t alignment)
+{
+	static const uint8_t zero[TAR_BLOCK_SIZE];
+
+	return archive_write(archive, zero, (alignment - size % alignment) % alignment);
+}
+
+/* Write a tar header block. Numbers are stored in octal, and the
+ * checksum is computed with the checksum field filled with spaces. */
+static bool
+write_tar_header(Archive *archive, const char *name, const char *prefix, char type, size_t size)
+{
+	char header[TAR_BLOCK_SIZE];
+	uint32_t checksum = 0;
+	size_t c;
+
+	memset(header, 0, TAR_BLOCK_SIZE);
+	strncpy(header, name, TAR_NAME_SIZE);
+	sprintf(header + 100, "%07o", 0644);
+	sprintf(header + 108, "%07o", 0);
+	sprintf(header + 116, "%07o", 0);
+	sprintf(header + 124, "%011lo", (unsigned long) size);
+	sprintf(header + 136, "%011lo", (unsigned long) archive->mtime);
+	memset(header + 148, ' ', 8);
+	header[156] = type;
+	memcpy(header + 257, "ustar", 6);
+	memcpy(header + 263, "00", 2);
+	if (prefix != NULL)
+		strncpy(header + 345, prefix, TAR_PREFIX_SIZE);
+	for (c = 0; c < TAR_BLOCK_SIZE; c++)
+		checksum += (uint8_t) header[c];
+	sprintf(header + 148, "%06o", checksum);
+	return archive_write(archive, header, TAR_BLOCK_SIZE);
+}
+
+/* Make a pax extended header record for a path. The length at the
+ * start of a record counts its own digits. */
+static char *
+pax_path_record(const char *name)
+{
+	size_t size = strlen(name) + sizeof(" path=\n") - 1;
+	size_t length = size + 1;
+
+	while (length != size + snprintf(NULL, 0, "%lu", (unsigned long) length))
+		length = size + snprintf(NULL, 0, "%lu", (unsigned long) length);
+	return xasprintf("%lu path=%s\n", (unsigned long) length, name);
+}
+
+/* Names that do not fit into the ustar name and prefix fields are
+ * stored in a pax extended header before the entry, and truncated in
+ * the entry itself. */
+static bool
+add_tar_entry(Archive *archive, const char *name, const void *data, size_t size)
+{
+	size_t length = strlen(name);
+	char *prefix = NULL;
+	bool success;
+
+	if (length > TAR_NAME_SIZE) {
+		const char *slash = strchr(name + length - TAR_NAME_SIZE - 1, '/');
+
+		if (slash != NULL && slash - name <= TAR_PREFIX_SIZE && slash[1] != '\0') {
+			prefix = xstrndup(name, slash - name);
+			name = slash + 1;
+		} else {
+			char *record = pax_path_record(name);
+
+			success = write_tar_header(archive, "PaxHeader", NULL, 'x', strlen(record))
+				&& archive_write(archive, record, strlen(record))
+				&& archive_pad(archive, strlen(record), TAR_BLOCK_SIZE);
+			free(record);
+			if (!success)
+				return false;
+		}
+	}
+
+	success = write_tar_header(archive, name, prefix, '0', size)
+		&& archive_write(archive, data, size)
+		&& archive_pad(archive, size, TAR_BLOCK_SIZE);
+	free(prefix);
+	return success;
+}
+
+/* Write a cpio entry in the portable "newc" format, which has a header
+ * of hexadecimal fields, and pads the name and the data to four bytes. */
+static bool
+add_cpio_entry(Archive *archive, const char *name, uint32_t ino, uint32_t mode, const void *data, size_t size)
+{
+	char header[CPIO_HEADER_SIZE + 1];
+	size_t name_size = strlen(name) + 1;
+
+	sprintf(header, "070701%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X%08X",
+			ino, mode, 0, 0, 1, archive->mtime, (uint32_t) size,
+			0, 0, 0, 0, (uint32_t) name_size, 0);
+	return archive_write(archive, header, CPIO_HEADER_SIZE)
+		&& archive_write(archive, name, name_size)
+		&& archive_pad(archive, CPIO_HEADER_SIZE + name_size, 4)
+		&& archive_write(archive, data, size)
+		&& archive_pad(archive, size, 4);
+}
+
+/**
+ * Add a file called `name' with `size' bytes of `data' to the archive.
+ * Returns false if the archive could not be written.
+ */
+bool
+archive_add(Archive *archive, const char *name, const void *data, size_t size)
+{
+	if (archive->format == ARCHIVE_FORMAT_TAR)
+		return add_tar_entry(archive, name, data, size);
+	return add_cpio_entry(archive, name, ++archive->ino, 0100644, data, size);
+}
+
+/**
+ * End the archive and free it. Returns false if the archive could not
+ * be written, now or before.
+ */
+bool
+archive_finish(Archive *archive)
+{
+	static const uint8_t end[2 * TAR_BLOCK_SIZE];
+	bool success;
+
+	if (archive->format == ARCHIVE_FORMAT_TAR)
+		success = archive_write(archive, end, sizeof(end));
+	else
+		success = add_cpio_entry(archive, CPIO_TRAILER, 0, 0, NULL, 0);
+	if (success && fflush(archive->out) != 0) {
+		set_message_header(archive->name);
+		warn_errno(_("cannot write to file"));
+		restore_message_header();
+		success = false;
+	}
+	success = success && !archive->failed;
+	free(archive->name);
+	free(archive);
+	return success;
+}
@@ -37,6 +37,9 @@
 #include <stdio.h>		/* C89 */
 #include <stdbool.h>		/* Gnulib/POSIX */
 #include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <setjmp.h>		/* C89 */
+#include <sys/stat.h>		/* Gnulib/POSIX */
 #include "gettext.h"		/* Gnulib */
 #include "xalloc.h"		/* Gnulib */
 #include "minmax.h"		/* Gnulib */
@@ -45,12 +48,6 @@
 #include "common/io-utils.h"
 #include "common/error.h"
 #include "icotool.h"
-#include "win32.h"
-#include "win32-endian.h"
-
-#define ROW_BYTES(bits) ((((bits) + 31) >> 5) << 2)
-
-static void simple_setvec(uint8_t *data, uint32_t ofs, uint8_t size, uint32_t value);
 
 static bool
 xfread(void *ptr, size_t size, FILE *stream)
@@ -65,431 +62,326 @@ xfread(void *ptr, size_t size, FILE *stream)
 	return true;
 }
 
-bool
-create_icon(size_t filec, char **filev, size_t raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count)
-{
-	struct {
-		FILE *in;
-		png_structp png_ptr;
-		png_infop info_ptr;
-		uint32_t bit_count;
-		uint32_t palette_count;
-		uint32_t image_size;
-		uint32_t mask_size;
-		uint32_t width;
-		uint32_t height;
-		uint8_t *image_data;
-		uint8_t **row_datas;
-		Palette *palette;
-		bool store_raw;
-	} *img;
-
-	Win32CursorIconFileDir dir;
-	FILE *out;
-	char *outname = NULL;
-	size_t c;
-	uint32_t d, x;
-	uint32_t dib_start;
-	png_byte ct;
-	size_t org_filec = filec;
-	
-	filec += raw_filec;
-
-	img = xzalloc(filec * sizeof(*img));
-
-	for (c = 0; c < filec; c++) {
-		char header[8];
-		uint32_t row_bytes;
-		uint8_t transparency[256];
-		uint16_t transparency_count;
-		bool need_transparency;
-		const char* real_filev = (c >= org_filec) ? raw_filev[c-org_filec] : filev[c];
-
-		img[c].store_raw = (c >= org_filec);
-		set_message_header(real_filev);
+typedef enum {
+	CREATE_SET,		/* encode the image and keep it in the writer */
+	CREATE_PLAN,		/* only find the size of the image */
+	CREATE_WRITE,		/* encode the image and append it to `out' */
+} CreateStep;
 
-		img[c].in = fopen(real_filev, "rb");
-    	if (img[c].in == NULL) {
-        	warn_errno(_("cannot open file"));
-			goto cleanup;
-		}
-    	if (!xfread(header, 8, img[c].in))
-			goto cleanup;
-    	if (png_sig_cmp((png_bytep)header, 0, 8)) {
-	    
-        	warn(_("not a png file"));
-			goto cleanup;
-		}
-
-		img[c].png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
-		if (img[c].png_ptr == NULL) {
-			warn(_("cannot initialize PNG library"));
-			goto cleanup;
-		}
-		img[c].info_ptr = png_create_info_struct(img[c].png_ptr);
-		if (img[c].info_ptr == NULL) {
-			warn(_("cannot create PNG info structure - out of memory"));
-			goto cleanup;
-		}
-
-		png_init_io(img[c].png_ptr, img[c].in);
-		png_set_sig_bytes(img[c].png_ptr, 8);
-		png_set_strip_16(img[c].png_ptr);
-		png_set_expand(img[c].png_ptr);
-		png_set_gray_to_rgb(img[c].png_ptr);
-		png_set_interlace_handling(img[c].png_ptr);
-		png_set_filler(img[c].png_ptr, 0xFF, PNG_FILLER_AFTER);
-		png_read_info(img[c].png_ptr, img[c].info_ptr);
-		png_read_update_info(img[c].png_ptr, img[c].info_ptr);
+/* An input file, read and handed to its reserved image of the writer
+ * on a pool thread or, without a pool, in order. Raw PNG files that
+ * are regular files are only planned from their header, and copied
+ * into `outfile' when the image is written.
+ */
+typedef struct {
+	IcoWriter *writer;
+	size_t index;
+	const char *name;
+	bool raw;
+	bool copy;
+	CreateStep step;
+	IcoBuffer *out;
+	FILE *outfile;
+	bool failed;
+} CreateJob;
+
+/* Read a PNG file as RGBA and give it to the writer. */
+static bool
+add_png_file(const CreateJob *job, FILE *in)
+{
+	png_structp png_ptr;
+	png_infop info_ptr;
+	png_bytep *volatile row_datas = NULL;
+	char header[8];
+	uint32_t width, height, row_bytes;
+	uint32_t d;
+	bool success;
+
+	if (!xfread(header, 8, in))
+		return false;
+	if (png_sig_cmp((png_bytep)header, 0, 8)) {
+		warn(_("not a png file"));
+		return false;
+	}
 
-		img[c].width = png_get_image_width(img[c].png_ptr, img[c].info_ptr);
-		img[c].height = png_get_image_height(img[c].png_ptr, img[c].info_ptr);
-		
-		if (img[c].store_raw)
-		{
-			ct = png_get_color_type(img[c].png_ptr, img[c].info_ptr);
-			if (ct & PNG_COLOR_MASK_PALETTE)
-			{
-				img[c].bit_count = png_get_bit_depth(img[c].png_ptr, img[c].info_ptr);
-			}
-			else
-				img[c].bit_count = png_get_bit_depth(img[c].png_ptr, img[c].info_ptr)
-					* png_get_channels(img[c].png_ptr, img[c].info_ptr);
-			png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
-			
-			fseek(img[c].in, 0, SEEK_END);
-			img[c].image_size = ftell(img[c].in);
-			fseek(img[c].in, 0, SEEK_SET);
-			img[c].image_data = xmalloc(img[c].image_size);
-		    	if (!xfread(img[c].image_data, img[c].image_size, img[c].in))
-				goto cleanup;
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
+	if (png_ptr == NULL) {
+		warn(_("cannot initialize PNG library"));
+		return false;
+	}
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		warn(_("cannot create PNG info structure - out of memory"));
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return false;
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		if (row_datas != NULL) {
+			free(row_datas[0]);
+			free(row_datas);
 		}
-		else
-		{
-			row_bytes = png_get_rowbytes(img[c].png_ptr, img[c].info_ptr);
-			img[c].row_datas = xmalloc(img[c].height * sizeof(png_bytep *));
-			img[c].row_datas[0] = xmalloc(img[c].height * row_bytes);
-			for (d = 1; d < img[c].height; d++)
-				img[c].row_datas[d] = img[c].row_datas[d-1] + row_bytes;
-			png_read_rows(img[c].png_ptr, img[c].row_datas, NULL, img[c].height);
-
-			ct = png_get_color_type(img[c].png_ptr, img[c].info_ptr);
-			img[c].palette = palette_new();
-
-
-			/* Count number of necessary colors in palette and number of transparencies */
-			memset(transparency, 0, 256);
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[d];
-				for (x = 0; x < img[c].width; x++) {
-					/* Set color of fully transparent pixels to black.
-					    On Windows Mobile, and possibly on regular Windows OSes as well,
-					    it seems that Windows does not completely ignore RGB-values of 
-					    entirely transparent pixels as expected.
-					 */
-					if ((ct & PNG_COLOR_MASK_ALPHA) && (row[4*x+3] == 0))
-					    row[4*x+0] = row[4*x+1] = row[4*x+2] = 0;
-					if (palette_count(img[c].palette) <= (1 << 8))
-					    palette_add(img[c].palette, row[4*x+0], row[4*x+1], row[4*x+2]);
-					if (ct & PNG_COLOR_MASK_ALPHA)
-					    transparency[row[4*x+3]] = 1;
-				}
-			}
-			transparency_count = 0;
-			for (d = 0; d < 256; d++)
-			    transparency_count += transparency[d];
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		return false;
+	}
 
-			/* If there are more than two steps of transparency, or if the
-			 * two steps are NOT either entirely off (0) and entirely on (255),
-			 * then we will lose transparency information if bit_count is not 32.
-			 */
-			need_transparency =
-			    transparency_count > 2
-			    ||
-			    (transparency_count == 2 && (transparency[0] == 0 || transparency[255] == 0));
+	png_init_io(png_ptr, in);
+	png_set_sig_bytes(png_ptr, 8);
+	png_set_strip_16(png_ptr);
+	png_set_expand(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	png_set_interlace_handling(png_ptr);
+	png_set_filler(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	png_read_info(png_ptr, info_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	width = png_get_image_width(png_ptr, info_ptr);
+	height = png_get_image_height(png_ptr, info_ptr);
+	row_bytes = png_get_rowbytes(png_ptr, info_ptr);
+	row_datas = xmalloc(height * sizeof(png_bytep *));
+	row_datas[0] = xmalloc(height * row_bytes);
+	for (d = 1; d < height; d++)
+		row_datas[d] = row_datas[d-1] + row_bytes;
+	png_read_rows(png_ptr, row_datas, NULL, height);
+	png_read_end(png_ptr, info_ptr);
+
+	switch (job->step) {
+	case CREATE_SET:
+		success = ico_writer_set_rgba(job->writer, job->index, width, height, row_datas[0], row_bytes);
+		break;
+	case CREATE_PLAN:
+		success = ico_writer_plan_rgba(job->writer, job->index, width, height, row_datas[0], row_bytes);
+		break;
+	default:
+		success = ico_writer_write_rgba(job->writer, job->index, width, height, row_datas[0], row_bytes, job->out);
+		break;
+	}
 
-			/* Can we keep all colors in a palette? */
-			if (need_transparency) {
-				if (bit_count != -1) {
-				    if (bit_count != 32)
-					warn("decreasing bit depth will discard variable transparency", transparency_count);
-				    /* Why 24 and not bit_count? Otherwise we might decrease below what's possible
-					   * due to number of colors in image. The real decrease happens below. */
-				    img[c].bit_count = 24;
-				} else {
-				    img[c].bit_count = 32;
-				}
-				img[c].palette_count = 0;
-			}
-			else if (palette_count(img[c].palette) <= 256) {
-				for (d = 1; palette_count(img[c].palette) > (uint32_t)(1 << d); d <<= 1);
-				if (d == 2)	/* four colors (two bits) are not supported */
-					d = 4;
-				img[c].bit_count = d;
-				img[c].palette_count = 1 << d;
-			}
-			else {
-				img[c].bit_count = 24;
-				img[c].palette_count = 0;
-			}
+	free(row_datas[0]);
+	free(row_datas);
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	return success;
+}
 
-			/* Does the user want to change number of bits per pixel? */
-			if (bit_count != -1) {
-				if (img[c].bit_count == (uint32_t) bit_count) {
-					/* No operation */
-				} else if (img[c].bit_count < (uint32_t) bit_count) {
-					img[c].bit_count = bit_count;
-					img[c].palette_count = (bit_count > 16 ? 0 : 1 << bit_count);
-				} else {
-					warn(_("cannot decrease bit depth from %d to %d, bit depth not changed"), img[c].bit_count, bit_count);
-				}
-			}
-		
-			img[c].image_size = img[c].height * ROW_BYTES(img[c].width * img[c].bit_count);
-			img[c].mask_size = img[c].height * ROW_BYTES(img[c].width);
-		}
+/* Plan a PNG file to be stored as it is from its header, or copy it
+ * into the output file after checking that it is the file planned. */
+static bool
+copy_raw_png_file(const CreateJob *job, FILE *in, off_t size)
+{
+	uint8_t header[ICO_PNG_HEADER_SIZE];
+	size_t header_size = MIN(size, ICO_PNG_HEADER_SIZE);
 
-		restore_message_header();
+	if (header_size != 0 && !xfread(header, header_size, in))
+		return false;
+	if (job->step != CREATE_WRITE)
+		return ico_writer_plan_png(job->writer, job->index, header, size);
+	if (!ico_writer_write_png(job->writer, job->index, header, size, NULL))
+		return false;
+	if (!copy_file_data(fileno(in), fileno(job->outfile), size)) {
+		warn_errno(_("cannot copy file"));
+		return false;
 	}
+	return true;
+}
 
-	out = outfile_gen(&outname);
-	restore_message_header();
-	set_message_header(outname);
-	if (out == NULL) {
-		warn_errno(_("cannot create file"));
-		goto cleanup;
+/* Give a PNG file to the writer to be stored as it is. Regular files
+ * are copied into the output file when it is written, so that they are
+ * never held in memory; other files are read whole. */
+static bool
+add_raw_png_file(CreateJob *job, FILE *in)
+{
+	struct stat statbuf;
+	void *data;
+	size_t size;
+	bool mapped;
+	bool success;
+
+	if (fstat(fileno(in), &statbuf) < 0) {
+		warn_errno(_("cannot read file"));
+		return false;
 	}
-
-	dir.reserved = 0;
-	dir.type = (icon_mode ? 1 : 2);
-	dir.count = filec;
-	fix_win32_cursor_icon_file_dir_endian(&dir);
-	if (fwrite(&dir, sizeof(Win32CursorIconFileDir), 1, out) != 1) {
-		warn_errno(_("cannot write to file"));
-		goto cleanup;
+	if (job->step != CREATE_WRITE)
+		job->copy = S_ISREG(statbuf.st_mode);
+	if (job->copy)
+		return copy_raw_png_file(job, in, statbuf.st_size);
+
+	data = map_file(in, &size, &mapped);
+	if (data == NULL) {
+		warn_errno(_("cannot read file"));
+		return false;
 	}
+	switch (job->step) {
+	case CREATE_SET:
+		success = ico_writer_set_png(job->writer, job->index, data, size);
+		break;
+	case CREATE_PLAN:
+		success = ico_writer_plan_png(job->writer, job->index, data, size);
+		break;
+	default:
+		success = ico_writer_write_png(job->writer, job->index, data, size, job->out);
+		break;
+	}
+	unmap_file(data, size, mapped);
+	return success;
+}
 
-	dib_start = sizeof(Win32CursorIconFileDir) + filec * sizeof(Win32CursorIconFileDirEntry);
-	for (c = 0; c < filec; c++) {
-		Win32CursorIconFileDirEntry entry;
-
-		/* If one of the dimensions is larger or equal to 256, both icon dimensions have
-		   to be stored as 0 in the entry. */
-		if ((img[c].width >= 256) || (img[c].height >= 256))
-		{
-			entry.width = 0;
-			entry.height = 0;
-		}
-		else
-		{
-			entry.width = img[c].width;
-			entry.height = img[c].height;
-		}
-		entry.reserved = 0;
-		if (icon_mode) {
-			entry.hotspot_x = 1;	            /* color planes for icons */
-			entry.hotspot_y = img[c].bit_count; /* bit_count for icons */
-		} else {
-			entry.hotspot_x = hotspot_x;
-			entry.hotspot_y = hotspot_y;
-		}
-		entry.dib_offset = dib_start;
-		entry.color_count = (img[c].bit_count >= 8 ? 0 : 1 << img[c].bit_count);
-		if (img[c].store_raw)
-			entry.dib_size = img[c].image_size;
+static void
+create_job(void *arg)
+{
+	CreateJob *job = arg;
+	FILE *in;
+
+	set_message_header(job->name);
+	in = fopen(job->name, "rb");
+	if (in == NULL) {
+		warn_errno(_("cannot open file"));
+		job->failed = true;
+	} else {
+		if (job->raw)
+			job->failed = !add_raw_png_file(job, in);
 		else
-			entry.dib_size = img[c].palette_count * sizeof(Win32RGBQuad)
-					+ sizeof(Win32BitmapInfoHeader)
-					+ img[c].image_size
-					+ img[c].mask_size;
+			job->failed = !add_png_file(job, in);
+		fclose(in);
+	}
+	restore_message_header();
+}
 
-		dib_start += entry.dib_size;
+static const struct {
+	const char *name;
+	IcoCompression compression;
+} compressions[] = {
+	{ "bmp",	ICO_COMPRESSION_BMP },
+	{ "png",	ICO_COMPRESSION_PNG },
+	{ "auto",	ICO_COMPRESSION_AUTO },
+};
+
+/**
+ * Parse the name of a way to store created images (bmp, png or auto).
+ * Return false if there is no such name.
+ */
+bool
+compression_parse(const char *name, IcoCompression *compression)
+{
+	size_t c;
 
-		fix_win32_cursor_icon_file_dir_entry_endian(&entry);
-		if (fwrite(&entry, sizeof(Win32CursorIconFileDirEntry), 1, out) != 1) {
-			warn_errno(_("cannot write to file"));
-			goto cleanup;
+	for (c = 0; c < sizeof(compressions)/sizeof(*compressions); c++) {
+		if (strcmp(name, compressions[c].name) == 0) {
+			*compression = compressions[c].compression;
+			return true;
 		}
-
 	}
+	return false;
+}
 
-	for (c = 0; c < filec; c++) {
-		if (img[c].store_raw)
-		{
-			if (fwrite(img[c].image_data, img[c].image_size, 1, out) != 1) {
-				warn_errno(_("cannot write to file"));
-				goto cleanup;
-			}
-		}
-		else
-		{
-			Win32BitmapInfoHeader bitmap;
-
-			bitmap.size = sizeof(Win32BitmapInfoHeader);
-			bitmap.width = png_get_image_width(img[c].png_ptr, img[c].info_ptr);
-			bitmap.height = png_get_image_height(img[c].png_ptr, img[c].info_ptr) * 2;
-			bitmap.planes = 1;							// appears to be 1 always (XXX)
-			bitmap.bit_count = img[c].bit_count;
-			bitmap.compression = 0;
-			bitmap.x_pels_per_meter = 0;				// should be 0 always
-			bitmap.y_pels_per_meter = 0;				// should be 0 always
-			bitmap.clr_important = 0;					// should be 0 always
-			bitmap.clr_used = img[c].palette_count;
-			bitmap.size_image = img[c].image_size;		// appears to be ok here (may be image_size+mask_size or 0, XXX)
-
-			fix_win32_bitmap_info_header_endian(&bitmap);
-			if (fwrite(&bitmap, sizeof(Win32BitmapInfoHeader), 1, out) != 1) {
-				warn_errno("cannot write to file");
-				goto cleanup;
-			}
+/* Write and empty the buffer. */
+static bool
+flush_buffer(IcoBuffer *buffer, FILE *out)
+{
+	if (buffer->size != 0 && fwrite(buffer->data, buffer->size, 1, out) != 1) {
+		warn_errno(_("cannot write to file"));
+		return false;
+	}
+	buffer->size = 0;
+	return true;
+}
 
-			if (img[c].bit_count <= 16) {
-				Win32RGBQuad color;
+/**
+ * Create an icon or cursor file from PNG files, with a writer made
+ * with `options'. The images in `filev' are decoded and stored as the
+ * compression option says, and those in `raw_filev' are copied as
+ * they are after them. If `pool' is not NULL, the files are read and converted
+ * on its threads, and only the file itself is put together in order.
+ *
+ * If `stream' is set, no more than one image (per thread) is held in
+ * memory at a time: the files are first read only to find the size of
+ * each image, and then read again and written one at a time after the
+ * directory.
+ */
+bool
+create_icon(size_t filec, char **filev, size_t raw_filec, char** raw_filev, CreateNameGen outfile_gen, const IcoWriterOptions *options, ThreadPool *pool, bool stream)
+{
+	IcoWriter *writer;
+	IcoBuffer buffer = { NULL, 0, 0 };
+	CreateJob *jobs;
+	size_t first;
+	FILE *out = NULL;
+	char *outname = NULL;
+	bool success = false;
+	size_t c;
 
-				palette_assign_indices(img[c].palette);
-				color.reserved = 0;
-				while (palette_next(img[c].palette, &color.red, &color.green, &color.blue))
-					fwrite(&color, sizeof(Win32RGBQuad), 1, out);
+	writer = ico_writer_new(options, warn_message, NULL);
+
+	jobs = xnmalloc(filec + raw_filec, sizeof(CreateJob));
+	first = ico_writer_reserve(writer, filec + raw_filec);
+	for (c = 0; c < filec + raw_filec; c++) {
+		jobs[c].writer = writer;
+		jobs[c].index = first + c;
+		jobs[c].name = (c < filec ? filev[c] : raw_filev[c - filec]);
+		jobs[c].raw = (c >= filec);
+		jobs[c].copy = false;
+		jobs[c].step = (stream ? CREATE_PLAN : CREATE_SET);
+		jobs[c].out = &buffer;
+		jobs[c].outfile = NULL;
+		jobs[c].failed = false;
+	}
 
-				/* Pad with empty colors. The reason we do this is because we
-				 * specify bitmap.clr_used as a base of 2. The latter is probably
-				 * not necessary according to the original specs, but many
-				 * programs that read icons assume it. Especially gdk-pixbuf.
-				 */
-			    	memset(&color, 0, sizeof(Win32RGBQuad));
-				for (d = palette_count(img[c].palette); d < (uint32_t) (1 << img[c].bit_count); d++)
-					fwrite(&color, sizeof(Win32RGBQuad), 1, out);
-			}
+	/* Without a pool, nothing more is read after the first failure. */
+	if (pool != NULL) {
+		ThreadPoolGroup group = THREADPOOL_GROUP_INIT;
 
-			img[c].image_data = xzalloc(img[c].image_size);
+		for (c = 0; c < filec + raw_filec; c++)
+			threadpool_submit(pool, &group, create_job, &jobs[c]);
+		threadpool_wait(pool, &group);
+	}
+	for (c = 0; c < filec + raw_filec; c++) {
+		if (pool == NULL)
+			create_job(&jobs[c]);
+		if (jobs[c].failed)
+			goto cleanup;
+	}
 
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[img[c].height - d - 1];
-				if (img[c].bit_count < 24) {
-					uint32_t imod = d * (img[c].image_size/img[c].height) * 8 / img[c].bit_count;
-					for (x = 0; x < img[c].width; x++) {
-						uint32_t color;
-						color = palette_lookup(img[c].palette, row[4*x+0], row[4*x+1], row[4*x+2]);
-						simple_setvec(img[c].image_data, x+imod, img[c].bit_count, color);
-					}
-				} else if (img[c].bit_count == 24) {
-					uint32_t irow = d * (img[c].image_size/img[c].height);
-					for (x = 0; x < img[c].width; x++) {
-						img[c].image_data[3*x+0 + irow] = row[4*x+2];
-						img[c].image_data[3*x+1 + irow] = row[4*x+1];
-						img[c].image_data[3*x+2 + irow] = row[4*x+0];
-					}
-				} else if (img[c].bit_count == 32) {
-					uint32_t irow = d * (img[c].image_size/img[c].height);
-					for (x = 0; x < img[c].width; x++) {
-						img[c].image_data[4*x+0 + irow] = row[4*x+2];
-						img[c].image_data[4*x+1 + irow] = row[4*x+1];
-						img[c].image_data[4*x+2 + irow] = row[4*x+0];
-						img[c].image_data[4*x+3 + irow] = row[4*x+3];
-					}
-				}
-			}
+	out = outfile_gen(&outname);
+	set_message_header(outname);
+	if (out == NULL) {
+		warn_errno(_("cannot create file"));
+		goto done;
+	}
 
-			if (fwrite(img[c].image_data, img[c].image_size, 1, out) != 1) {
+	/* Images that were set are taken from the writer; the others are
+	 * read again, or copied, and written one at a time. */
+	ico_writer_start(writer, &buffer);
+	if (!flush_buffer(&buffer, out))
+		goto done;
+	for (c = 0; c < filec + raw_filec; c++) {
+		if (stream || jobs[c].copy) {
+			if (jobs[c].copy && fflush(out) != 0) {
 				warn_errno(_("cannot write to file"));
-				goto cleanup;
+				goto done;
 			}
-
-			for (d = 0; d < img[c].height; d++) {
-				png_bytep row = img[c].row_datas[img[c].height - d - 1];
-
-				for (x = 0; x < img[c].width; x += 8) {
-					uint8_t mask = 0;
-					mask |= (row[4*(x+0)+3] <= alpha_threshold ? 1 << 7 : 0);
-					mask |= (row[4*(x+1)+3] <= alpha_threshold ? 1 << 6 : 0);
-					mask |= (row[4*(x+2)+3] <= alpha_threshold ? 1 << 5 : 0);
-					mask |= (row[4*(x+3)+3] <= alpha_threshold ? 1 << 4 : 0);
-					mask |= (row[4*(x+4)+3] <= alpha_threshold ? 1 << 3 : 0);
-					mask |= (row[4*(x+5)+3] <= alpha_threshold ? 1 << 2 : 0);
-					mask |= (row[4*(x+6)+3] <= alpha_threshold ? 1 << 1 : 0);
-					mask |= (row[4*(x+7)+3] <= alpha_threshold ? 1 << 0 : 0);
-					fputc(mask, out);
-				}
-
-				fpad(out, 0, img[c].mask_size/img[c].height - x/8);
-			}
-		}
-
-		free(img[c].image_data);
-		if (img[c].palette) palette_free(img[c].palette);
-		if (img[c].row_datas)
-		{
-			free(img[c].row_datas[0]);
-			free(img[c].row_datas);
-		}
-		if (!img[c].store_raw)
-		{
-			png_read_end(img[c].png_ptr, img[c].info_ptr);
+			jobs[c].step = CREATE_WRITE;
+			jobs[c].outfile = out;
+			create_job(&jobs[c]);
+			if (jobs[c].failed)
+				goto done;
+		} else {
+			ico_writer_write_image(writer, jobs[c].index, &buffer);
 		}
-		if (img[c].png_ptr)
-			png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
-		fclose(img[c].in);
-		memset(&img[c], 0, sizeof(*img));
+		if (!flush_buffer(&buffer, out))
+			goto done;
 	}
-
-	free(outname);
-	free(img);
-	return true;
-
-cleanup:
-
-	restore_message_header();
-	for (c = 0; c < filec; c++) {
-		if (img[c].image_data != NULL)
-			free(img[c].image_data);
-		if (img[c].palette != NULL)
-			palette_free(img[c].palette);
-		if (img[c].row_datas != NULL && img[c].row_datas[0] != NULL) {
-			free(img[c].row_datas[0]);
-			free(img[c].row_datas);
-		}
-		if (img[c].png_ptr != NULL)
-			png_destroy_read_struct(&img[c].png_ptr, &img[c].info_ptr, NULL);
-		if (img[c].in != NULL)
-			fclose(img[c].in);
+	if (fflush(out) != 0) {
+		warn_errno(_("cannot write to file"));
+		goto done;
 	}
-	if (outname != NULL)
-		free(outname);
-
-	free(img);
-	return false;
-}
+	success = true;
 
-static void
-simple_setvec(uint8_t *data, uint32_t ofs, uint8_t size, uint32_t value)
-{
-	switch (size) {
-	case 1:
-		data[ofs/8] |= (value & 1) << (7 - ofs%8);
-		break;
-	case 2:
-		data[ofs/4] |= (value & 3) << ((3 - ofs%4) << 1);
-		break;
-	case 4:
-		data[ofs/2] |= (value & 15) << ((1 - ofs%2) << 2);
-		break;
-	case 8:
-		data[ofs] = value;
-		break;
-	case 16:
-		data[2*ofs] = value;
-		data[2*ofs+1] = (value >> 8);
-		break;
-	case 24:
-		data[3*ofs] = value;
-		data[3*ofs+1] = (value >> 8);
-		data[3*ofs+2] = (value >> 16);
-		break;
-	case 32:
-		data[4*ofs] = value;
-		data[4*ofs+1] = (value >> 8);
-		data[4*ofs+2] = (value >> 16);
-		data[4*ofs+3] = (value >> 24);
-		break;
-	}
+done:
+	restore_message_header();
+cleanup:
+	if (out != NULL && out != stdout)
+		fclose(out);
+	free(outname);
+	free(buffer.data);
+	free(jobs);
+	ico_writer_free(writer);
+	return success;
 }
@@ -21,7 +21,9 @@
 #include <stdint.h>		/* POSIX/Gnulib */
 #include <stdlib.h>		/* C89 */
 #include <stdio.h>		/* C89 */
-#include <inttypes.h>
+#include <inttypes.h>		/* C99 */
+#include <string.h>		/* C89 */
+#include <sys/stat.h>		/* Gnulib/POSIX */
 #if HAVE_PNG_H
 # include <png.h>
 #else
@@ -37,465 +39,666 @@
 #  endif
 # endif
 #endif
+#include <zlib.h>		/* zlib */
 #include "gettext.h"		/* Gnulib */
 #include "minmax.h"		/* Gnulib */
 #define _(s) gettext(s)
 #define N_(s) gettext_noop(s)
 #include "xalloc.h"		/* Gnulib */
-#include "common/strbuf.h"
-#include "common/string-utils.h"
+#include "xvasprintf.h"		/* Gnulib */
 #include "common/io-utils.h"
 #include "common/error.h"
+#include "common/store.h"
 #include "icotool.h"
-#include "win32-endian.h"
 
-#define ICO_PNG_MAGIC       0x474e5089
+/* Images of a stream are extracted in batches, so that no more than
+ * this many bytes of image data are held in memory at once when
+ * extracting in parallel. */
+#define STREAM_BATCH_SIZE (16 * 1024 * 1024)
 
-#define ROW_BYTES(bits) ((((bits) + 31) >> 5) << 2)
+/* An image selected for extraction. Images are converted to the
+ * output format in memory by encode_job, possibly on another thread,
+ * and written out in index order by write_job. Vista PNG images are
+ * written as they are when the output format is PNG.
+ */
+typedef struct {
+	const char *inname;
+	char *outname;
+	Archive *archive;
+	ContentStore *store;
+	Stats *stats;
+	char key[STORE_KEY_LENGTH + 1];
+	bool stored;
+	IcoEntry entry;
+	const ExtractOptions *options;
+	uint8_t *output;
+	size_t output_size;
+	size_t output_alloc;
+	bool failed;
+} ExtractJob;
+
+static const struct {
+	const char *name;
+	const char *extension;
+} extract_formats[] = {
+	[EXTRACT_FORMAT_PNG]		= { "png", "png" },
+	[EXTRACT_FORMAT_RGBA]		= { "rgba", "rgba" },
+	[EXTRACT_FORMAT_PAM]		= { "pam", "pam" },
+	[EXTRACT_FORMAT_FARBFELD]	= { "farbfeld", "ff" },
+};
 
-#define FALSE	0
-#define TRUE	1
+/**
+ * Set the output format for extracted images (png, rgba, pam or
+ * farbfeld). Return false if there is no such format.
+ */
+bool
+extract_options_set_format(ExtractOptions *options, const char *name)
+{
+	size_t c;
 
-static uint32_t simple_vec(uint8_t *data, uint32_t ofs, uint8_t size);
-static int read_png(uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t *width, uint32_t *height);
+	for (c = 0; c < sizeof(extract_formats)/sizeof(*extract_formats); c++) {
+		if (strcmp(name, extract_formats[c].name) == 0) {
+			options->format = c;
+			return true;
+		}
+	}
+	return false;
+}
 
-static bool
-xfread(void *ptr, size_t size, FILE *stream)
+/**
+ * Return the file name extension used for images in `format'.
+ */
+const char *
+extract_format_extension(ExtractFormat format)
 {
-	if (fread(ptr, size, 1, stream) < 1) {
-		if (ferror(stream))
-			warn_errno(_("cannot read file"));
-		else
-			warn(_("premature end"));
-		return false;
+	return extract_formats[format].extension;
+}
+
+static void
+append_output(ExtractJob *job, const void *data, size_t size)
+{
+	if (job->output_alloc - job->output_size < size) {
+		job->output_alloc = MAX(job->output_size + size, 2 * job->output_alloc);
+		job->output = xrealloc(job->output, job->output_alloc);
 	}
-	return true;
+	memcpy(job->output + job->output_size, data, size);
+	job->output_size += size;
+}
+
+static void
+put_be32(uint8_t *p, uint32_t value)
+{
+	p[0] = value >> 24;
+	p[1] = value >> 16;
+	p[2] = value >> 8;
+	p[3] = value;
 }
 
-struct png_mem_in
+static void
+put_be16(uint8_t *p, uint16_t value)
 {
-	uint8_t* ptr;
-	uint32_t size;
+	p[0] = value >> 8;
+	p[1] = value;
+}
+
+static void
+png_write_mem(png_structp png_ptr, png_bytep data, png_size_t size)
+{
+	append_output(png_get_io_ptr(png_ptr), data, size);
+}
+
+static void
+png_flush_mem(png_structp png_ptr)
+{
+}
+
+/* PNG encoding profiles. The balanced profile is what libpng does by
+ * default; fast uses the fastest zlib level and only the cheap sub
+ * filter; small tries every filter at maximum compression.
+ */
+static const struct {
+	const char *name;
+	PNGOptions options;
+} png_profiles[] = {
+	{ "fast",	{ 1, -1, PNG_FILTER_SUB, -1, 9 } },
+	{ "balanced",	{ -1, -1, -1, -1, -1 } },
+	{ "small",	{ 9, Z_DEFAULT_STRATEGY, PNG_ALL_FILTERS, 15, 9 } },
+};
+
+static const struct {
+	const char *name;
+	int filters;
+} png_filters[] = {
+	{ "none",	PNG_FILTER_NONE },
+	{ "sub",	PNG_FILTER_SUB },
+	{ "up",		PNG_FILTER_UP },
+	{ "avg",	PNG_FILTER_AVG },
+	{ "paeth",	PNG_FILTER_PAETH },
+	{ "all",	PNG_ALL_FILTERS },
 };
 
-static void png_read_mem (png_structp png, png_bytep data, png_size_t size)
+/**
+ * Set PNG encoding options to those of the named profile
+ * (fast, balanced or small). Return false if there is no such profile.
+ */
+bool
+png_options_set_profile(PNGOptions *options, const char *name)
 {
-	struct png_mem_in* io = (struct png_mem_in*)png_get_io_ptr (png);
-
-	if (io->size < size)
-		png_error (png, _("read error"));
-	else
-  	{
-		memcpy (data, io->ptr, size);
-		io->size -= size;
-		io->ptr += size;
+	size_t c;
+
+	for (c = 0; c < sizeof(png_profiles)/sizeof(*png_profiles); c++) {
+		if (strcmp(name, png_profiles[c].name) == 0) {
+			*options = png_profiles[c].options;
+			return true;
+		}
 	}
+	return false;
 }
 
+/**
+ * Set the PNG row filters that the encoder may choose from, given as a
+ * comma-separated list of filter names (none, sub, up, avg, paeth
+ * or all). Return false if the list contains an unknown name.
+ */
+bool
+png_options_set_filter(PNGOptions *options, const char *names)
+{
+	int filters = 0;
 
+	while (*names != '\0') {
+		size_t len = strcspn(names, ",");
+		size_t c;
 
-int
-extract_icons(FILE *in, const char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter)
-{
-	Win32CursorIconFileDir dir;
-	Win32CursorIconFileDirEntry *entries = NULL;
-	uint32_t offset;
-	uint32_t c, d;
-	int completed = 0;
-	int matched = 0;
+		for (c = 0; c < sizeof(png_filters)/sizeof(*png_filters); c++) {
+			if (strlen(png_filters[c].name) == len && strncmp(names, png_filters[c].name, len) == 0)
+				break;
+		}
+		if (c >= sizeof(png_filters)/sizeof(*png_filters))
+			return false;
+		filters |= png_filters[c].filters;
+		names += len;
+		if (*names == ',')
+			names++;
+	}
+	if (filters == 0)
+		return false;
+	options->filters = filters;
+	return true;
+}
 
-	set_message_header(inname);
+static void
+apply_png_options(png_structp png_ptr, const PNGOptions *options)
+{
+	if (options->level >= 0)
+		png_set_compression_level(png_ptr, options->level);
+	if (options->strategy >= 0)
+		png_set_compression_strategy(png_ptr, options->strategy);
+	if (options->filters >= 0)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, options->filters);
+	if (options->window_bits >= 0)
+		png_set_compression_window_bits(png_ptr, options->window_bits);
+	if (options->mem_level >= 0)
+		png_set_compression_mem_level(png_ptr, options->mem_level);
+}
 
-	if (!xfread(&dir, sizeof(Win32CursorIconFileDir), in))
-		goto cleanup;
-	fix_win32_cursor_icon_file_dir_endian(&dir);
+/* Encode RGBA rows as PNG into job->output. */
+static bool
+encode_png(ExtractJob *job, const uint8_t *pixels)
+{
+	png_structp png_ptr;
+	png_infop info_ptr = NULL;
+	uint32_t d;
 
-	if (dir.reserved != 0) {
-		warn(_("not an icon or cursor file (reserved non-zero)"));
-		goto cleanup;
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
+	if (!png_ptr) {
+		warn(_("cannot initialize PNG library"));
+		return false;
 	}
-	if (dir.type != 1 && dir.type != 2) {
-		warn(_("not an icon or cursor file (wrong type)"));
+	info_ptr = png_create_info_struct(png_ptr);
+	if (!info_ptr) {
+		warn(_("cannot create PNG info structure - out of memory"));
 		goto cleanup;
 	}
+	if (setjmp(png_jmpbuf(png_ptr)))
+		goto cleanup;
+
+	png_set_write_fn(png_ptr, job, png_write_mem, png_flush_mem);
+	apply_png_options(png_ptr, &job->options->png);
+	png_set_IHDR(png_ptr, info_ptr, job->entry.width, job->entry.height, 8,
+			PNG_COLOR_TYPE_RGB_ALPHA,
+			PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT,
+			PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+
+	for (d = 0; d < (uint32_t) job->entry.height; d++)
+		png_write_row(png_ptr, (png_bytep) pixels + d * (size_t) job->entry.width * 4);
+
+	png_write_end(png_ptr, info_ptr);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	return true;
+
+cleanup:
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	return false;
+}
 
-	entries = xmalloc(dir.count * sizeof(Win32CursorIconFileDirEntry));
-	for (c = 0; c < dir.count; c++) {
-		if (!xfread(&entries[c], sizeof(Win32CursorIconFileDirEntry), in))
-			goto cleanup;
-		fix_win32_cursor_icon_file_dir_entry_endian(&entries[c]);
-		if (entries[c].reserved != 0)
-			warn(_("reserved is not zero"));
+/* Write RGBA rows with the header of one of the raw formats into
+ * job->output. The rgba format has a 20-byte header of the magic
+ * "RGBA", the width and height (32 bits), and the index and hotspot
+ * coordinates (16 bits, zero for icons) followed by two zero bytes,
+ * all big-endian. PAM carries the index and hotspot in comments, and
+ * farbfeld has no room for them.
+ */
+static void
+encode_raw(ExtractJob *job, const uint8_t *pixels)
+{
+	size_t row_size = (size_t) job->entry.width * 4;
+	uint8_t header[20];
+	uint32_t d, x;
+
+	switch (job->options->format) {
+	case EXTRACT_FORMAT_RGBA:
+		memcpy(header, "RGBA", 4);
+		put_be32(header + 4, job->entry.width);
+		put_be32(header + 8, job->entry.height);
+		put_be16(header + 12, job->entry.index);
+		put_be16(header + 14, job->entry.hotspot_x);
+		put_be16(header + 16, job->entry.hotspot_y);
+		put_be16(header + 18, 0);
+		append_output(job, header, 20);
+		append_output(job, pixels, row_size * job->entry.height);
+		break;
+	case EXTRACT_FORMAT_PAM: {
+		char *text;
+
+		if (job->entry.is_cursor) {
+			text = xasprintf("P7\n# index %d\n# hotspot %d %d\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+					job->entry.index, job->entry.hotspot_x, job->entry.hotspot_y, job->entry.width, job->entry.height);
+		} else {
+			text = xasprintf("P7\n# index %d\nWIDTH %d\nHEIGHT %d\nDEPTH 4\nMAXVAL 255\nTUPLTYPE RGB_ALPHA\nENDHDR\n",
+					job->entry.index, job->entry.width, job->entry.height);
+		}
+		append_output(job, text, strlen(text));
+		free(text);
+		append_output(job, pixels, row_size * job->entry.height);
+		break;
 	}
-	offset = sizeof(Win32CursorIconFileDir) + dir.count * sizeof(Win32CursorIconFileDirEntry);
-
-	while(completed < dir.count) {
-		uint32_t min_offset = UINT32_MAX;
-		int previous = completed;
-		
-		for (c = 0; c < dir.count; c++) {
-			if (entries[c].dib_offset == offset) {
-				Win32BitmapInfoHeader bitmap;
-				Win32RGBQuad *palette = NULL;
-				uint32_t palette_count = 0;
-				uint32_t image_size, mask_size;
-				int32_t width, height;
-				uint32_t bit_count;
-				uint8_t *image_data = NULL, *mask_data = NULL;
-				png_structp png_ptr = NULL;
-				png_infop info_ptr = NULL;
-				png_byte *row = NULL;
-				char *outname = NULL;
-				FILE *out = NULL;
-				int do_next = FALSE;
-
-				if (!xfread(&bitmap, sizeof(Win32BitmapInfoHeader), in))
-					goto done;
-
-				fix_win32_bitmap_info_header_endian(&bitmap);
-				/* Vista icon: it's just a raw PNG */
-				if (bitmap.size == ICO_PNG_MAGIC)
-				{
-					uint32_t unsigned_width, unsigned_height;
-					fseek(in, offset, SEEK_SET);
-				
-					image_size = entries[c].dib_size;
-					image_data = xmalloc(image_size);
-					if (!xfread(image_data, image_size, in))
-						goto done;
-
-					if (!read_png (image_data, image_size, &bit_count, &unsigned_width, &unsigned_height))
-						goto done;
-
-					width = (int32_t)unsigned_width;
-					height = (int32_t)unsigned_height;
-					if ((bitmap.width > INT32_MAX/4) || (bitmap.height > INT32_MAX)) {
-						warn(_("PNG too large"));
-						goto done;
-					}
-					completed++;
-					
-					if (!filter(completed, width, height, bitmap.bit_count, palette_count, dir.type == 1,
-							(dir.type == 1 ? 0 : entries[c].hotspot_x),
-								(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
-						do_next = TRUE;
-						goto done;
-					}
-					matched++;
-
-					if (listmode) {
-						printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%" PRIu32 " --palette-size=%" PRIu32),
-								(dir.type == 1 ? "icon" : "cursor"), completed, width, height,
-								bit_count, palette_count);
-						if (dir.type == 2)
-							printf(_(" --hotspot-x=%d --hotspot-y=%d"), entries[c].hotspot_x, entries[c].hotspot_y);
-						printf("\n");
-					} else {
-						out = outfile_gen(inname, &outname, width, height, bit_count, completed);
-						restore_message_header();
-						set_message_header(outname);
-
-						if (out == NULL) {
-							warn_errno(_("cannot create file"));
-							goto done;
-						}
-
-						restore_message_header();
-						set_message_header(inname);
-
-						if (fwrite(image_data, image_size, 1, out) != 1) {
-							warn_errno(_("cannot write to file"));
-							goto cleanup;
-						}
-					}
-					offset += image_size;
-				}
-				else
-				{
-					if (bitmap.size < sizeof(Win32BitmapInfoHeader)) {
-						warn(_("bitmap header is too short"));
-						goto done;
-					}
-					if (bitmap.compression != 0) {
-						warn(_("compressed image data not supported"));
-						goto done;
-					}
-					if (bitmap.x_pels_per_meter != 0)
-						warn(_("x_pels_per_meter field in bitmap should be zero"));
-					if (bitmap.y_pels_per_meter != 0)
-						warn(_("y_pels_per_meter field in bitmap should be zero"));
-					if (bitmap.clr_important != 0)
-						warn(_("clr_important field in bitmap should be zero"));
-					if (bitmap.planes != 1)
-						warn(_("planes field in bitmap should be one"));
-					if (bitmap.size != sizeof(Win32BitmapInfoHeader)) {
-						uint32_t skip = bitmap.size - sizeof(Win32BitmapInfoHeader);
-						warn(_("skipping %d bytes of extended bitmap header"), skip);
-						fskip(in, skip);
-					}
-					offset += bitmap.size;
-
-					if (bitmap.clr_used != 0 || bitmap.bit_count < 24) {
-						palette_count = (bitmap.clr_used != 0 ? bitmap.clr_used : (uint32_t) (1 << bitmap.bit_count));
-						if (palette_count > 256) {
-							warn(_("palette too large"));
-							goto done;
-						}
-						palette = xmalloc(sizeof(Win32RGBQuad) * palette_count);
-						if (!xfread(palette, sizeof(Win32RGBQuad) * palette_count, in))
-							goto done;
-						offset += sizeof(Win32RGBQuad) * palette_count;
-					}
-					if (abs(bitmap.width) > INT32_MAX/max(4, bitmap.bit_count)) {
-						warn(_("bitmap width too large"));
-						goto done;
-					}
-
-					width = bitmap.width;
-					height = abs(bitmap.height)/2;
-				
-					image_size = height * ROW_BYTES(width * bitmap.bit_count);
-					mask_size = height * ROW_BYTES(width);
-
-					if (entries[c].dib_size	!= bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad))
-						warn(_("incorrect total size of bitmap (%d specified; %d real)"),
-						    entries[c].dib_size,
-						    bitmap.size + image_size + mask_size + palette_count * sizeof(Win32RGBQuad)
-						);
-
-					image_data = xmalloc(image_size);
-					if (!xfread(image_data, image_size, in))
-						goto done;
-
-					mask_data = xmalloc(mask_size);
-					if (!xfread(mask_data, mask_size, in))
-						goto done;
-
-					offset += image_size;
-					offset += mask_size;
-					completed++;
-
-					if (!filter(completed, width, height, bitmap.bit_count, palette_count, dir.type == 1,
-							(dir.type == 1 ? 0 : entries[c].hotspot_x),
-								(dir.type == 1 ? 0 : entries[c].hotspot_y))) {
-						do_next = TRUE;
-						goto done;
-					}
-					matched++;
-
-					if (!listmode) {
-						png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
-						if (!png_ptr) {
-							warn(_("cannot initialize PNG library"));
-							goto done;
-						}
-						info_ptr = png_create_info_struct(png_ptr);
-						if (!info_ptr) {
-							warn(_("cannot create PNG info structure - out of memory"));
-							goto done;
-						}
-
-						out = outfile_gen(inname, &outname, width, height, bitmap.bit_count, completed);
-						restore_message_header();
-						set_message_header(outname);
-
-						if (out == NULL) {
-							warn_errno(_("cannot create file"));
-							goto done;
-						}
-						png_init_io(png_ptr, out);
-
-						restore_message_header();
-						set_message_header(inname);
-
-						png_set_IHDR(png_ptr, info_ptr,	width, height, 8,
-								PNG_COLOR_TYPE_RGB_ALPHA,
-								PNG_INTERLACE_NONE,
-								PNG_COMPRESSION_TYPE_DEFAULT,
-								PNG_FILTER_TYPE_DEFAULT);
-						png_write_info(png_ptr, info_ptr);
-					}
-
-					row = xmalloc(width * 4);
-
-					for (d = 0; d < (uint32_t) height; d++) {
-						uint32_t x;
-						uint32_t y = (bitmap.height < 0 ? d : height - d - 1);
-						uint32_t imod = y * (image_size / height) * 8 / bitmap.bit_count;
-						uint32_t mmod = y * (mask_size / height) * 8;
-
-						for (x = 0; x < (uint32_t) width; x++) {
-							uint32_t color = simple_vec(image_data, x + imod, bitmap.bit_count);
-
-							if (bitmap.bit_count <= 16) {
-								if (color >= palette_count) {
-									warn("color out of range in image data");
-									goto done;
-								}
-								row[4*x+0] = palette[color].red;
-								row[4*x+1] = palette[color].green;
-								row[4*x+2] = palette[color].blue;
-							} else {
-								row[4*x+0] = (color >> 16) & 0xFF;
-								row[4*x+1] = (color >>  8) & 0xFF;
-								row[4*x+2] = (color >>  0) & 0xFF;
-							}
-							if (bitmap.bit_count == 32)
-							    row[4*x+3] = (color >> 24) & 0xFF;
-							else
-							    row[4*x+3] = simple_vec(mask_data, x + mmod, 1) ? 0 : 0xFF;
-						}
-
-						if (!listmode)
-							png_write_row(png_ptr, row);
-					}
-
-					if (listmode) {
-						printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%" PRIu32 " --palette-size=%" PRIu32),
-								(dir.type == 1 ? "icon" : "cursor"), completed, width, height,
-								bitmap.bit_count, palette_count);
-						if (dir.type == 2)
-							printf(_(" --hotspot-x=%d --hotspot-y=%d"), entries[c].hotspot_x, entries[c].hotspot_y);
-						printf("\n");
-					} else {
-						png_write_end(png_ptr, info_ptr);
-						png_destroy_write_struct(&png_ptr, &info_ptr);
-						/*restore_message_header();*/
-					}
-				}
-				
-			do_next = TRUE;
-			done:
-
-				if (row != NULL) {
-					free(row);
-					row = NULL;
-				}
-				if (palette != NULL) {
-					free(palette);
-					palette = NULL;
-				}
-				if (image_data != NULL) {
-					free(image_data);
-					image_data = NULL;
-				}
-				if(mask_data != NULL) {
-					free(mask_data);
-					mask_data = NULL;
-				}
-				if (out != NULL) {
-					fclose(out);
-					out = NULL;
-				}
-				if (outname != NULL) {
-					free(outname);
-					outname = NULL;
-				}
-				if (do_next == TRUE) {
-					continue;
-				} else {
-					goto cleanup;
-				}
-			} else {
-				if (entries[c].dib_offset > offset)
-					min_offset = MIN(min_offset, entries[c].dib_offset);
-			}
+	case EXTRACT_FORMAT_FARBFELD: {
+		uint8_t *row = xnmalloc(row_size, 2);
+
+		memcpy(header, "farbfeld", 8);
+		put_be32(header + 8, job->entry.width);
+		put_be32(header + 12, job->entry.height);
+		append_output(job, header, 16);
+		/* 8-bit samples are widened to 16 bits as v * 257. */
+		for (d = 0; d < (uint32_t) job->entry.height; d++) {
+			const uint8_t *src = pixels + d * row_size;
+			for (x = 0; x < row_size; x++)
+				row[2*x] = row[2*x+1] = src[x];
+			append_output(job, row, 2 * row_size);
 		}
+		free(row);
+		break;
+	}
+	case EXTRACT_FORMAT_PNG:
+		break;
+	}
+}
 
-		if (previous == completed) {
-			if (min_offset < offset) {
-				warn(_("offset of bitmap header incorrect (too low)"));
-				goto cleanup;
-			}
-			if ((min_offset-offset) == 0) {
-				warn(_("invalid data at expected offset (unrecoverable)"));
-				goto cleanup;
-			}
-			warn(_("skipping %u bytes of garbage at %u"), min_offset-offset, offset);
-			fskip(in, min_offset - offset);
-			offset = min_offset;
-		}
+static void
+encode_job(void *arg)
+{
+	ExtractJob *job = arg;
+	const IcoEntry *entry = &job->entry;
+	Stats *old_stats;
+	uint8_t *pixels;
+	bool success;
+
+	/* Vista PNG images are written as they are. */
+	if (entry->is_png && job->options->format == EXTRACT_FORMAT_PNG) {
+		if (job->store != NULL)
+			store_key(entry->data, entry->data_size, 0, job->key);
+		return;
 	}
 
+	/* Jobs run on pool threads count into the stats of their file. */
+	old_stats = stats_set_current(job->stats);
+	TRACE_BEGIN_INDEX("entry", entry->index);
+	set_message_header(job->inname);
+	STATS_BEGIN(STATS_DECODE);
+	TRACE_BEGIN("decode");
+	pixels = xnmalloc(entry->height, (size_t) entry->width * 4);
+	success = ico_entry_decode(entry, pixels, (size_t) entry->width * 4);
+	TRACE_END("decode");
+	STATS_END(STATS_DECODE);
+
+	/* Images are stored by their pixels, so an image that is already
+	 * in the store is not encoded again. */
+	if (success && job->store != NULL) {
+		char extension[16];
+
+		store_key(pixels, (size_t) entry->height * entry->width * 4,
+				(uint64_t) entry->width << 32 | entry->height, job->key);
+		sprintf(extension, ".%s", extract_format_extension(job->options->format));
+		job->stored = store_contains(job->store, job->key, extension);
+	}
+	if (success && !job->stored) {
+		STATS_BEGIN(STATS_ENCODE);
+		if (job->options->format == EXTRACT_FORMAT_PNG) {
+			TRACE_BEGIN("encode_png");
+			success = encode_png(job, pixels);
+			TRACE_END("encode_png");
+		} else {
+			TRACE_BEGIN("encode_raw");
+			encode_raw(job, pixels);
+			TRACE_END("encode_raw");
+		}
+		STATS_END(STATS_ENCODE);
+	}
+	free(pixels);
+	job->failed = !success;
 	restore_message_header();
-	free(entries);
-	return matched;
-
-cleanup:
+	TRACE_END("entry");
+	stats_set_current(old_stats);
+}
 
-	restore_message_header();
-	free(entries);
-	return -1;
+/* Add the image of a job to the content store, and record where it
+ * came from in the index. */
+static bool
+store_job(ExtractJob *job)
+{
+	const IcoEntry *entry = &job->entry;
+	const void *data = job->output;
+	size_t size = job->output_size;
+	char extension[16];
+	char *fields;
+	bool success;
+
+	if (job->output == NULL) {
+		data = entry->data;
+		size = entry->data_size;
+	}
+	sprintf(extension, ".%s", extract_format_extension(job->options->format));
+	fields = xasprintf("%s\t%d\t%dx%dx%" PRIu32, job->inname, entry->index,
+			entry->width, entry->height, entry->bit_count);
+	success = store_add(job->store, job->key, extension, (job->stored ? NULL : data), size, fields);
+	free(fields);
+	return success;
 }
 
-static uint32_t
-simple_vec(uint8_t *data, uint32_t ofs, uint8_t size)
+static bool
+output_job(ExtractJob *job)
 {
-	switch (size) {
-	case 1:
-		return (data[ofs/8] >> (7 - ofs%8)) & 1;
-	case 2:
-		return (data[ofs/4] >> ((3 - ofs%4) << 1)) & 3;
-	case 4:
-		return (data[ofs/2] >> ((1 - ofs%2) << 2)) & 15;
-	case 8:
-		return data[ofs];
-	case 16:
-		return data[2*ofs] | data[2*ofs+1] << 8;
-	case 24:
-		return data[3*ofs] | data[3*ofs+1] << 8 | data[3*ofs+2] << 16;
-	case 32:
-		return data[4*ofs] | data[4*ofs+1] << 8 | data[4*ofs+2] << 16 | data[4*ofs+3] << 24;
+	const IcoEntry *entry = &job->entry;
+	FILE *out;
+	bool success = false;
+
+	if (job->store != NULL)
+		return store_job(job);
+
+	/* An image in an archive is named like the file it would be
+	 * extracted to. */
+	if (job->archive != NULL) {
+		if (job->output == NULL)
+			return archive_add(job->archive, job->outname, entry->data, entry->data_size);
+		return archive_add(job->archive, job->outname, job->output, job->output_size);
+	}
+
+	if (job->outname == NULL) {
+		out = stdout;
+	} else {
+		out = fopen(job->outname, "wb");
+		if (out == NULL) {
+			set_message_header(job->outname);
+			warn_errno(_("cannot create file"));
+			restore_message_header();
+			return false;
+		}
 	}
 
-	return 0;
+	set_message_header(job->inname);
+	if (job->output == NULL) {
+		if (fwrite(entry->data, entry->data_size, 1, out) != 1) {
+			warn_errno(_("cannot write to file"));
+			goto done;
+		}
+	} else {
+		if (fwrite(job->output, job->output_size, 1, out) != 1) {
+			warn_errno(_("cannot write to file"));
+			goto done;
+		}
+	}
+	success = true;
+
+done:
+	/* Images written to standard out follow each other as a stream. */
+	if (out == stdout) {
+		if (fflush(out) != 0 && success) {
+			warn_errno(_("cannot write to file"));
+			success = false;
+		}
+	} else {
+		fclose(out);
+	}
+	restore_message_header();
+	return success;
 }
 
-static int
-read_png(uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t *width, uint32_t *height)
+/* Encode and write jobs in index order, and free their data. Images
+ * that cannot be decoded or encoded are skipped, which is recorded in
+ * `skipped'. Nothing more is written after the first write failure.
+ */
+static bool
+write_job(ExtractJob *job)
 {
-	png_structp png_ptr;
-	png_infop info_ptr;
-	struct png_mem_in png_in;
-	png_byte ct;
+	bool success;
+
+	STATS_BEGIN(STATS_WRITE);
+	TRACE_BEGIN_INDEX("write", job->entry.index);
+	success = output_job(job);
+	TRACE_END("write");
+	STATS_END(STATS_WRITE);
+	if (success)
+		STATS_ADD(STATS_BYTES_WRITTEN, (job->stored ? 0 : job->output != NULL ? job->output_size : job->entry.data_size));
+	return success;
+}
 
-	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL /*user_error_fn, user_warning_fn*/);
-	if (png_ptr == NULL) {
-		warn(_("cannot initialize PNG library"));
-		return FALSE;
+static bool
+run_jobs(ExtractJob *jobs, size_t count, ThreadPool *pool, bool *skipped)
+{
+	bool success = true;
+	size_t c;
+
+	if (pool != NULL) {
+		ThreadPoolGroup group = THREADPOOL_GROUP_INIT;
+
+		for (c = 0; c < count; c++)
+			threadpool_submit(pool, &group, encode_job, &jobs[c]);
+		threadpool_wait(pool, &group);
 	}
-	info_ptr = png_create_info_struct(png_ptr);
-	if (info_ptr == NULL) {
-		warn(_("cannot create PNG info structure - out of memory"));
-		return FALSE;
+	for (c = 0; c < count; c++) {
+		if (success) {
+			if (pool == NULL)
+				encode_job(&jobs[c]);
+			if (jobs[c].failed)
+				*skipped = true;
+			else if (!write_job(&jobs[c]))
+				success = false;
+		}
+		free(jobs[c].output);
+		free(jobs[c].outname);
+		ico_entry_free(&jobs[c].entry);
 	}
-	
-	if (setjmp(png_jmpbuf(png_ptr)))
-	{
-		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-		return FALSE;
+	return success;
+}
+
+static ssize_t
+read_stream(void *data, void *buffer, size_t size)
+{
+	FILE *in = data;
+	size_t count;
+
+	STATS_BEGIN(STATS_READ);
+	TRACE_BEGIN("read");
+	count = fread(buffer, 1, size, in);
+	TRACE_END("read");
+	STATS_END(STATS_READ);
+	if (count == 0 && ferror(in))
+		return -1;
+	STATS_ADD(STATS_BYTES_READ, count);
+	return count;
+}
+
+/**
+ * Open an icon or cursor file for reading. Regular files are mapped
+ * into memory. Other input, such as pipes, is read forward only, so
+ * that images can be extracted as they are read with bounded memory.
+ * Problems are reported as warnings about the current file.
+ */
+bool
+icon_file_open(IconFile *icf, FILE *in)
+{
+	struct stat statbuf;
+
+	memset(icf, 0, sizeof(IconFile));
+	icf->stream = (fstat(fileno(in), &statbuf) == 0 && !S_ISREG(statbuf.st_mode));
+	if (icf->stream) {
+		STATS_BEGIN(STATS_PARSE);
+		TRACE_BEGIN("parse");
+		icf->reader = ico_reader_open_stream(read_stream, in, warn_message, NULL);
+		TRACE_END("parse");
+		STATS_END(STATS_PARSE);
+	} else {
+		STATS_BEGIN(STATS_READ);
+		TRACE_BEGIN("read");
+		icf->memory = map_file(in, &icf->size, &icf->mapped);
+		TRACE_END("read");
+		STATS_END(STATS_READ);
+		if (icf->memory == NULL) {
+			warn_errno(_("cannot read file"));
+			return false;
+		}
+		STATS_ADD(STATS_BYTES_READ, icf->size);
+		STATS_BEGIN(STATS_PARSE);
+		TRACE_BEGIN("parse");
+		icf->reader = ico_reader_open(icf->memory, icf->size, warn_message, NULL);
+		TRACE_END("parse");
+		STATS_END(STATS_PARSE);
+	}
+	if (icf->reader == NULL) {
+		icon_file_close(icf);
+		return false;
 	}
+	return true;
+}
+
+void
+icon_file_close(IconFile *icf)
+{
+	if (icf->reader != NULL)
+		ico_reader_close(icf->reader);
+	if (icf->memory != NULL)
+		unmap_file(icf->memory, icf->size, icf->mapped);
+	memset(icf, 0, sizeof(IconFile));
+}
 
-	png_in.ptr = image_data;
-	png_in.size = image_size;
-	
-	png_set_read_fn(png_ptr, &png_in, &png_read_mem);
-	png_read_info(png_ptr, info_ptr);
-	png_read_update_info(png_ptr, info_ptr);
-	
-	*width = png_get_image_width(png_ptr, info_ptr);
-	*height = png_get_image_height(png_ptr, info_ptr);
-	ct = png_get_color_type(png_ptr, info_ptr);
-	if (ct & PNG_COLOR_MASK_PALETTE)
-	{
-		*bit_count = png_get_bit_depth(png_ptr, info_ptr);
+struct _Extractor {
+	const char *inname;
+	const ExtractOptions *options;
+	ThreadPool *pool;
+	Archive *archive;
+	ContentStore *store;
+	bool stream;
+	ExtractJob *jobs;
+	size_t job_count;
+	size_t job_alloc;
+	size_t batch_size;
+	bool failed;
+	bool skipped;
+};
+
+/**
+ * Create an extractor for the images of the icon file `icf', which are
+ * written in the format and with the PNG encoding given by `options'.
+ *
+ * If `pool' is not NULL, images are decoded and encoded in parallel on
+ * its threads. Output files are still created and written in index
+ * order by the calling thread. If `archive' is not NULL, images are
+ * added to it instead of being written to files, and likewise for
+ * `store'.
+ */
+Extractor *
+extractor_new(const IconFile *icf, const char *inname, const ExtractOptions *options, ThreadPool *pool, Archive *archive, ContentStore *store)
+{
+	Extractor *ex = xzalloc(sizeof(Extractor));
+
+	ex->inname = inname;
+	ex->options = options;
+	ex->pool = pool;
+	ex->archive = archive;
+	ex->store = store;
+	ex->stream = icf->stream;
+	return ex;
+}
+
+/**
+ * Extract an image just returned by ico_reader_next to the file
+ * `outname', or to standard out if it is NULL. With an archive,
+ * `outname' is the name of the image in the archive, and with a
+ * store, it is not used. The extractor takes
+ * over the name. Images are written some time before extractor_finish
+ * returns; with a stream, they are written in batches as they are
+ * added, to keep the memory used bounded. An image that cannot be
+ * decoded is skipped with a warning. Returns false if writing an
+ * earlier image failed, after which nothing more is written.
+ */
+bool
+extractor_add(Extractor *ex, IconFile *icf, IcoEntry *entry, char *outname)
+{
+	ExtractJob *job;
+
+	if (ex->failed) {
+		free(outname);
+		return false;
 	}
-	else
-		*bit_count = png_get_bit_depth(png_ptr, info_ptr)
-			* png_get_channels(png_ptr, info_ptr);
 
-	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
-	
-	return TRUE;
+	ico_reader_keep(icf->reader, entry);
+	if (ex->job_count >= ex->job_alloc)
+		ex->jobs = x2nrealloc(ex->jobs, &ex->job_alloc, sizeof(ExtractJob));
+	job = &ex->jobs[ex->job_count++];
+	memset(job, 0, sizeof(ExtractJob));
+	job->inname = ex->inname;
+	job->outname = outname;
+	job->archive = ex->archive;
+	job->store = ex->store;
+	job->stats = stats_current();
+	job->entry = *entry;
+	job->options = ex->options;
+
+	ex->batch_size += entry->buffer_size;
+	if (ex->stream && (ex->pool == NULL || ex->batch_size >= STREAM_BATCH_SIZE)) {
+		if (!run_jobs(ex->jobs, ex->job_count, ex->pool, &ex->skipped))
+			ex->failed = true;
+		ex->job_count = 0;
+		ex->batch_size = 0;
+	}
+	return !ex->failed;
 }
 
+/**
+ * Write the images that are still pending and free the extractor.
+ * Images added before an error in the file are still written. Returns
+ * false if any image could not be extracted.
+ */
+bool
+extractor_finish(Extractor *ex)
+{
+	bool success = !ex->failed;
+
+	if (!run_jobs(ex->jobs, ex->job_count, ex->pool, &ex->skipped) || ex->skipped)
+		success = false;
+	free(ex->jobs);
+	free(ex);
+	return success;
+}
@@ -23,24 +23,66 @@
 #include <stdint.h>		/* POSIX/Gnulib */
 #include <stdio.h>		/* C89 */
 #include "common/common.h"
+#include "common/stats.h"
+#include "common/store.h"
+#include "common/trace.h"
+#include "common/threadpool.h"
+#include "icoutils.h"
 
-typedef struct _Palette Palette;
+/* main.c */
+void warn_message(void *data, const char *message);
 
-/* palette.c */
-Palette *palette_new(void);
-void palette_free(Palette *palette);
-void palette_add(Palette *palette, uint8_t r, uint8_t g, uint8_t b);
-bool palette_next(Palette *palette, uint8_t *r, uint8_t *g, uint8_t *b);
-void palette_assign_indices(Palette *palette);
-uint32_t palette_lookup(Palette *palette, uint8_t r, uint8_t g, uint8_t b);
-uint32_t palette_count(Palette *palette);
+/* archive.c */
+typedef enum {
+	ARCHIVE_FORMAT_TAR,
+	ARCHIVE_FORMAT_CPIO,
+} ArchiveFormat;
+typedef struct _Archive Archive;
+bool archive_format_parse(const char *name, ArchiveFormat *format);
+Archive *archive_new(FILE *out, const char *name, ArchiveFormat format);
+bool archive_add(Archive *archive, const char *name, const void *data, size_t size);
+bool archive_finish(Archive *archive);
 
 /* extract.c */
-typedef FILE *(*ExtractNameGen)(const char *inname, char **outname, int width, int height, int bitcount, int index);
-typedef bool (*ExtractFilter)(int index, int width, int height, int bitdepth, int palettesize, bool icon, int hotspot_x, int hotspot_y);
-int extract_icons(FILE *in, const char *inname, bool listmode, ExtractNameGen outfile_gen, ExtractFilter filter);
+/* Encoding options for extracted PNG images. Negative values select
+ * the libpng defaults. */
+typedef struct {
+	int level;		/* zlib compression level, 0-9 */
+	int strategy;		/* zlib strategy (Z_FILTERED etc) */
+	int filters;		/* PNG_FILTER_* flags */
+	int window_bits;	/* zlib window size, 8-15 */
+	int mem_level;		/* zlib memory level, 1-9 */
+} PNGOptions;
+typedef enum {
+	EXTRACT_FORMAT_PNG,
+	EXTRACT_FORMAT_RGBA,
+	EXTRACT_FORMAT_PAM,
+	EXTRACT_FORMAT_FARBFELD,
+} ExtractFormat;
+typedef struct {
+	ExtractFormat format;
+	PNGOptions png;
+} ExtractOptions;
+bool png_options_set_profile(PNGOptions *options, const char *name);
+bool png_options_set_filter(PNGOptions *options, const char *names);
+bool extract_options_set_format(ExtractOptions *options, const char *name);
+const char *extract_format_extension(ExtractFormat format);
+typedef struct {
+	IcoReader *reader;
+	bool stream;		/* read forward only */
+	void *memory;
+	size_t size;
+	bool mapped;
+} IconFile;
+typedef struct _Extractor Extractor;
+bool icon_file_open(IconFile *icf, FILE *in);
+void icon_file_close(IconFile *icf);
+Extractor *extractor_new(const IconFile *icf, const char *inname, const ExtractOptions *options, ThreadPool *pool, Archive *archive, ContentStore *store);
+bool extractor_add(Extractor *ex, IconFile *icf, IcoEntry *entry, char *outname);
+bool extractor_finish(Extractor *ex);
 
 /* create.c */
 typedef FILE *(*CreateNameGen)(char **outname);
-bool create_icon(size_t filec, char **filev, size_t raw_filec, char** raw_filev, CreateNameGen outfile_gen, bool icon_mode, int32_t hotspot_x, int32_t hotspot_y, int32_t alpha_threshold, int32_t bit_count);
+bool compression_parse(const char *name, IcoCompression *compression);
+bool create_icon(size_t filec, char **filev, size_t raw_filec, char** raw_filev, CreateNameGen outfile_gen, const IcoWriterOptions *options, ThreadPool *pool, bool stream);
 #endif
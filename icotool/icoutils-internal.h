@@ -0,0 +1,117 @@
+/* icoutils-internal.h - Declarations shared by the icon library sources
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ICOUTILS_INTERNAL_H
+#define ICOUTILS_INTERNAL_H
+
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stdint.h>		/* POSIX/Gnulib */
+#if HAVE_PNG_H
+# include <png.h>
+#else
+# if HAVE_LIBPNG_PNG_H
+#  include <libpng/png.h>
+# else
+#  if HAVE_LIBPNG10_PNG_H
+#   include <libpng10/png.h>
+#  else
+#   if HAVE_LIBPNG12_PNG_H
+#    include <libpng12/png.h>
+#   endif
+#  endif
+# endif
+#endif
+#include "common/common.h"
+#include "common/cpu.h"
+#include "icoutils.h"
+
+#define ROW_BYTES(bits) ((((bits) + 31) >> 5) << 2)
+
+/* reader.c */
+typedef struct {
+	const uint8_t *ptr;
+	size_t size;
+} PngMemoryInput;
+typedef struct {
+	IcoMessageFunc message;
+	void *message_data;
+} PngMessageTarget;
+void ico_report(IcoMessageFunc message, void *message_data, const char *format, ...);
+void png_read_mem(png_structp png_ptr, png_bytep data, png_size_t size);
+void png_error_message(png_structp png_ptr, png_const_charp text);
+void png_warning_message(png_structp png_ptr, png_const_charp text);
+
+typedef struct _Palette Palette;
+
+/* palette.c */
+#define PALETTE_MAX 256
+#define PALETTE_FULL ((uint32_t) -1)
+Palette *palette_new(void);
+void palette_free(Palette *palette);
+uint32_t palette_add(Palette *palette, uint8_t r, uint8_t g, uint8_t b);
+bool palette_next(Palette *palette, uint8_t *r, uint8_t *g, uint8_t *b);
+uint32_t palette_count(Palette *palette);
+
+/* rowconv.c */
+typedef uint32_t (*DIBRowDecoder)(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette);
+DIBRowDecoder dib_row_decoder(uint32_t bit_count);
+void dib_palette_to_rgba(uint8_t *rgba, const uint8_t *quads, uint32_t count);
+typedef struct {
+	void (*bgr_to_rgba)(uint8_t *dst, const uint8_t *src, uint32_t width);
+	void (*swap_rb)(uint8_t *dst, const uint8_t *src, uint32_t width);
+	void (*rgba_to_bgr)(uint8_t *dst, const uint8_t *src, uint32_t width);
+	void (*mask_to_alpha)(uint8_t *row, const uint8_t *mask, uint32_t width);
+	void (*alpha_to_mask)(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold);
+	uint32_t (*scan_alpha)(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha);
+} RowConvOps;
+#define ALPHA_ZERO 1
+#define ALPHA_FULL 2
+extern RowConvOps rowconv;
+void rowconv_init(void);
+void bgr_to_rgba_scalar(uint8_t *dst, const uint8_t *src, uint32_t width);
+void swap_rb_scalar(uint8_t *dst, const uint8_t *src, uint32_t width);
+void rgba_to_bgr_scalar(uint8_t *dst, const uint8_t *src, uint32_t width);
+void mask_to_alpha_scalar(uint8_t *row, const uint8_t *mask, uint32_t width);
+void alpha_to_mask_scalar(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold);
+uint32_t scan_alpha_scalar(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha);
+
+/* rowconv-simd.c */
+#if CPU_X86_SIMD
+void swap_rb_sse2(uint8_t *dst, const uint8_t *src, uint32_t width);
+void mask_to_alpha_sse2(uint8_t *row, const uint8_t *mask, uint32_t width);
+void alpha_to_mask_sse2(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold);
+uint32_t scan_alpha_sse2(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha);
+void bgr_to_rgba_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width);
+void swap_rb_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width);
+void rgba_to_bgr_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width);
+void bgr_to_rgba_avx2(uint8_t *dst, const uint8_t *src, uint32_t width);
+void swap_rb_avx2(uint8_t *dst, const uint8_t *src, uint32_t width);
+void mask_to_alpha_avx2(uint8_t *row, const uint8_t *mask, uint32_t width);
+void alpha_to_mask_avx2(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold);
+uint32_t scan_alpha_avx2(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha);
+#endif
+#if CPU_ARM_NEON
+void bgr_to_rgba_neon(uint8_t *dst, const uint8_t *src, uint32_t width);
+void swap_rb_neon(uint8_t *dst, const uint8_t *src, uint32_t width);
+void rgba_to_bgr_neon(uint8_t *dst, const uint8_t *src, uint32_t width);
+void mask_to_alpha_neon(uint8_t *row, const uint8_t *mask, uint32_t width);
+void alpha_to_mask_neon(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold);
+uint32_t scan_alpha_neon(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha);
+#endif
+
+#endif
@@ -0,0 +1,136 @@
+/* icoutils.h - Reading and writing icon and cursor files in memory
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef ICOUTILS_H
+#define ICOUTILS_H
+
+#include <stdbool.h>		/* POSIX/Gnulib */
+#include <stddef.h>		/* C89 */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <sys/types.h>		/* POSIX */
+
+/* The icon library decodes and encodes icon and cursor files held in
+ * memory. It keeps no global state apart from conversion tables that
+ * are set up once, so readers and writers may be used on different
+ * threads at the same time. A single reader or writer must only be
+ * used by one thread at a time, but entries that have been kept may
+ * be decoded on any thread, and images reserved in a writer may be
+ * set from any thread.
+ *
+ * Problems are reported as translated, human-readable messages through
+ * an optional callback. Functions that fail return false, NULL or -1
+ * after reporting why. Like the rest of icoutils, the library aborts
+ * the program if memory cannot be allocated.
+ */
+
+typedef void (*IcoMessageFunc)(void *data, const char *message);
+
+/* Read up to `size' bytes into `buffer'. Return the number of bytes
+ * read, 0 at end of input, or -1 with errno set on error. */
+typedef ssize_t (*IcoReadFunc)(void *data, void *buffer, size_t size);
+
+typedef struct _IcoReader IcoReader;
+typedef struct _IcoWriter IcoWriter;
+
+/* An image in an icon or cursor file, as returned by ico_reader_next.
+ * Only the fields up to `data_size' are meant to be used directly.
+ */
+typedef struct {
+	int index;		/* position in file order, from 1 */
+	bool is_cursor;
+	bool is_png;		/* stored as PNG (Vista icon) */
+	int32_t width;
+	int32_t height;
+	uint32_t bit_count;	/* bits per pixel, or per index for PNG */
+	uint32_t palette_count;
+	uint16_t hotspot_x;	/* zero for icons */
+	uint16_t hotspot_y;
+	const uint8_t *data;	/* the PNG image, or the DIB pixel data */
+	uint32_t data_size;
+
+	bool top_down;
+	uint32_t image_stride;	/* bytes per row of DIB pixel data */
+	uint32_t mask_stride;
+	const uint8_t *mask;
+	const uint8_t *palette;
+	uint8_t *buffer;
+	size_t buffer_size;
+	IcoMessageFunc message;
+	void *message_data;
+} IcoEntry;
+
+IcoReader *ico_reader_open(const void *data, size_t size, IcoMessageFunc message, void *message_data);
+IcoReader *ico_reader_open_stream(IcoReadFunc read, void *read_data, IcoMessageFunc message, void *message_data);
+int ico_reader_next(IcoReader *reader, IcoEntry *entry);
+void ico_reader_keep(IcoReader *reader, IcoEntry *entry);
+void ico_reader_close(IcoReader *reader);
+bool ico_entry_decode(const IcoEntry *entry, uint8_t *rgba, size_t stride);
+void ico_entry_free(IcoEntry *entry);
+bool ico_entry_better(const IcoEntry *a, const IcoEntry *b, uint32_t size, uint32_t bit_count);
+
+/* A growable block of memory that written files are stored in. It
+ * should be initialized to zero and its data freed with free. */
+typedef struct {
+	uint8_t *data;
+	size_t size;
+	size_t alloc;
+} IcoBuffer;
+
+/* How images given as RGBA are stored. In auto mode, images at least
+ * png_size pixels wide or high are stored as PNG, images narrower and
+ * lower than png_min_size as DIBs, and other images in whichever
+ * encoding is smaller. */
+typedef enum {
+	ICO_COMPRESSION_BMP,
+	ICO_COMPRESSION_PNG,
+	ICO_COMPRESSION_AUTO,
+} IcoCompression;
+
+typedef struct {
+	bool cursor;
+	uint16_t hotspot_x;	/* used for all cursor images */
+	uint16_t hotspot_y;
+	uint8_t alpha_threshold; /* highest alpha that is transparent in the mask */
+	int32_t bit_count;	/* bits per pixel of DIB images, or -1 for the least needed */
+	IcoCompression compression;
+	uint32_t png_size;
+	uint32_t png_min_size;
+	int png_level;		/* zlib level of PNG images, or -1 for the default */
+	int png_filters;	/* PNG_FILTER_* flags of PNG images, or -1 for the default */
+} IcoWriterOptions;
+
+/* The bytes at the start of a PNG image that hold its dimensions and
+ * depth: the signature and the IHDR chunk. */
+#define ICO_PNG_HEADER_SIZE 33
+
+IcoWriter *ico_writer_new(const IcoWriterOptions *options, IcoMessageFunc message, void *message_data);
+bool ico_writer_add_rgba(IcoWriter *writer, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride);
+bool ico_writer_add_png(IcoWriter *writer, const void *data, size_t size);
+size_t ico_writer_reserve(IcoWriter *writer, size_t count);
+bool ico_writer_set_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride);
+bool ico_writer_set_png(IcoWriter *writer, size_t index, const void *data, size_t size);
+bool ico_writer_plan_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride);
+bool ico_writer_plan_png(IcoWriter *writer, size_t index, const void *data, size_t size);
+void ico_writer_finish(IcoWriter *writer, IcoBuffer *out);
+void ico_writer_start(IcoWriter *writer, IcoBuffer *out);
+void ico_writer_write_image(IcoWriter *writer, size_t index, IcoBuffer *out);
+bool ico_writer_write_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride, IcoBuffer *out);
+bool ico_writer_write_png(IcoWriter *writer, size_t index, const void *data, size_t size, IcoBuffer *out);
+void ico_writer_free(IcoWriter *writer);
+
+#endif
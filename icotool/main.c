@@ -23,6 +23,7 @@
 #include <getopt.h>		/* Gnulib/GNU Libc */
 #include <string.h>		/* C89 */
 #include <stdlib.h>		/* C89 */
+#include <inttypes.h>		/* C99 */
 #ifdef HAVE_LOCALE_H
 # include <locale.h>		/* Solaris */
 #endif
@@ -30,6 +31,7 @@
 #include "configmake.h"
 #define _(s) gettext(s)
 #define N_(s) gettext_noop(s)
+#include "minmax.h"		/* Gnulib */
 #include "progname.h"		/* Gnulib */
 #include "version-etc.h"	/* Gnulib */
 #include "xalloc.h"		/* Gnulib */
@@ -56,6 +58,41 @@ static int32_t alpha_threshold = 127;
 static bool icon_only = false;	
 static bool cursor_only = false;
 static char *output = NULL;
+static uint32_t jobs = 1;
+static const char *files_from = NULL;
+static bool null_separated = false;
+static ThreadPool *pool = NULL;
+static const char *png_profile = NULL;
+static int32_t png_level = -1;
+static const char *png_filter = NULL;
+static ExtractOptions extract_options;
+static uint32_t best_size = 0;
+static uint32_t best_bit_count = 0;
+static uint32_t dpi_scale = 100;
+static bool archive_set = false;
+static ArchiveFormat archive_format;
+static Archive *archive = NULL;
+static const char *store_dir = NULL;
+static bool store_sha256 = false;
+static ContentStore *store = NULL;
+static bool show_stats = false;
+static StatsFormat stats_format = STATS_FORMAT_TEXT;
+static const char *trace_filename = NULL;
+static bool stream = false;
+static IcoCompression compression = ICO_COMPRESSION_BMP;
+static uint32_t png_size = 256;
+static uint32_t png_min_size = 0;
+
+/* A file named on the command line or in a --files-from list. */
+typedef struct {
+    const char *name;
+    bool failed;
+    Stats stats;
+} BatchFile;
+
+static BatchFile *files = NULL;
+static size_t file_count = 0;
+static size_t file_alloc = 0;
 
 const char version_etc_copyright[] = "Copyright (C) 1998 Oskar Liljeblad";
 
@@ -64,9 +101,25 @@ enum {
     HELP_OPT,
     ICON_OPT,
     CURSOR_OPT,
+    NULL_OPT,
+    PNG_PROFILE_OPT,
+    PNG_LEVEL_OPT,
+    PNG_FILTER_OPT,
+    FORMAT_OPT,
+    BEST_SIZE_OPT,
+    DPI_SCALE_OPT,
+    ARCHIVE_OPT,
+    STORE_OPT,
+    STORE_SHA256_OPT,
+    STATS_OPT,
+    TRACE_OPT,
+    STREAM_OPT,
+    COMPRESS_OPT,
+    PNG_SIZE_OPT,
+    PNG_MIN_SIZE_OPT,
 };
 
-static const char *short_opts = "xlco:i:w:h:p:b:X:Y:t:r:";
+static const char *short_opts = "xlco:i:w:h:p:b:X:Y:t:r:j:T:";
 static struct option long_opts[] = {
     { "extract",		no_argument,    	NULL, 'x' },
     { "list",			no_argument,		NULL, 'l' },
@@ -86,33 +139,77 @@ static struct option long_opts[] = {
     { "icon",       	 	no_argument,       	NULL, ICON_OPT	},
     { "cursor",     	 	no_argument,       	NULL, CURSOR_OPT },
     { "raw", 			required_argument, 	NULL, 'r' },
+    { "stream", 		no_argument, 		NULL, STREAM_OPT },
+    { "compress", 		required_argument, 	NULL, COMPRESS_OPT },
+    { "png-size", 		required_argument, 	NULL, PNG_SIZE_OPT },
+    { "png-min-size", 		required_argument, 	NULL, PNG_MIN_SIZE_OPT },
+    { "jobs", 			required_argument, 	NULL, 'j' },
+    { "files-from", 		required_argument, 	NULL, 'T' },
+    { "null", 			no_argument, 		NULL, NULL_OPT },
+    { "png-profile", 		required_argument, 	NULL, PNG_PROFILE_OPT },
+    { "png-level", 		required_argument, 	NULL, PNG_LEVEL_OPT },
+    { "png-filter", 		required_argument, 	NULL, PNG_FILTER_OPT },
+    { "format", 		required_argument, 	NULL, FORMAT_OPT },
+    { "best-size", 		required_argument, 	NULL, BEST_SIZE_OPT },
+    { "dpi-scale", 		required_argument, 	NULL, DPI_SCALE_OPT },
+    { "archive", 		required_argument, 	NULL, ARCHIVE_OPT },
+    { "store", 			required_argument, 	NULL, STORE_OPT },
+    { "store-sha256", 		no_argument, 		NULL, STORE_SHA256_OPT },
+    { "stats", 			optional_argument, 	NULL, STATS_OPT },
+    { "trace", 			required_argument, 	NULL, TRACE_OPT },
     { 0, 0, 0, 0 }
 };
 
+/* Print a message from the icon library as a warning. */
+void
+warn_message(void *data, const char *message)
+{
+    warn("%s", message);
+}
+
+/* Return true if an image matches all filter options. */
 static bool
-filter(int i, int w, int h, int bd, int ps, bool icon, int hx, int hy)
+entry_matches(const IcoEntry *entry)
 {
-    if (image_index != -1 && i != image_index)
+    if (image_index != -1 && entry->index != image_index)
 	return false;
-    if (width != -1 && w != width)
+    if (width != -1 && entry->width != width)
 	return false;
-    if (height != -1 && h != height)
+    if (height != -1 && entry->height != height)
 	return false;
-    if (bitdepth != -1 && bd != bitdepth)
+    if (bitdepth != -1 && entry->bit_count != (uint32_t) bitdepth)
 	return false;
     /*if (bd < minbitdepth)
         return false;*/
-    if (palettesize != -1 && ps != palettesize)
+    if (palettesize != -1 && entry->palette_count != (uint32_t) palettesize)
 	return false;
-    if ((icon_only && !icon) || (cursor_only && icon))
+    if ((icon_only && entry->is_cursor) || (cursor_only && !entry->is_cursor))
 	return false;
-    if (hotspot_x_set && hx != hotspot_x)
+    if (hotspot_x_set && entry->hotspot_x != hotspot_x)
 	return false;
-    if (hotspot_y_set && hy != hotspot_y)	
+    if (hotspot_y_set && entry->hotspot_y != hotspot_y)
 	return false;
     return true;
 }
 
+/* Parse a --best-size value of the form SIZE[@BITS]. */
+static bool
+parse_best_size(const char *value)
+{
+    char *size = xstrdup(value);
+    char *bits = strchr(size, '@');
+    bool success = true;
+
+    best_bit_count = 0;
+    if (bits != NULL) {
+	*bits++ = '\0';
+	success = parse_uint32(bits, &best_bit_count) && best_bit_count > 0;
+    }
+    success = success && parse_uint32(size, &best_size) && best_size > 0;
+    free(size);
+    return success;
+}
+
 static FILE *
 create_outfile_gen(char **out)
 {
@@ -126,15 +223,21 @@ create_outfile_gen(char **out)
     return stdout;
 }
 
-static FILE *
-extract_outfile_gen(const char *inname, char **outname_ptr, int w, int h, int bc, int i)
+/* Return the name of the file to extract an image to, or NULL for
+ * standard out or a store. Images in an archive are named without a
+ * directory.
+ */
+static char *
+extract_outname(const char *inname, const IcoEntry *entry)
 {
-    if (output == NULL || is_directory(output)) {
+    if (store != NULL)
+	return NULL;
+    if (archive != NULL || output == NULL || is_directory(output)) {
 	StrBuf *outname;
 	const char *inbase;
 
 	outname = strbuf_new();
-	if (output != NULL) {
+	if (archive == NULL && output != NULL) {
 	    strbuf_append(outname, output);
 	    if (!ends_with(output, "/"))
 		strbuf_append(outname, "/");
@@ -146,17 +249,26 @@ extract_outfile_gen(const char *inname, char **outname_ptr, int w, int h, int bc
 	} else {
 	    strbuf_append(outname, inbase);
 	}
-	strbuf_appendf(outname, "_%d_%dx%dx%d.png", i, w, h, bc);
-	*outname_ptr = strbuf_free_to_string(outname);
-	return fopen(*outname_ptr, "wb");
+	strbuf_appendf(outname, "_%d_%dx%dx%" PRIu32 ".%s", entry->index, entry->width, entry->height,
+		entry->bit_count, extract_format_extension(extract_options.format));
+	return strbuf_free_to_string(outname);
     }
     else if (strcmp(output, "-") == 0) {
-	*outname_ptr = xstrdup(_("(standard out)"));
-	return stdout;
+	return NULL;
     }
 
-    *outname_ptr = xstrdup(output);
-    return fopen(output, "wb");
+    return xstrdup(output);
+}
+
+static void
+list_entry(const IcoEntry *entry)
+{
+    printf(_("--%s --index=%d --width=%d --height=%d --bit-depth=%" PRIu32 " --palette-size=%" PRIu32),
+	    (entry->is_cursor ? "cursor" : "icon"), entry->index, entry->width, entry->height,
+	    entry->bit_count, entry->palette_count);
+    if (entry->is_cursor)
+	printf(_(" --hotspot-x=%d --hotspot-y=%d"), entry->hotspot_x, entry->hotspot_y);
+    printf("\n");
 }
 
 static void
@@ -182,15 +294,51 @@ display_help(void)
     printf(_("  -t, --alpha-threshold=LEVEL  highest level in alpha channel indicating\n"
 	     "                               transparent image portions (default is 127)\n"));
     printf(_("  -r, --raw=FILENAME           store input file as raw PNG (\"Vista icons\")\n"));
+    printf(_("      --stream                 read input files twice to hold only one image\n"
+	     "                               in memory at a time when creating\n"));
+    printf(_("      --compress=MODE          store created images as bmp (default), png,\n"
+	     "                               or auto to choose for each image\n"));
+    printf(_("      --png-size=PIXELS        with --compress=auto, store images at least\n"
+	     "                               PIXELS wide or high as PNG (default 256)\n"));
+    printf(_("      --png-min-size=PIXELS    with --compress=auto, store images narrower\n"
+	     "                               and lower than PIXELS as DIBs (default 0)\n"));
     printf(_("      --icon                   match icons only\n"));
     printf(_("      --cursor                 match cursors only\n"));
     printf(_("  -o, --output=PATH            where to place extracted files\n"));
+    printf(_("  -j, --jobs=COUNT             number of threads to use for extraction\n"
+	     "                               or creation\n"
+	     "                               (0 means one per processor, default is 1)\n"));
+    printf(_("  -T, --files-from=FILE        read names of files to list or extract from\n"
+	     "                               FILE, one per line (`-' for standard in)\n"));
+    printf(_("      --null                   names in --files-from are separated by\n"
+	     "                               null characters instead of newlines\n"));
+    printf(_("      --format=FORMAT          format of extracted images: png (default),\n"
+	     "                               rgba, pam or farbfeld\n"));
+    printf(_("      --best-size=SIZE[@BITS]  only the image best suited for SIZE pixels\n"
+	     "                               (and a display of BITS bits per pixel)\n"));
+    printf(_("      --dpi-scale=PERCENT      scale the --best-size size by PERCENT\n"));
+    printf(_("      --archive=FORMAT         write extracted images into one tar or cpio\n"
+	     "                               archive (the default for -o NAME.tar and\n"
+	     "                               -o NAME.cpio)\n"));
+    printf(_("      --store=DIR              add extracted images to a content-addressed\n"
+	     "                               store in DIR, keeping one copy of each image\n"));
+    printf(_("      --store-sha256           record SHA-256 digests in the store index\n"));
+    printf(_("      --stats[=FORMAT]         print time spent and counters on exit, per\n"
+	     "                               file and in total, as text or json\n"));
+    printf(_("      --trace=FILE             write a Chrome trace of the time spent on\n"
+	     "                               each file, image and phase to FILE\n"));
+    printf(_("      --png-profile=PROFILE    PNG encoding profile for extracted images\n"
+	     "                               and images created as PNG:\n"
+	     "                               fast, balanced (default) or small\n"));
+    printf(_("      --png-level=LEVEL        PNG compression level, 0 (none) to 9 (best)\n"));
+    printf(_("      --png-filter=FILTERS     PNG row filters to choose from, separated by\n"
+	     "                               commas: none, sub, up, avg, paeth or all\n"));
     printf(_("\n"));
     printf(_("Report bugs to <%s>.\n"), PACKAGE_BUGREPORT);
 }
 
 static bool
-open_file_or_stdin(char *name, FILE **outfile, const char **outname)
+open_file_or_stdin(const char *name, FILE **outfile, const char **outname)
 {
     if (strcmp(name, "-") == 0) {
         *outfile = stdin;
@@ -206,6 +354,171 @@ open_file_or_stdin(char *name, FILE **outfile, const char **outname)
     return true;
 }
 
+static void
+add_file(const char *name)
+{
+    if (file_count >= file_alloc)
+	files = x2nrealloc(files, &file_alloc, sizeof(BatchFile));
+    files[file_count].name = name;
+    files[file_count].failed = false;
+    memset(&files[file_count].stats, 0, sizeof(Stats));
+    file_count++;
+}
+
+static void
+add_files_from(const char *listname)
+{
+    FILE *list;
+    char *line = NULL;
+    size_t size = 0;
+    ssize_t len;
+    int delim = (null_separated ? '\0' : '\n');
+
+    if (strcmp(listname, "-") == 0) {
+	list = stdin;
+    } else {
+	list = fopen(listname, "r");
+	if (list == NULL)
+	    die_errno(_("%s: cannot open file"), listname);
+    }
+    while ((len = getdelim(&line, &size, delim, list)) != -1) {
+	if (len > 0 && line[len-1] == delim)
+	    line[--len] = '\0';
+	if (len > 0)
+	    add_file(xstrdup(line));
+    }
+    if (ferror(list))
+	die_errno(_("%s: cannot read file"), listname);
+    free(line);
+    if (list != stdin)
+	fclose(list);
+}
+
+/* Read the next entry of a file, timing it as parsing. */
+static int
+read_entry(IcoReader *reader, IcoEntry *entry)
+{
+    int status;
+
+    STATS_BEGIN(STATS_PARSE);
+    TRACE_BEGIN("parse");
+    status = ico_reader_next(reader, entry);
+    TRACE_END("parse");
+    STATS_END(STATS_PARSE);
+    if (status > 0)
+	STATS_ADD(STATS_ENTRIES, 1);
+    return status;
+}
+
+/* List or extract the images of a single file. Images are read in
+ * file order, and only those that match the filter options are
+ * decoded. Reading stops after the image selected with --index. With
+ * --best-size, only the best of the matching images is decoded.
+ * Return false if the file could not be processed, or if no images
+ * were listed.
+ */
+static bool
+process_file(const char *name, bool listmode)
+{
+    FILE *in;
+    const char *inname;
+    IconFile icf;
+    Extractor *ex = NULL;
+    IcoEntry entry;
+    IcoEntry best;
+    uint32_t size = ((uint64_t) best_size * dpi_scale + 50) / 100;
+    int matched = 0;
+    int status;
+
+    if (!open_file_or_stdin(name, &in, &inname))
+	return false;
+    set_message_header(inname);
+    if (!icon_file_open(&icf, in)) {
+	restore_message_header();
+	if (in != stdin)
+	    fclose(in);
+	return false;
+    }
+    if (!listmode)
+	ex = extractor_new(&icf, inname, &extract_options, pool, archive, store);
+
+    while ((status = read_entry(icf.reader, &entry)) > 0) {
+	if (entry_matches(&entry)) {
+	    if (best_size != 0) {
+		/* Only the headers are needed to rank the images. */
+		if (matched == 0 || ico_entry_better(&entry, &best, size, best_bit_count)) {
+		    if (matched != 0)
+			ico_entry_free(&best);
+		    ico_reader_keep(icf.reader, &entry);
+		    best = entry;
+		}
+		matched = 1;
+	    } else {
+		matched++;
+		if (listmode) {
+		    list_entry(&entry);
+		} else if (!extractor_add(ex, &icf, &entry, extract_outname(inname, &entry))) {
+		    status = -1;
+		    break;
+		}
+	    }
+	}
+	if (image_index != -1 && entry.index >= image_index)
+	    break;
+    }
+
+    /* The best image found before an error is still used. */
+    if (best_size != 0 && matched != 0) {
+	if (listmode) {
+	    list_entry(&best);
+	    ico_entry_free(&best);
+	} else if (!extractor_add(ex, &icf, &best, extract_outname(inname, &best))) {
+	    ico_entry_free(&best);
+	    status = -1;
+	}
+    }
+    if (ex != NULL && !extractor_finish(ex))
+	status = -1;
+    restore_message_header();
+    icon_file_close(&icf);
+    if (in != stdin)
+	fclose(in);
+
+    if (status < 0)
+	return false;
+    if (listmode)
+	return matched > 0;
+    if (matched == 0)
+	fprintf(stderr, _("%s: no images matched\n"), inname);
+    return true;
+}
+
+static void
+extract_file_task(void *arg)
+{
+    BatchFile *file = arg;
+    Stats *old_stats = stats_set_current(&file->stats);
+
+    TRACE_BEGIN_FILE("file", file->name);
+    file->failed = !process_file(file->name, false);
+    TRACE_END("file");
+    stats_set_current(old_stats);
+}
+
+/* Print statistics to standard error, for each file if there are
+ * several, and in total. */
+static void
+print_stats(void)
+{
+    size_t f;
+
+    if (file_count > 1) {
+	for (f = 0; f < file_count; f++)
+	    stats_print(stderr, files[f].name, &files[f].stats, stats_format);
+    }
+    stats_print(stderr, NULL, stats_total(), stats_format);
+}
+
 int
 main(int argc, char **argv)
 {
@@ -213,9 +526,9 @@ main(int argc, char **argv)
     bool list_mode = false;
     bool extract_mode = false;
     bool create_mode = false;
-    FILE *in;
-    const char *inname;
     size_t raw_filec = 0;
+    size_t f;
+    bool failed = false;
     char** raw_filev = 0;
 
     set_program_name(argv[0]);
@@ -292,6 +605,76 @@ main(int argc, char **argv)
 	    raw_filev[raw_filec] = optarg;
 	    raw_filec++;
 	    break;
+	case 'j':
+	    if (!parse_uint32(optarg, &jobs))
+		die(_("invalid jobs value: %s"), optarg);
+	    if (jobs == 0) {
+		long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+		jobs = (cpus > 0 ? cpus : 1);
+	    }
+	    break;
+	case 'T':
+	    files_from = optarg;
+	    break;
+	case NULL_OPT:
+	    null_separated = true;
+	    break;
+	case PNG_PROFILE_OPT:
+	    png_profile = optarg;
+	    break;
+	case PNG_LEVEL_OPT:
+	    if (!parse_int32(optarg, &png_level) || png_level < 0 || png_level > 9)
+		die(_("invalid png-level value: %s"), optarg);
+	    break;
+	case PNG_FILTER_OPT:
+	    png_filter = optarg;
+	    break;
+	case FORMAT_OPT:
+	    if (!extract_options_set_format(&extract_options, optarg))
+		die(_("invalid format value: %s"), optarg);
+	    break;
+	case BEST_SIZE_OPT:
+	    if (!parse_best_size(optarg))
+		die(_("invalid best-size value: %s"), optarg);
+	    break;
+	case ARCHIVE_OPT:
+	    if (!archive_format_parse(optarg, &archive_format))
+		die(_("invalid archive value: %s"), optarg);
+	    archive_set = true;
+	    break;
+	case STORE_OPT:
+	    store_dir = optarg;
+	    break;
+	case STORE_SHA256_OPT:
+	    store_sha256 = true;
+	    break;
+	case STATS_OPT:
+	    if (optarg != NULL && !stats_parse_format(optarg, &stats_format))
+		die(_("invalid stats value: %s"), optarg);
+	    show_stats = true;
+	    break;
+	case TRACE_OPT:
+	    trace_filename = optarg;
+	    break;
+	case STREAM_OPT:
+	    stream = true;
+	    break;
+	case COMPRESS_OPT:
+	    if (!compression_parse(optarg, &compression))
+		die(_("invalid compress value: %s"), optarg);
+	    break;
+	case PNG_SIZE_OPT:
+	    if (!parse_uint32(optarg, &png_size))
+		die(_("invalid png-size value: %s"), optarg);
+	    break;
+	case PNG_MIN_SIZE_OPT:
+	    if (!parse_uint32(optarg, &png_min_size))
+		die(_("invalid png-min-size value: %s"), optarg);
+	    break;
+	case DPI_SCALE_OPT:
+	    if (!parse_uint32(optarg, &dpi_scale) || dpi_scale == 0)
+		die(_("invalid dpi-scale value: %s"), optarg);
+	    break;
 	case ICON_OPT:
 	    icon_only = true;
 	    break;
@@ -312,45 +695,138 @@ main(int argc, char **argv)
     }
     if (icon_only && cursor_only)
 	die(_("only one of --icon and --cursor may be specified"));
+    if (show_stats && !stats_enable())
+	die(_("--stats is not supported by this build"));
+    if (trace_filename != NULL && !trace_open(trace_filename))
+	exit(1);
+
+    /* Explicit PNG options override those of the profile. */
+    png_options_set_profile(&extract_options.png, "balanced");
+    if (png_profile != NULL && !png_options_set_profile(&extract_options.png, png_profile))
+	die(_("invalid png-profile value: %s"), png_profile);
+    if (png_level != -1)
+	extract_options.png.level = png_level;
+    if (png_filter != NULL && !png_options_set_filter(&extract_options.png, png_filter))
+	die(_("invalid png-filter value: %s"), png_filter);
 
+    if (list_mode || extract_mode) {
+	if (argc-optind <= 0 && files_from == NULL)
+	    die(list_mode ? _("missing file argument") : _("missing arguments"));
+	for (c = optind ; c < argc ; c++)
+	    add_file(argv[c]);
+	if (files_from != NULL)
+	    add_files_from(files_from);
+    }
+
+    /* Listings are printed in order, so files are listed one at a time.
+     * When extracting with more than one thread, whole files are spread
+     * across the pool, and the images of each file may be split further.
+     * Output to standard out is kept in order by extracting one file at
+     * a time.
+     */
     if (list_mode) {
-	if (argc-optind <= 0)
-	    die(_("missing file argument"));
-	for (c = optind ; c < argc ; c++) {
-	    if (open_file_or_stdin(argv[c], &in, &inname)) {
-		if (!extract_icons(in, inname, true, NULL, filter))
-		    exit(1);
-		if (in != stdin)
-		    fclose(in);
-	    }
+	for (f = 0; f < file_count; f++) {
+	    Stats *old_stats = stats_set_current(&files[f].stats);
+
+	    TRACE_BEGIN_FILE("file", files[f].name);
+	    if (!process_file(files[f].name, true))
+		failed = true;
+	    TRACE_END("file");
+	    stats_set_current(old_stats);
 	}
     }
 
     if (extract_mode) {
-	if (argc-optind <= 0)
-	    die(_("missing arguments"));
+	FILE *archive_out = NULL;
 
-        for (c = optind ; c < argc ; c++) {
-            int matched;
-
-	    if (open_file_or_stdin(argv[c], &in, &inname)) {
-	        matched = extract_icons(in, inname, false, extract_outfile_gen, filter);
-	        if (matched == -1)
-	            exit(1);
-                if (matched == 0)
-                    fprintf(stderr, _("%s: no images matched\n"), inname);
-                if (in != stdin)
-                    fclose(in);
-            }
-        }
+	if (store_dir != NULL) {
+	    if (output != NULL || archive_set)
+		die(_("--store cannot be used with --output or --archive"));
+	    store = store_open(store_dir, store_sha256);
+	    if (store == NULL)
+		exit(1);
+	}
+	/* An output name ending in .tar or .cpio selects an archive. */
+	if (!archive_set && output != NULL && !is_directory(output)) {
+	    if (ends_with_nocase(output, ".tar"))
+		archive_set = archive_format_parse("tar", &archive_format);
+	    else if (ends_with_nocase(output, ".cpio"))
+		archive_set = archive_format_parse("cpio", &archive_format);
+	}
+	if (archive_set) {
+	    if (output == NULL || strcmp(output, "-") == 0) {
+		if (isatty(STDOUT_FILENO))
+		    die(_("refusing to write binary data to terminal"));
+		archive_out = stdout;
+		archive = archive_new(stdout, _("(standard out)"), archive_format);
+	    } else {
+		archive_out = fopen(output, "wb");
+		if (archive_out == NULL)
+		    die_errno(_("%s: cannot create file"), output);
+		archive = archive_new(archive_out, output, archive_format);
+	    }
+	}
+
+	if (jobs > 1)
+	    pool = threadpool_new(jobs);
+
+	/* Images are added to an archive one file at a time. */
+	if (pool != NULL && archive == NULL && (output == NULL || strcmp(output, "-") != 0)) {
+	    ThreadPoolGroup group = THREADPOOL_GROUP_INIT;
+
+	    for (f = 0; f < file_count; f++)
+		threadpool_submit(pool, &group, extract_file_task, &files[f]);
+	    threadpool_wait(pool, &group);
+	} else {
+	    for (f = 0; f < file_count; f++)
+		extract_file_task(&files[f]);
+	}
+	for (f = 0; f < file_count; f++) {
+	    if (files[f].failed)
+		failed = true;
+	}
+
+	if (pool != NULL)
+	    threadpool_free(pool);
+
+	if (archive != NULL) {
+	    if (!archive_finish(archive))
+		failed = true;
+	    if (archive_out != stdout && fclose(archive_out) != 0) {
+		warn_errno(_("%s: cannot write to file"), output);
+		failed = true;
+	    }
+	}
+	if (store != NULL && !store_close(store))
+	    failed = true;
     }
 
     if (create_mode) {
+	IcoWriterOptions options;
+
         if (argc-optind+raw_filec <= 0)
 	    die(_("missing arguments"));
-        if (!create_icon(argc-optind, argv+optind, raw_filec, raw_filev, create_outfile_gen, (icon_only ? true : !cursor_only), hotspot_x, hotspot_y, alpha_threshold, bitdepth))
-            exit(1);
+	options.cursor = (icon_only ? false : cursor_only);
+	options.hotspot_x = hotspot_x;
+	options.hotspot_y = hotspot_y;
+	options.alpha_threshold = MIN(alpha_threshold, 255);
+	options.bit_count = bitdepth;
+	options.compression = compression;
+	options.png_size = png_size;
+	options.png_min_size = png_min_size;
+	options.png_level = extract_options.png.level;
+	options.png_filters = extract_options.png.filters;
+	if (jobs > 1)
+	    pool = threadpool_new(jobs);
+        if (!create_icon(argc-optind, argv+optind, raw_filec, raw_filev, create_outfile_gen, &options, pool, stream))
+            failed = true;
+	if (pool != NULL)
+	    threadpool_free(pool);
     }
 
-    exit(0);
+    if (show_stats)
+	print_stats();
+    if (trace_filename != NULL && !trace_close())
+	failed = true;
+    exit(failed ? 1 : 0);
 }
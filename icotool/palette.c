@@ -1,4 +1,4 @@
-/* palette.c - Palette hash management for icon/cursor creation
+/* palette.c - Palette color table for icon/cursor creation
  *
  * Copyright (C) 1998 Oskar Liljeblad
  *
@@ -20,121 +20,87 @@
 #include <stdint.h>		/* Gnulib/POSIX */
 #include <stdlib.h>		/* C89 */
 #include "xalloc.h"		/* Gnulib */
-#include "icotool.h"
-#include "common/hmap.h"
-#include "common/common.h"
+#include "icoutils-internal.h"
 
-typedef struct {
-	uint8_t red;
-	uint8_t green;
-	uint8_t blue;
-	uint32_t index;
-} PaletteColor;
+/* A palette holds at most PALETTE_MAX colors, which is all a DIB can
+ * use. Colors are kept in the order they were first added, so that the
+ * same image always gives the same palette, and are found by open
+ * addressing with linear probing in a table of twice that many slots.
+ * A slot holds the color packed as 0xRRGGBB with bit 24 set, or 0 if it
+ * is empty.
+ */
+#define PALETTE_SLOT_BITS 9
+#define PALETTE_SLOTS (1 << PALETTE_SLOT_BITS)
+#define PALETTE_USED 0x1000000
 
 struct _Palette {
-	HMap *map;
-	HMapIterator it;
-	bool it_init;
+	uint32_t slots[PALETTE_SLOTS];
+	uint8_t slot_index[PALETTE_SLOTS];
+	uint32_t colors[PALETTE_MAX];
+	uint32_t count;
+	uint32_t next;
+	bool full;
 };
 
-static uint32_t
-color_hash(PaletteColor *color)
-{
-	return (color->red << 16) | (color->green << 8) | color->blue;
-}
-
-static int32_t
-color_compare(PaletteColor *c1, PaletteColor *c2)
-{
-	if (c1->red != c2->red)
-		return c1->red - c2->red;
-	if (c1->green != c2->green)
-		return c1->green - c2->green;
-	if (c1->blue != c2->blue)
-		return c1->blue - c2->blue;
-	return 0;
-}
-
 Palette *
 palette_new(void)
 {
-	Palette *palette = xmalloc(sizeof(Palette));
-	palette->map = hmap_new();
-	palette->it_init = false;
-	hmap_set_hash_fn(palette->map, (hash_fn_t) color_hash);
-	hmap_set_compare_fn(palette->map, (comparison_fn_t) color_compare);
-	return palette;
+	return xzalloc(sizeof(Palette));
 }
 
 void
 palette_free(Palette *palette)
 {
-	hmap_foreach_value(palette->map, free);
-	hmap_free(palette->map);
 	free(palette);
 }
 
-void
+/**
+ * Add a color to the palette unless it is there already, and return
+ * its index. If the palette has PALETTE_MAX colors and the color is
+ * not one of them, PALETTE_FULL is returned, and palette_count will
+ * return more than PALETTE_MAX from then on.
+ */
+uint32_t
 palette_add(Palette *palette, uint8_t r, uint8_t g, uint8_t b)
 {
-	PaletteColor color = { r, g, b, 0 };
+	uint32_t key = PALETTE_USED | r << 16 | g << 8 | b;
+	uint32_t slot = (key * UINT32_C(0x9e3779b1)) >> (32 - PALETTE_SLOT_BITS);
 
-	if (!hmap_contains_key(palette->map, &color)) {
-		PaletteColor *new_color = xmalloc(sizeof(PaletteColor));
-		new_color->red = r;
-		new_color->green = g;
-		new_color->blue = b;
-		new_color->index = 0;
-		hmap_put(palette->map, new_color, new_color);
+	while (palette->slots[slot] != 0) {
+		if (palette->slots[slot] == key)
+			return palette->slot_index[slot];
+		slot = (slot + 1) & (PALETTE_SLOTS - 1);
+	}
+	if (palette->count >= PALETTE_MAX) {
+		palette->full = true;
+		return PALETTE_FULL;
 	}
+	palette->slots[slot] = key;
+	palette->slot_index[slot] = palette->count;
+	palette->colors[palette->count] = key;
+	return palette->count++;
 }
 
+/**
+ * Get the colors of the palette in index order, one per call. Returns
+ * false, and starts over on the next call, when there are no more.
+ */
 bool
 palette_next(Palette *palette, uint8_t *r, uint8_t *g, uint8_t *b)
 {
-	if (!palette->it_init) {
-		hmap_iterator(palette->map, &palette->it);
-		palette->it_init = true;
-	}
-	if (palette->it.has_next(&palette->it)) {
-		PaletteColor *color = palette->it.next(&palette->it);
-		*r = color->red;
-		*g = color->green;
-		*b = color->blue;
+	if (palette->next < palette->count) {
+		uint32_t color = palette->colors[palette->next++];
+		*r = color >> 16;
+		*g = color >> 8;
+		*b = color;
 		return true;
 	}
-	palette->it_init = false;
+	palette->next = 0;
 	return false;
 }
 
-void
-palette_assign_indices(Palette *palette)
-{
-	HMapIterator it;
-	uint32_t c;
-
-	hmap_iterator(palette->map, &it);
-	for (c = 0; it.has_next(&it); c++) {
-		PaletteColor *color = it.next(&it);
-		color->index = c;
-	}
-}
-
-uint32_t
-palette_lookup(Palette *palette, uint8_t r, uint8_t g, uint8_t b)
-{
-	PaletteColor color = { r, g, b, 0 };
-	PaletteColor *real_color = hmap_get(palette->map, &color);
-	/* The caller doesn't handle this as an error, but simply
-	 * assigns 0xffffffff as a colour in the output.
-	 */
-	if (real_color == NULL)
-		return (uint32_t)-1;
-	return real_color->index;
-}
-
 uint32_t
 palette_count(Palette *palette)
 {
-	return hmap_size(palette->map);
+	return palette->count + palette->full;
 }
@@ -0,0 +1,771 @@
+/* reader.c - Read icon and cursor files from memory or a stream
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <errno.h>		/* C89 */
+#include <setjmp.h>		/* C89 */
+#include <stdarg.h>		/* C89 */
+#include <stdint.h>		/* POSIX/Gnulib */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <inttypes.h>
+#include "gettext.h"		/* Gnulib */
+#include "minmax.h"		/* Gnulib */
+#define _(s) gettext(s)
+#define N_(s) gettext_noop(s)
+#include "xalloc.h"		/* Gnulib */
+#include "xvasprintf.h"		/* Gnulib */
+#include "icoutils-internal.h"
+#include "win32.h"
+#include "win32-endian.h"
+
+#define ICO_PNG_MAGIC       0x474e5089
+
+#define GET_BE32(p) ((uint32_t) (p)[0] << 24 | (uint32_t) (p)[1] << 16 | (uint32_t) (p)[2] << 8 | (uint32_t) (p)[3])
+
+static bool read_png_header(IcoReader *reader, const uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t *width, uint32_t *height);
+
+/* The contents of an icon or cursor file in memory. All structures
+ * are decoded directly from this memory, through bounds-checked views.
+ *
+ * A stream is read forward only and never seeks. Only the bytes from
+ * the start of the current image onward are buffered; views of a
+ * stream stay valid until they are released or detached. Since the
+ * buffer may move when it grows, reserve_view should be called with
+ * the whole extent of an image before views into it are kept.
+ */
+typedef struct {
+	const uint8_t *memory;
+	size_t size;
+	IcoReadFunc read;
+	void *read_data;
+	uint8_t *buffer;
+	size_t alloc;
+	uint32_t base;
+	bool eof;
+	int read_errno;
+} IconFile;
+
+/* A directory entry in the order images are read. */
+typedef struct {
+	uint32_t offset;
+	uint32_t entry;
+} PlannedEntry;
+
+struct _IcoReader {
+	IconFile icf;
+	IcoMessageFunc message;
+	void *message_data;
+	Win32CursorIconFileDir dir;
+	Win32CursorIconFileDirEntry *entries;
+	PlannedEntry *plan;
+	uint32_t next;
+	uint32_t offset;
+	bool failed;
+};
+
+/**
+ * Format a message and pass it to a message callback, if there is one.
+ */
+void
+ico_report(IcoMessageFunc message, void *message_data, const char *format, ...)
+{
+	va_list args;
+	char *text;
+
+	if (message == NULL)
+		return;
+	va_start(args, format);
+	text = xvasprintf(format, args);
+	va_end(args);
+	message(message_data, text);
+	free(text);
+}
+
+#define report(reader, ...) ico_report((reader)->message, (reader)->message_data, __VA_ARGS__)
+
+/* Read from the stream until the buffer covers `size' bytes at
+ * `offset', skipping any bytes before `offset' that nothing refers to.
+ * The buffer grows with the data actually read, so a bogus size in a
+ * short stream does not allocate much.
+ */
+static bool
+fill_stream(IconFile *icf, uint32_t offset, uint32_t size)
+{
+	size_t need;
+
+	while (icf->size == 0 && offset > icf->base) {
+		uint8_t scratch[4096];
+		ssize_t count;
+
+		if (icf->eof)
+			return false;
+		count = icf->read(icf->read_data, scratch, MIN(sizeof(scratch), offset - icf->base));
+		if (count <= 0) {
+			icf->read_errno = (count < 0 ? errno : 0);
+			icf->eof = true;
+			return false;
+		}
+		icf->base += count;
+	}
+	need = (size_t) (offset - icf->base) + size;
+	while (icf->size < need) {
+		ssize_t count;
+
+		if (icf->eof)
+			return false;
+		if (icf->size == icf->alloc) {
+			icf->alloc = MIN(need, MAX(2 * icf->alloc, 65536));
+			icf->buffer = xrealloc(icf->buffer, icf->alloc);
+			icf->memory = icf->buffer;
+		}
+		count = icf->read(icf->read_data, icf->buffer + icf->size, MIN(need, icf->alloc) - icf->size);
+		if (count <= 0) {
+			icf->read_errno = (count < 0 ? errno : 0);
+			icf->eof = true;
+			return false;
+		}
+		icf->size += count;
+	}
+	return true;
+}
+
+/* Return a pointer to `size' bytes at `offset' in the file, or NULL
+ * (with a message) if the range is not within the file.
+ */
+static const void *
+get_view(IcoReader *reader, uint32_t offset, uint32_t size)
+{
+	IconFile *icf = &reader->icf;
+
+	if (icf->read != NULL) {
+		if (offset < icf->base) {
+			report(reader, _("cannot seek backwards in input stream"));
+			return NULL;
+		}
+		if (size > UINT32_MAX - offset || !fill_stream(icf, offset, size)) {
+			if (icf->read_errno != 0)
+				report(reader, "%s: %s", _("cannot read file"), strerror(icf->read_errno));
+			else
+				report(reader, _("premature end"));
+			return NULL;
+		}
+		return icf->memory + (offset - icf->base);
+	}
+	if (offset > icf->size || size > icf->size - offset) {
+		report(reader, _("premature end"));
+		return NULL;
+	}
+	return icf->memory + offset;
+}
+
+/* Read ahead `size' bytes at `offset' of a stream, so that views
+ * within that range do not move the buffer. Errors are left for
+ * get_view to report. */
+static void
+reserve_view(IconFile *icf, uint32_t offset, uint32_t size)
+{
+	if (icf->read != NULL && offset >= icf->base && size <= UINT32_MAX - offset)
+		fill_stream(icf, offset, size);
+}
+
+/* Drop all buffered stream data. Views returned so far become
+ * invalid. */
+static void
+release_views(IconFile *icf)
+{
+	if (icf->read != NULL) {
+		icf->base += icf->size;
+		icf->size = 0;
+	}
+}
+
+static int
+compare_planned_entries(const void *a, const void *b)
+{
+	const PlannedEntry *pa = a;
+	const PlannedEntry *pb = b;
+
+	if (pa->offset != pb->offset)
+		return (pa->offset < pb->offset ? -1 : 1);
+	return (pa->entry < pb->entry ? -1 : pa->entry > pb->entry);
+}
+
+static IcoReader *
+open_reader(IcoReader *reader)
+{
+	const void *dir_header;
+	const Win32CursorIconFileDirEntry *dir_entries;
+	uint32_t c;
+
+	rowconv_init();
+
+	dir_header = get_view(reader, 0, sizeof(Win32CursorIconFileDir));
+	if (dir_header == NULL)
+		goto cleanup;
+	memcpy(&reader->dir, dir_header, sizeof(Win32CursorIconFileDir));
+	fix_win32_cursor_icon_file_dir_endian(&reader->dir);
+
+	if (reader->dir.reserved != 0) {
+		report(reader, _("not an icon or cursor file (reserved non-zero)"));
+		goto cleanup;
+	}
+	if (reader->dir.type != 1 && reader->dir.type != 2) {
+		report(reader, _("not an icon or cursor file (wrong type)"));
+		goto cleanup;
+	}
+
+	dir_entries = get_view(reader, sizeof(Win32CursorIconFileDir), reader->dir.count * sizeof(Win32CursorIconFileDirEntry));
+	if (dir_entries == NULL)
+		goto cleanup;
+	reader->entries = xmalloc(reader->dir.count * sizeof(Win32CursorIconFileDirEntry));
+	memcpy(reader->entries, dir_entries, reader->dir.count * sizeof(Win32CursorIconFileDirEntry));
+	for (c = 0; c < reader->dir.count; c++) {
+		fix_win32_cursor_icon_file_dir_entry_endian(&reader->entries[c]);
+		if (reader->entries[c].reserved != 0)
+			report(reader, _("reserved is not zero"));
+	}
+	reader->offset = sizeof(Win32CursorIconFileDir) + reader->dir.count * sizeof(Win32CursorIconFileDirEntry);
+
+	/* Plan the order in which images are read: by offset, and in
+	 * directory order where images share their data. Images are
+	 * numbered in this order. */
+	reader->plan = xnmalloc(reader->dir.count, sizeof(PlannedEntry));
+	for (c = 0; c < reader->dir.count; c++) {
+		reader->plan[c].offset = reader->entries[c].dib_offset;
+		reader->plan[c].entry = c;
+	}
+	qsort(reader->plan, reader->dir.count, sizeof(PlannedEntry), compare_planned_entries);
+
+	return reader;
+
+cleanup:
+	ico_reader_close(reader);
+	return NULL;
+}
+
+/**
+ * Start reading an icon or cursor file of `size' bytes at `data'.
+ * The data is not copied, and must not change or go away until the
+ * reader and all entries returned by it are no longer used. Messages
+ * about problems in the file are passed to `message', if not NULL.
+ * Return NULL if the file is not an icon or cursor file.
+ */
+IcoReader *
+ico_reader_open(const void *data, size_t size, IcoMessageFunc message, void *message_data)
+{
+	IcoReader *reader = xzalloc(sizeof(IcoReader));
+
+	reader->icf.memory = data;
+	reader->icf.size = size;
+	reader->message = message;
+	reader->message_data = message_data;
+	return open_reader(reader);
+}
+
+/**
+ * Start reading an icon or cursor file from a stream, such as a pipe,
+ * through the `read' function. The stream is read forward only, and
+ * only the data of the current image is held in memory. Entries must
+ * be kept with ico_reader_keep to be used after the next one has been
+ * read.
+ */
+IcoReader *
+ico_reader_open_stream(IcoReadFunc read, void *read_data, IcoMessageFunc message, void *message_data)
+{
+	IcoReader *reader = xzalloc(sizeof(IcoReader));
+
+	reader->icf.read = read;
+	reader->icf.read_data = read_data;
+	reader->message = message;
+	reader->message_data = message_data;
+	return open_reader(reader);
+}
+
+/**
+ * Free a reader. Entries that have been kept remain valid, but must
+ * still be freed with ico_entry_free.
+ */
+void
+ico_reader_close(IcoReader *reader)
+{
+	if (reader->icf.read != NULL)
+		free(reader->icf.buffer);
+	free(reader->plan);
+	free(reader->entries);
+	free(reader);
+}
+
+/**
+ * Read the headers of the next image in file order into `entry'.
+ * No pixel data is decoded. The data of the entry may be used until
+ * the next call, or until the entry is freed if it is kept with
+ * ico_reader_keep.
+ *
+ * @returns
+ *   1 if an entry was read, 0 if there are no more images, or -1 if
+ *   the file is malformed. No more entries are read after an error.
+ */
+int
+ico_reader_next(IcoReader *reader, IcoEntry *entry)
+{
+	const Win32CursorIconFileDirEntry *dir_entry;
+	Win32BitmapInfoHeader bitmap;
+	const void *header;
+	uint32_t p = reader->next;
+	bool shared = false;
+
+	if (reader->failed)
+		return -1;
+	if (p >= reader->dir.count)
+		return 0;
+	reader->next++;
+
+	dir_entry = &reader->entries[reader->plan[p].entry];
+	if (p > 0 && reader->plan[p].offset == reader->plan[p-1].offset) {
+		report(reader, _("image %u shares its data with image %u"), p+1, p);
+		reader->offset = reader->plan[p].offset;
+		shared = true;
+	} else if (reader->plan[p].offset < reader->offset) {
+		if (p == 0)
+			report(reader, _("offset of bitmap header incorrect (too low)"));
+		else
+			report(reader, _("image %u at %u overlaps image %u, which ends at %u"), p+1, reader->plan[p].offset, p, reader->offset);
+		goto fail;
+	} else if (reader->plan[p].offset > reader->offset) {
+		report(reader, _("skipping %u bytes of garbage at %u"), reader->plan[p].offset - reader->offset, reader->offset);
+		reader->offset = reader->plan[p].offset;
+	}
+
+	if (!shared)
+		release_views(&reader->icf);
+	memset(entry, 0, sizeof(IcoEntry));
+	entry->index = p + 1;
+	entry->is_cursor = (reader->dir.type == 2);
+	if (entry->is_cursor) {
+		entry->hotspot_x = dir_entry->hotspot_x;
+		entry->hotspot_y = dir_entry->hotspot_y;
+	}
+	entry->message = reader->message;
+	entry->message_data = reader->message_data;
+
+	header = get_view(reader, reader->offset, sizeof(Win32BitmapInfoHeader));
+	if (header == NULL)
+		goto fail;
+	memcpy(&bitmap, header, sizeof(Win32BitmapInfoHeader));
+
+	fix_win32_bitmap_info_header_endian(&bitmap);
+	/* Vista icon: it's just a raw PNG */
+	if (bitmap.size == ICO_PNG_MAGIC)
+	{
+		uint32_t unsigned_width, unsigned_height;
+
+		entry->is_png = true;
+		entry->data_size = dir_entry->dib_size;
+		entry->data = get_view(reader, reader->offset, entry->data_size);
+		if (entry->data == NULL)
+			goto fail;
+
+		if (!read_png_header(reader, entry->data, entry->data_size, &entry->bit_count, &unsigned_width, &unsigned_height))
+			goto fail;
+
+		if (unsigned_width == 0 || unsigned_height == 0) {
+			report(reader, _("PNG has no pixels"));
+			goto fail;
+		}
+		if (unsigned_width > INT32_MAX/4 || unsigned_height > INT32_MAX/4
+		    || unsigned_height > SIZE_MAX / ((size_t) unsigned_width * 4)) {
+			report(reader, _("PNG too large"));
+			goto fail;
+		}
+		entry->width = (int32_t) unsigned_width;
+		entry->height = (int32_t) unsigned_height;
+		reader->offset += entry->data_size;
+	}
+	else
+	{
+		uint32_t palette_offset;
+		uint64_t image_size, mask_size, extent;
+
+		if (bitmap.size < sizeof(Win32BitmapInfoHeader)) {
+			report(reader, _("bitmap header is too short"));
+			goto fail;
+		}
+		if (bitmap.compression != 0) {
+			report(reader, _("compressed image data not supported"));
+			goto fail;
+		}
+		if (bitmap.x_pels_per_meter != 0)
+			report(reader, _("x_pels_per_meter field in bitmap should be zero"));
+		if (bitmap.y_pels_per_meter != 0)
+			report(reader, _("y_pels_per_meter field in bitmap should be zero"));
+		if (bitmap.clr_important != 0)
+			report(reader, _("clr_important field in bitmap should be zero"));
+		if (bitmap.planes != 1)
+			report(reader, _("planes field in bitmap should be one"));
+		if (bitmap.size != sizeof(Win32BitmapInfoHeader)) {
+			uint32_t skip = bitmap.size - sizeof(Win32BitmapInfoHeader);
+			report(reader, _("skipping %d bytes of extended bitmap header"), skip);
+		}
+		reader->offset += bitmap.size;
+		palette_offset = reader->offset;
+
+		if (bitmap.clr_used != 0 || bitmap.bit_count < 24) {
+			entry->palette_count = (bitmap.clr_used != 0 ? bitmap.clr_used : (uint32_t) (1 << bitmap.bit_count));
+			if (entry->palette_count > 256) {
+				report(reader, _("palette too large"));
+				goto fail;
+			}
+			reader->offset += sizeof(Win32RGBQuad) * entry->palette_count;
+		}
+		/* The height covers both the image and the mask. */
+		if (bitmap.width <= 0 || bitmap.height / 2 == 0) {
+			report(reader, _("bitmap has no pixels"));
+			goto fail;
+		}
+		if (bitmap.width > INT32_MAX/max(4, bitmap.bit_count)) {
+			report(reader, _("bitmap width too large"));
+			goto fail;
+		}
+		if (bitmap.height == INT32_MIN) {
+			report(reader, _("bitmap height too large"));
+			goto fail;
+		}
+
+		entry->width = bitmap.width;
+		entry->height = abs(bitmap.height)/2;
+		entry->bit_count = bitmap.bit_count;
+		entry->top_down = (bitmap.height < 0);
+
+		entry->image_stride = ROW_BYTES((uint64_t) entry->width * bitmap.bit_count);
+		entry->mask_stride = ROW_BYTES((uint64_t) entry->width);
+		image_size = (uint64_t) entry->height * entry->image_stride;
+		mask_size = (uint64_t) entry->height * entry->mask_stride;
+
+		/* Offsets are 32-bit, so a bitmap that does not end below
+		 * 4 GiB cannot be complete. */
+		extent = (uint64_t) (reader->offset - palette_offset) + image_size + mask_size;
+		if (extent > UINT32_MAX - palette_offset) {
+			report(reader, _("premature end"));
+			goto fail;
+		}
+
+		if (dir_entry->dib_size != bitmap.size + extent)
+			report(reader, _("incorrect total size of bitmap (%d specified; %d real)"),
+			    dir_entry->dib_size,
+			    (uint32_t) (bitmap.size + extent)
+			);
+
+		/* A stream must not move while views of it are held. */
+		reserve_view(&reader->icf, palette_offset, extent);
+		if (entry->palette_count != 0) {
+			entry->palette = get_view(reader, palette_offset, sizeof(Win32RGBQuad) * entry->palette_count);
+			if (entry->palette == NULL)
+				goto fail;
+		}
+
+		entry->data_size = image_size;
+		entry->data = get_view(reader, reader->offset, image_size);
+		if (entry->data == NULL)
+			goto fail;
+
+		entry->mask = get_view(reader, reader->offset + image_size, mask_size);
+		if (entry->mask == NULL)
+			goto fail;
+
+		reader->offset += image_size;
+		reader->offset += mask_size;
+	}
+	return 1;
+
+fail:
+	reader->failed = true;
+	return -1;
+}
+
+/**
+ * Keep the data of the entry last returned by ico_reader_next, so
+ * that it can still be used after the next entry has been read. This
+ * only copies anything when reading from a stream. The entry must be
+ * freed with ico_entry_free. Keeping an entry again does nothing.
+ */
+void
+ico_reader_keep(IcoReader *reader, IcoEntry *entry)
+{
+	IconFile *icf = &reader->icf;
+	uint32_t p = reader->next;
+
+	if (icf->read == NULL || entry->buffer != NULL)
+		return;
+
+	/* The next image uses the same data, so the buffer is copied
+	 * rather than handed over. */
+	if (p < reader->dir.count && reader->plan[p].offset == reader->plan[p-1].offset) {
+		entry->buffer = xmemdup(icf->memory, icf->size);
+		entry->buffer_size = icf->size;
+		entry->data = entry->buffer + (entry->data - icf->memory);
+		if (entry->mask != NULL)
+			entry->mask = entry->buffer + (entry->mask - icf->memory);
+		if (entry->palette != NULL)
+			entry->palette = entry->buffer + (entry->palette - icf->memory);
+		return;
+	}
+
+	entry->buffer = icf->buffer;
+	entry->buffer_size = icf->size;
+	icf->base += icf->size;
+	icf->buffer = NULL;
+	icf->memory = NULL;
+	icf->size = 0;
+	icf->alloc = 0;
+}
+
+/**
+ * Free the data of an entry that has been kept.
+ */
+void
+ico_entry_free(IcoEntry *entry)
+{
+	free(entry->buffer);
+	entry->buffer = NULL;
+	entry->buffer_size = 0;
+}
+
+/* Rank the bit depth of an entry for a display of `bit_count' bits
+ * per pixel: the highest depth that the display can show, then the
+ * lowest of those it cannot. */
+static uint32_t
+depth_rank(uint32_t depth, uint32_t bit_count)
+{
+	if (bit_count == 0 || depth <= bit_count)
+		return depth;
+	return UINT32_MAX - depth;
+}
+
+/**
+ * Return true if entry `a' is a better choice than `b' for showing an
+ * image of `size' pixels on a display of `bit_count' bits per pixel,
+ * or with the highest depth available if `bit_count' is 0. Like
+ * Windows, this prefers the smallest image that is at least as large
+ * as `size', or else the largest image, and among images of the same
+ * size the one with the best depth. The size of an image is its
+ * larger dimension. Where entries are equally good, the earlier one
+ * is better.
+ */
+bool
+ico_entry_better(const IcoEntry *a, const IcoEntry *b, uint32_t size, uint32_t bit_count)
+{
+	uint32_t size_a = MAX(a->width, a->height);
+	uint32_t size_b = MAX(b->width, b->height);
+
+	if (size_a != size_b) {
+		if ((size_a >= size) != (size_b >= size))
+			return size_a >= size;
+		if (size_a >= size)
+			return size_a < size_b;
+		return size_a > size_b;
+	}
+	if (depth_rank(a->bit_count, bit_count) != depth_rank(b->bit_count, bit_count))
+		return depth_rank(a->bit_count, bit_count) > depth_rank(b->bit_count, bit_count);
+	return a->index < b->index;
+}
+
+/* Decode a DIB image into top-down RGBA rows. */
+static bool
+decode_dib(const IcoEntry *entry, uint8_t *rgba, size_t stride)
+{
+	uint8_t palette_rgba[256 * 4];
+	DIBRowDecoder decode_row = dib_row_decoder(entry->bit_count);
+	uint32_t d;
+
+	if (decode_row == NULL) {
+		ico_report(entry->message, entry->message_data, _("bit depth %" PRIu32 " not supported"), entry->bit_count);
+		return false;
+	}
+	if (entry->palette != NULL)
+		dib_palette_to_rgba(palette_rgba, entry->palette, entry->palette_count);
+
+	for (d = 0; d < (uint32_t) entry->height; d++) {
+		uint8_t *row = rgba + d * stride;
+		uint32_t y = (entry->top_down ? d : entry->height - d - 1);
+		uint32_t max_index;
+
+		max_index = decode_row(row, entry->data + (size_t) y * entry->image_stride, entry->width, palette_rgba);
+		if (entry->bit_count <= 16 && max_index >= entry->palette_count) {
+			ico_report(entry->message, entry->message_data, _("color out of range in image data"));
+			return false;
+		}
+		if (entry->bit_count != 32)
+			rowconv.mask_to_alpha(row, entry->mask + (size_t) y * entry->mask_stride, entry->width);
+	}
+	return true;
+}
+
+/**
+ * Read callback for libpng that reads from a PngMemoryInput.
+ */
+void
+png_read_mem(png_structp png_ptr, png_bytep data, png_size_t size)
+{
+	PngMemoryInput *io = png_get_io_ptr(png_ptr);
+
+	if (io->size < size)
+		png_error(png_ptr, _("read error"));
+	memcpy(data, io->ptr, size);
+	io->size -= size;
+	io->ptr += size;
+}
+
+/**
+ * Error callback for libpng that passes the error to the message
+ * callback given as the error pointer (a PngMessageTarget).
+ */
+void
+png_error_message(png_structp png_ptr, png_const_charp text)
+{
+	PngMessageTarget *target = png_get_error_ptr(png_ptr);
+
+	ico_report(target->message, target->message_data, _("libpng error: %s"), text);
+	longjmp(png_jmpbuf(png_ptr), 1);
+}
+
+/**
+ * Warning callback for libpng, like png_error_message.
+ */
+void
+png_warning_message(png_structp png_ptr, png_const_charp text)
+{
+	PngMessageTarget *target = png_get_error_ptr(png_ptr);
+
+	ico_report(target->message, target->message_data, _("libpng warning: %s"), text);
+}
+
+/* Decode a Vista PNG image into 8-bit RGBA rows. */
+static bool
+decode_png(const IcoEntry *entry, uint8_t *rgba, size_t stride)
+{
+	PngMessageTarget target = { entry->message, entry->message_data };
+	png_structp png_ptr;
+	png_infop info_ptr;
+	PngMemoryInput png_in;
+	png_bytep *volatile rows = NULL;
+	uint32_t d;
+
+	png_ptr = png_create_read_struct(PNG_LIBPNG_VER_STRING, &target, png_error_message, png_warning_message);
+	if (png_ptr == NULL) {
+		ico_report(entry->message, entry->message_data, _("cannot initialize PNG library"));
+		return false;
+	}
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		ico_report(entry->message, entry->message_data, _("cannot create PNG info structure - out of memory"));
+		png_destroy_read_struct(&png_ptr, NULL, NULL);
+		return false;
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+		free(rows);
+		return false;
+	}
+
+	png_in.ptr = entry->data;
+	png_in.size = entry->data_size;
+	png_set_read_fn(png_ptr, &png_in, png_read_mem);
+	png_read_info(png_ptr, info_ptr);
+
+	png_set_expand(png_ptr);
+	png_set_strip_16(png_ptr);
+	png_set_gray_to_rgb(png_ptr);
+	png_set_add_alpha(png_ptr, 0xFF, PNG_FILLER_AFTER);
+	png_set_interlace_handling(png_ptr);
+	png_read_update_info(png_ptr, info_ptr);
+
+	/* The size was taken from the same IHDR chunk, so this is just
+	 * a safeguard for the caller's buffer. */
+	if (png_get_image_width(png_ptr, info_ptr) != (uint32_t) entry->width
+			|| png_get_image_height(png_ptr, info_ptr) != (uint32_t) entry->height)
+		png_error(png_ptr, _("image size changed"));
+
+	rows = xnmalloc(entry->height, sizeof(png_bytep));
+	for (d = 0; d < (uint32_t) entry->height; d++)
+		rows[d] = rgba + d * stride;
+	png_read_image(png_ptr, rows);
+	png_read_end(png_ptr, NULL);
+
+	png_destroy_read_struct(&png_ptr, &info_ptr, NULL);
+	free(rows);
+	return true;
+}
+
+/**
+ * Decode the pixels of an entry into `rgba', which must have room for
+ * `height' rows of `stride' bytes. Rows are stored top-down, with four
+ * bytes (red, green, blue, alpha) per pixel. This may be called from
+ * any thread for entries that are still valid.
+ */
+bool
+ico_entry_decode(const IcoEntry *entry, uint8_t *rgba, size_t stride)
+{
+	if (entry->is_png)
+		return decode_png(entry, rgba, stride);
+	return decode_dib(entry, rgba, stride);
+}
+
+/* Get the dimensions and bit depth of an embedded PNG image from its
+ * IHDR chunk, which the PNG specification requires to come first.
+ * The bit depth is reported per pixel, or per index for palette images.
+ */
+static bool
+read_png_header(IcoReader *reader, const uint8_t *image_data, uint32_t image_size, uint32_t *bit_count, uint32_t *width, uint32_t *height)
+{
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	const uint8_t *ihdr = image_data + sizeof(signature);
+	uint8_t channels;
+
+	if (image_size < sizeof(signature) + 8 + 13 + 4
+			|| memcmp(image_data, signature, sizeof(signature)) != 0
+			|| memcmp(ihdr + 4, "IHDR", 4) != 0
+			|| GET_BE32(ihdr) != 13) {
+		report(reader, _("invalid PNG header"));
+		return false;
+	}
+
+	*width = GET_BE32(ihdr + 8);
+	*height = GET_BE32(ihdr + 12);
+	switch (ihdr[17]) {
+	case 0: /* gray */
+	case 3: /* palette */
+		channels = 1;
+		break;
+	case 2: /* RGB */
+		channels = 3;
+		break;
+	case 4: /* gray + alpha */
+		channels = 2;
+		break;
+	case 6: /* RGB + alpha */
+		channels = 4;
+		break;
+	default:
+		report(reader, _("invalid PNG header"));
+		return false;
+	}
+	*bit_count = ihdr[16] * channels;
+
+	return true;
+}
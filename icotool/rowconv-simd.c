@@ -0,0 +1,465 @@
+/* rowconv-simd.c - SIMD variants of the pixel row conversion kernels
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* Gnulib/POSIX */
+#include "icoutils-internal.h"
+#if CPU_X86_SIMD
+# include <immintrin.h>
+#endif
+#if CPU_ARM_NEON
+# include <arm_neon.h>
+#endif
+
+/* Every kernel processes as many whole vectors as it can without
+ * reading or writing outside of the row, and hands the remaining
+ * pixels to the scalar reference implementation in rowconv.c.
+ */
+
+#if CPU_X86_SIMD
+
+#define SSE2	__attribute__ ((target("sse2")))
+#define SSSE3	__attribute__ ((target("ssse3")))
+#define AVX2	__attribute__ ((target("avx2")))
+
+static inline uint8_t
+reverse_bits(uint8_t b)
+{
+	b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+	b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+	b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+	return b;
+}
+
+SSE2 void
+swap_rb_sse2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m128i ga = _mm_set1_epi32(0xFF00FF00);
+	const __m128i lo = _mm_set1_epi32(0x000000FF);
+	uint32_t x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		__m128i r = _mm_slli_epi32(_mm_and_si128(v, lo), 16);
+		__m128i b = _mm_and_si128(_mm_srli_epi32(v, 16), lo);
+		v = _mm_or_si128(_mm_and_si128(v, ga), _mm_or_si128(r, b));
+		_mm_storeu_si128((__m128i *) (dst + 4*x), v);
+	}
+	swap_rb_scalar(dst + 4*x, src + 4*x, width - x);
+}
+
+SSE2 void
+mask_to_alpha_sse2(uint8_t *row, const uint8_t *mask, uint32_t width)
+{
+	/* Alpha for four pixels, indexed by four mask bits (MSB first). */
+	static const uint32_t nibble_alpha[16][4] __attribute__ ((aligned (16))) = {
+#define A(b) ((b) ? 0 : 0xFF000000)
+#define N(n) { A(n & 8), A(n & 4), A(n & 2), A(n & 1) }
+		N(0), N(1), N(2), N(3), N(4), N(5), N(6), N(7),
+		N(8), N(9), N(10), N(11), N(12), N(13), N(14), N(15)
+#undef N
+#undef A
+	};
+	const __m128i rgb = _mm_set1_epi32(0x00FFFFFF);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		uint8_t m = *mask++;
+		__m128i v0 = _mm_loadu_si128((const __m128i *) (row + 4*x));
+		__m128i v1 = _mm_loadu_si128((const __m128i *) (row + 4*x + 16));
+		v0 = _mm_or_si128(_mm_and_si128(v0, rgb), _mm_load_si128((const __m128i *) nibble_alpha[m >> 4]));
+		v1 = _mm_or_si128(_mm_and_si128(v1, rgb), _mm_load_si128((const __m128i *) nibble_alpha[m & 15]));
+		_mm_storeu_si128((__m128i *) (row + 4*x), v0);
+		_mm_storeu_si128((__m128i *) (row + 4*x + 16), v1);
+	}
+	mask_to_alpha_scalar(row + 4*x, mask, width - x);
+}
+
+SSE2 void
+alpha_to_mask_sse2(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold)
+{
+	const __m128i t = _mm_set1_epi8((char) threshold);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		__m128i a0 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *) (row + 4*x)), 24);
+		__m128i a1 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *) (row + 4*x + 16)), 24);
+		__m128i a2 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *) (row + 4*x + 32)), 24);
+		__m128i a3 = _mm_srli_epi32(_mm_loadu_si128((const __m128i *) (row + 4*x + 48)), 24);
+		__m128i a = _mm_packus_epi16(_mm_packs_epi32(a0, a1), _mm_packs_epi32(a2, a3));
+		/* a <= t exactly when min(a, t) == a */
+		__m128i le = _mm_cmpeq_epi8(_mm_min_epu8(a, t), a);
+		uint32_t bits = _mm_movemask_epi8(le);
+		*mask++ = reverse_bits(bits & 0xFF);
+		*mask++ = reverse_bits(bits >> 8);
+	}
+	alpha_to_mask_scalar(mask, row + 4*x, width - x, threshold);
+}
+
+/* Fold the least and greatest bytes of `lo' and `hi' into *min_alpha
+ * and *max_alpha. */
+static void
+merge_alpha_range(const uint8_t *lo, const uint8_t *hi, uint32_t size, uint8_t *min_alpha, uint8_t *max_alpha)
+{
+	uint32_t c;
+
+	for (c = 0; c < size; c++) {
+		if (lo[c] < *min_alpha)
+			*min_alpha = lo[c];
+		if (hi[c] > *max_alpha)
+			*max_alpha = hi[c];
+	}
+}
+
+SSE2 uint32_t
+scan_alpha_sse2(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha)
+{
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	const __m128i ones = _mm_set1_epi32(-1);
+	const __m128i zero = _mm_setzero_si128();
+	__m128i any_zero = zero;
+	__m128i any_full = zero;
+	__m128i lo = ones;
+	__m128i hi = zero;
+	uint8_t lo_bytes[16], hi_bytes[16];
+	uint32_t flags;
+	uint32_t x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (row + 4*x));
+		__m128i a = _mm_and_si128(v, alpha);
+		__m128i z = _mm_cmpeq_epi32(a, zero);
+		__m128i f = _mm_cmpeq_epi32(a, alpha);
+		/* The alpha byte of pixels neither transparent nor opaque. */
+		__m128i o = _mm_andnot_si128(_mm_or_si128(z, f), alpha);
+		__m128i p = _mm_and_si128(a, o);
+
+		hi = _mm_max_epu8(hi, p);
+		lo = _mm_min_epu8(lo, _mm_or_si128(p, _mm_andnot_si128(o, ones)));
+		any_full = _mm_or_si128(any_full, f);
+		if (_mm_movemask_epi8(z) != 0) {
+			any_zero = _mm_or_si128(any_zero, z);
+			_mm_storeu_si128((__m128i *) (row + 4*x), _mm_andnot_si128(z, v));
+		}
+	}
+	_mm_storeu_si128((__m128i *) lo_bytes, lo);
+	_mm_storeu_si128((__m128i *) hi_bytes, hi);
+	merge_alpha_range(lo_bytes, hi_bytes, 16, min_alpha, max_alpha);
+	flags = (_mm_movemask_epi8(any_zero) != 0 ? ALPHA_ZERO : 0)
+		| (_mm_movemask_epi8(any_full) != 0 ? ALPHA_FULL : 0);
+	return flags | scan_alpha_scalar(row + 4*x, width - x, min_alpha, max_alpha);
+}
+
+SSSE3 void
+bgr_to_rgba_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m128i alpha = _mm_set1_epi32(0xFF000000);
+	uint32_t x;
+
+	/* Each load reads 16 bytes for 12 bytes of pixels. */
+	for (x = 0; x + 6 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 3*x));
+		v = _mm_or_si128(_mm_shuffle_epi8(v, shuf), alpha);
+		_mm_storeu_si128((__m128i *) (dst + 4*x), v);
+	}
+	bgr_to_rgba_scalar(dst + 4*x, src + 3*x, width - x);
+}
+
+SSSE3 void
+swap_rb_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	uint32_t x;
+
+	for (x = 0; x + 4 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		_mm_storeu_si128((__m128i *) (dst + 4*x), _mm_shuffle_epi8(v, shuf));
+	}
+	swap_rb_scalar(dst + 4*x, src + 4*x, width - x);
+}
+
+SSSE3 void
+rgba_to_bgr_ssse3(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m128i shuf = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	uint32_t x;
+
+	/* Each store writes 16 bytes for 12 bytes of pixels; the excess
+	 * is overwritten by the following pixels. */
+	for (x = 0; x + 6 <= width; x += 4) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + 4*x));
+		_mm_storeu_si128((__m128i *) (dst + 3*x), _mm_shuffle_epi8(v, shuf));
+	}
+	rgba_to_bgr_scalar(dst + 3*x, src + 4*x, width - x);
+}
+
+AVX2 void
+bgr_to_rgba_avx2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1,
+		2, 1, 0, -1, 5, 4, 3, -1, 8, 7, 6, -1, 11, 10, 9, -1);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	uint32_t x;
+
+	for (x = 0; x + 10 <= width; x += 8) {
+		__m128i lo = _mm_loadu_si128((const __m128i *) (src + 3*x));
+		__m128i hi = _mm_loadu_si128((const __m128i *) (src + 3*x + 12));
+		__m256i v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+		v = _mm256_or_si256(_mm256_shuffle_epi8(v, shuf), alpha);
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), v);
+	}
+	bgr_to_rgba_ssse3(dst + 4*x, src + 3*x, width - x);
+}
+
+AVX2 void
+swap_rb_avx2(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	const __m256i shuf = _mm256_setr_epi8(
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15,
+		2, 1, 0, 3, 6, 5, 4, 7, 10, 9, 8, 11, 14, 13, 12, 15);
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (src + 4*x));
+		_mm256_storeu_si256((__m256i *) (dst + 4*x), _mm256_shuffle_epi8(v, shuf));
+	}
+	swap_rb_scalar(dst + 4*x, src + 4*x, width - x);
+}
+
+AVX2 void
+mask_to_alpha_avx2(uint8_t *row, const uint8_t *mask, uint32_t width)
+{
+	const __m256i bit = _mm256_setr_epi32(0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01);
+	const __m256i rgb = _mm256_set1_epi32(0x00FFFFFF);
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	const __m256i zero = _mm256_setzero_si256();
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i m = _mm256_and_si256(_mm256_set1_epi32(*mask++), bit);
+		__m256i opaque = _mm256_and_si256(_mm256_cmpeq_epi32(m, zero), alpha);
+		__m256i v = _mm256_loadu_si256((const __m256i *) (row + 4*x));
+		v = _mm256_or_si256(_mm256_and_si256(v, rgb), opaque);
+		_mm256_storeu_si256((__m256i *) (row + 4*x), v);
+	}
+	mask_to_alpha_scalar(row + 4*x, mask, width - x);
+}
+
+AVX2 void
+alpha_to_mask_avx2(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold)
+{
+	/* Packing works within each 128-bit lane, which leaves groups of
+	 * four pixels out of order. */
+	const __m256i order = _mm256_setr_epi32(0, 4, 1, 5, 2, 6, 3, 7);
+	const __m256i t = _mm256_set1_epi8((char) threshold);
+	uint32_t x;
+
+	for (x = 0; x + 32 <= width; x += 32) {
+		__m256i a0 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *) (row + 4*x)), 24);
+		__m256i a1 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *) (row + 4*x + 32)), 24);
+		__m256i a2 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *) (row + 4*x + 64)), 24);
+		__m256i a3 = _mm256_srli_epi32(_mm256_loadu_si256((const __m256i *) (row + 4*x + 96)), 24);
+		__m256i a = _mm256_packus_epi16(_mm256_packs_epi32(a0, a1), _mm256_packs_epi32(a2, a3));
+		__m256i le;
+		uint32_t bits;
+
+		a = _mm256_permutevar8x32_epi32(a, order);
+		le = _mm256_cmpeq_epi8(_mm256_min_epu8(a, t), a);
+		bits = _mm256_movemask_epi8(le);
+		*mask++ = reverse_bits(bits & 0xFF);
+		*mask++ = reverse_bits(bits >> 8);
+		*mask++ = reverse_bits(bits >> 16);
+		*mask++ = reverse_bits(bits >> 24);
+	}
+	alpha_to_mask_sse2(mask, row + 4*x, width - x, threshold);
+}
+
+AVX2 uint32_t
+scan_alpha_avx2(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha)
+{
+	const __m256i alpha = _mm256_set1_epi32(0xFF000000);
+	const __m256i ones = _mm256_set1_epi32(-1);
+	const __m256i zero = _mm256_setzero_si256();
+	__m256i any_zero = zero;
+	__m256i any_full = zero;
+	__m256i lo = ones;
+	__m256i hi = zero;
+	uint8_t lo_bytes[32], hi_bytes[32];
+	uint32_t flags;
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		__m256i v = _mm256_loadu_si256((const __m256i *) (row + 4*x));
+		__m256i a = _mm256_and_si256(v, alpha);
+		__m256i z = _mm256_cmpeq_epi32(a, zero);
+		__m256i f = _mm256_cmpeq_epi32(a, alpha);
+		__m256i o = _mm256_andnot_si256(_mm256_or_si256(z, f), alpha);
+		__m256i p = _mm256_and_si256(a, o);
+
+		hi = _mm256_max_epu8(hi, p);
+		lo = _mm256_min_epu8(lo, _mm256_or_si256(p, _mm256_andnot_si256(o, ones)));
+		any_full = _mm256_or_si256(any_full, f);
+		if (_mm256_movemask_epi8(z) != 0) {
+			any_zero = _mm256_or_si256(any_zero, z);
+			_mm256_storeu_si256((__m256i *) (row + 4*x), _mm256_andnot_si256(z, v));
+		}
+	}
+	_mm256_storeu_si256((__m256i *) lo_bytes, lo);
+	_mm256_storeu_si256((__m256i *) hi_bytes, hi);
+	merge_alpha_range(lo_bytes, hi_bytes, 32, min_alpha, max_alpha);
+	flags = (_mm256_movemask_epi8(any_zero) != 0 ? ALPHA_ZERO : 0)
+		| (_mm256_movemask_epi8(any_full) != 0 ? ALPHA_FULL : 0);
+	return flags | scan_alpha_scalar(row + 4*x, width - x, min_alpha, max_alpha);
+}
+
+#endif /* CPU_X86_SIMD */
+
+#if CPU_ARM_NEON
+
+static const uint8_t neon_bit_weights[16] = {
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01,
+	0x80, 0x40, 0x20, 0x10, 0x08, 0x04, 0x02, 0x01
+};
+
+void
+bgr_to_rgba_neon(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x3_t p = vld3q_u8(src + 3*x);
+		uint8x16x4_t q;
+		q.val[0] = p.val[2];
+		q.val[1] = p.val[1];
+		q.val[2] = p.val[0];
+		q.val[3] = vdupq_n_u8(0xFF);
+		vst4q_u8(dst + 4*x, q);
+	}
+	bgr_to_rgba_scalar(dst + 4*x, src + 3*x, width - x);
+}
+
+void
+swap_rb_neon(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(src + 4*x);
+		uint8x16_t r = p.val[0];
+		p.val[0] = p.val[2];
+		p.val[2] = r;
+		vst4q_u8(dst + 4*x, p);
+	}
+	swap_rb_scalar(dst + 4*x, src + 4*x, width - x);
+}
+
+void
+rgba_to_bgr_neon(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(src + 4*x);
+		uint8x16x3_t q;
+		q.val[0] = p.val[2];
+		q.val[1] = p.val[1];
+		q.val[2] = p.val[0];
+		vst3q_u8(dst + 3*x, q);
+	}
+	rgba_to_bgr_scalar(dst + 3*x, src + 4*x, width - x);
+}
+
+void
+mask_to_alpha_neon(uint8_t *row, const uint8_t *mask, uint32_t width)
+{
+	const uint8x16_t weights = vld1q_u8(neon_bit_weights);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16_t m = vcombine_u8(vdup_n_u8(mask[0]), vdup_n_u8(mask[1]));
+		uint8x16x4_t p = vld4q_u8(row + 4*x);
+		p.val[3] = vmvnq_u8(vtstq_u8(m, weights));
+		vst4q_u8(row + 4*x, p);
+		mask += 2;
+	}
+	mask_to_alpha_scalar(row + 4*x, mask, width - x);
+}
+
+void
+alpha_to_mask_neon(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold)
+{
+	const uint8x16_t weights = vld1q_u8(neon_bit_weights);
+	const uint8x16_t t = vdupq_n_u8(threshold);
+	uint32_t x;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(row + 4*x);
+		uint8x16_t bits = vandq_u8(vcleq_u8(p.val[3], t), weights);
+		/* Sum the weights of each group of eight pixels. */
+		uint8x8_t s = vpadd_u8(vget_low_u8(bits), vget_high_u8(bits));
+		s = vpadd_u8(s, s);
+		s = vpadd_u8(s, s);
+		*mask++ = vget_lane_u8(s, 0);
+		*mask++ = vget_lane_u8(s, 1);
+	}
+	alpha_to_mask_scalar(mask, row + 4*x, width - x, threshold);
+}
+
+uint32_t
+scan_alpha_neon(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha)
+{
+	uint8x16_t any_zero = vdupq_n_u8(0);
+	uint8x16_t any_full = vdupq_n_u8(0);
+	uint8x16_t lo = vdupq_n_u8(0xFF);
+	uint8x16_t hi = vdupq_n_u8(0);
+	uint8_t lo_bytes[16], hi_bytes[16], zero_bytes[16], full_bytes[16];
+	uint32_t flags = 0;
+	uint32_t x, c;
+
+	for (x = 0; x + 16 <= width; x += 16) {
+		uint8x16x4_t p = vld4q_u8(row + 4*x);
+		uint8x16_t z = vceqq_u8(p.val[3], vdupq_n_u8(0));
+		uint8x16_t f = vceqq_u8(p.val[3], vdupq_n_u8(0xFF));
+		uint8x16_t o = vmvnq_u8(vorrq_u8(z, f));
+
+		hi = vmaxq_u8(hi, vandq_u8(p.val[3], o));
+		lo = vminq_u8(lo, vornq_u8(p.val[3], o));
+		any_zero = vorrq_u8(any_zero, z);
+		any_full = vorrq_u8(any_full, f);
+		p.val[0] = vbicq_u8(p.val[0], z);
+		p.val[1] = vbicq_u8(p.val[1], z);
+		p.val[2] = vbicq_u8(p.val[2], z);
+		vst4q_u8(row + 4*x, p);
+	}
+	vst1q_u8(lo_bytes, lo);
+	vst1q_u8(hi_bytes, hi);
+	vst1q_u8(zero_bytes, any_zero);
+	vst1q_u8(full_bytes, any_full);
+	for (c = 0; c < 16; c++) {
+		if (lo_bytes[c] < *min_alpha)
+			*min_alpha = lo_bytes[c];
+		if (hi_bytes[c] > *max_alpha)
+			*max_alpha = hi_bytes[c];
+		flags |= (zero_bytes[c] != 0 ? ALPHA_ZERO : 0) | (full_bytes[c] != 0 ? ALPHA_FULL : 0);
+	}
+	return flags | scan_alpha_scalar(row + 4*x, width - x, min_alpha, max_alpha);
+}
+
+#endif /* CPU_ARM_NEON */
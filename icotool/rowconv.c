@@ -0,0 +1,393 @@
+/* rowconv.c - Conversion of pixel rows between DIB and RGBA
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdint.h>		/* Gnulib/POSIX */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#if HAVE_PTHREAD
+#include <pthread.h>		/* POSIX */
+#endif
+#include "minmax.h"		/* Gnulib */
+#include "common/cpu.h"
+#include "icoutils-internal.h"
+
+/* Expanded palette entries are stored as four bytes (red, green,
+ * blue, alpha) so that a pixel can be copied with a single 32-bit
+ * move. The alpha byte is filled in from the mask afterwards.
+ */
+#define PUT_INDEXED(row, x, palette, index) \
+	memcpy((row) + 4*(x), (palette) + 4*(index), 4)
+
+/* Each byte of a 1-bit AND mask expands to eight alpha values:
+ * set bits are transparent (0), clear bits are opaque (0xFF).
+ */
+static uint8_t mask_alpha_table[256][8];
+
+/* Byte-order swizzles and mask conversions, set up by rowconv_init. */
+RowConvOps rowconv;
+
+static uint32_t
+decode_row_1(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	uint32_t x, max_index = 0;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		uint8_t b = *src++;
+		PUT_INDEXED(row, x+0, palette, (b >> 7) & 1);
+		PUT_INDEXED(row, x+1, palette, (b >> 6) & 1);
+		PUT_INDEXED(row, x+2, palette, (b >> 5) & 1);
+		PUT_INDEXED(row, x+3, palette, (b >> 4) & 1);
+		PUT_INDEXED(row, x+4, palette, (b >> 3) & 1);
+		PUT_INDEXED(row, x+5, palette, (b >> 2) & 1);
+		PUT_INDEXED(row, x+6, palette, (b >> 1) & 1);
+		PUT_INDEXED(row, x+7, palette, (b >> 0) & 1);
+		max_index |= b;
+	}
+	if (x < width) {
+		uint8_t b = *src;
+		for (; x < width; x++, b <<= 1) {
+			PUT_INDEXED(row, x, palette, b >> 7);
+			max_index |= b >> 7;
+		}
+	}
+	return max_index != 0;
+}
+
+static uint32_t
+decode_row_2(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	uint32_t x, max_index = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = (src[x/4] >> ((3 - x%4) << 1)) & 3;
+		PUT_INDEXED(row, x, palette, index);
+		max_index = MAX(max_index, index);
+	}
+	return max_index;
+}
+
+static uint32_t
+decode_row_4(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	uint32_t x, max_index = 0;
+
+	for (x = 0; x + 2 <= width; x += 2) {
+		uint32_t hi = *src >> 4;
+		uint32_t lo = *src++ & 15;
+		PUT_INDEXED(row, x+0, palette, hi);
+		PUT_INDEXED(row, x+1, palette, lo);
+		max_index = MAX(max_index, MAX(hi, lo));
+	}
+	if (x < width) {
+		uint32_t hi = *src >> 4;
+		PUT_INDEXED(row, x, palette, hi);
+		max_index = MAX(max_index, hi);
+	}
+	return max_index;
+}
+
+static uint32_t
+decode_row_8(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	uint32_t x, max_index = 0;
+
+	for (x = 0; x < width; x++) {
+		PUT_INDEXED(row, x, palette, src[x]);
+		max_index = MAX(max_index, src[x]);
+	}
+	return max_index;
+}
+
+/* 16-bit images are treated as indexed with a 16-bit index, like
+ * before. Since the palette never has more than 256 entries, indices
+ * outside of it are reported before they are used.
+ */
+static uint32_t
+decode_row_16(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	uint32_t x, max_index = 0;
+
+	for (x = 0; x < width; x++) {
+		uint32_t index = src[2*x] | src[2*x+1] << 8;
+		if (index > 0xFF)
+			return index;
+		PUT_INDEXED(row, x, palette, index);
+		max_index = MAX(max_index, index);
+	}
+	return max_index;
+}
+
+static uint32_t
+decode_row_24(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	rowconv.bgr_to_rgba(row, src, width);
+	return 0;
+}
+
+static uint32_t
+decode_row_32(uint8_t *row, const uint8_t *src, uint32_t width, const uint8_t *palette)
+{
+	rowconv.swap_rb(row, src, width);
+	return 0;
+}
+
+/**
+ * Return the row decoder for DIB data with the specified number
+ * of bits per pixel, or NULL if the bit depth is not supported.
+ *
+ * A decoder converts one row of `width' pixels from `src' into
+ * RGBA in `row'. Indexed decoders look colors up in `palette', as
+ * expanded by dib_palette_to_rgba, and return the largest palette
+ * index encountered so the caller can validate the row. Decoders
+ * for images without an alpha channel leave the alpha bytes to
+ * rowconv.mask_to_alpha.
+ */
+DIBRowDecoder
+dib_row_decoder(uint32_t bit_count)
+{
+	switch (bit_count) {
+	case 1:
+		return decode_row_1;
+	case 2:
+		return decode_row_2;
+	case 4:
+		return decode_row_4;
+	case 8:
+		return decode_row_8;
+	case 16:
+		return decode_row_16;
+	case 24:
+		return decode_row_24;
+	case 32:
+		return decode_row_32;
+	}
+	return NULL;
+}
+
+/**
+ * Expand `count' Win32RGBQuad palette entries into the 256-entry
+ * RGBA table used by the indexed row decoders. Unused entries are
+ * cleared.
+ */
+void
+dib_palette_to_rgba(uint8_t *rgba, const uint8_t *quads, uint32_t count)
+{
+	uint32_t c;
+
+	memset(rgba, 0, 256 * 4);
+	for (c = 0; c < count && c < 256; c++) {
+		rgba[4*c+0] = quads[4*c+2];
+		rgba[4*c+1] = quads[4*c+1];
+		rgba[4*c+2] = quads[4*c+0];
+		rgba[4*c+3] = 0xFF;
+	}
+}
+
+/* The scalar kernels below are the reference implementations
+ * which the SIMD variants in rowconv-simd.c must match exactly.
+ */
+
+void
+bgr_to_rgba_scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[4*x+0] = src[3*x+2];
+		dst[4*x+1] = src[3*x+1];
+		dst[4*x+2] = src[3*x+0];
+		dst[4*x+3] = 0xFF;
+	}
+}
+
+void
+swap_rb_scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		uint8_t r = src[4*x+0];
+		dst[4*x+0] = src[4*x+2];
+		dst[4*x+1] = src[4*x+1];
+		dst[4*x+2] = r;
+		dst[4*x+3] = src[4*x+3];
+	}
+}
+
+void
+rgba_to_bgr_scalar(uint8_t *dst, const uint8_t *src, uint32_t width)
+{
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		dst[3*x+0] = src[4*x+2];
+		dst[3*x+1] = src[4*x+1];
+		dst[3*x+2] = src[4*x+0];
+	}
+}
+
+void
+mask_to_alpha_scalar(uint8_t *row, const uint8_t *mask, uint32_t width)
+{
+	uint32_t x, c;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		const uint8_t *alpha = mask_alpha_table[*mask++];
+		row[4*(x+0)+3] = alpha[0];
+		row[4*(x+1)+3] = alpha[1];
+		row[4*(x+2)+3] = alpha[2];
+		row[4*(x+3)+3] = alpha[3];
+		row[4*(x+4)+3] = alpha[4];
+		row[4*(x+5)+3] = alpha[5];
+		row[4*(x+6)+3] = alpha[6];
+		row[4*(x+7)+3] = alpha[7];
+	}
+	for (c = 0; x < width; x++, c++)
+		row[4*x+3] = mask_alpha_table[*mask][c];
+}
+
+void
+alpha_to_mask_scalar(uint8_t *mask, const uint8_t *row, uint32_t width, uint8_t threshold)
+{
+	uint32_t x;
+
+	for (x = 0; x + 8 <= width; x += 8) {
+		uint8_t bits = 0;
+		bits |= (row[4*(x+0)+3] <= threshold ? 1 << 7 : 0);
+		bits |= (row[4*(x+1)+3] <= threshold ? 1 << 6 : 0);
+		bits |= (row[4*(x+2)+3] <= threshold ? 1 << 5 : 0);
+		bits |= (row[4*(x+3)+3] <= threshold ? 1 << 4 : 0);
+		bits |= (row[4*(x+4)+3] <= threshold ? 1 << 3 : 0);
+		bits |= (row[4*(x+5)+3] <= threshold ? 1 << 2 : 0);
+		bits |= (row[4*(x+6)+3] <= threshold ? 1 << 1 : 0);
+		bits |= (row[4*(x+7)+3] <= threshold ? 1 << 0 : 0);
+		*mask++ = bits;
+	}
+	if (x < width) {
+		uint8_t bits = 0;
+		uint32_t c;
+		for (c = 0; x < width; x++, c++)
+			bits |= (row[4*x+3] <= threshold ? 0x80 >> c : 0);
+		*mask = bits;
+	}
+}
+
+/* Set the color of fully transparent pixels of an RGBA row to black.
+ * Return ALPHA_ZERO and ALPHA_FULL if there are fully transparent and
+ * fully opaque pixels, and lower *min_alpha and raise *max_alpha to
+ * take in the alpha of every other pixel.
+ */
+uint32_t
+scan_alpha_scalar(uint8_t *row, uint32_t width, uint8_t *min_alpha, uint8_t *max_alpha)
+{
+	uint32_t flags = 0;
+	uint32_t x;
+
+	for (x = 0; x < width; x++) {
+		uint8_t a = row[4*x+3];
+
+		if (a == 0) {
+			row[4*x+0] = row[4*x+1] = row[4*x+2] = 0;
+			flags |= ALPHA_ZERO;
+		} else if (a == 0xFF) {
+			flags |= ALPHA_FULL;
+		} else {
+			if (a < *min_alpha)
+				*min_alpha = a;
+			if (a > *max_alpha)
+				*max_alpha = a;
+		}
+	}
+	return flags;
+}
+
+static void
+rowconv_setup(void)
+{
+#if CPU_X86_SIMD || CPU_ARM_NEON
+	uint32_t features = cpu_features();
+#endif
+	uint32_t c, x;
+
+	for (c = 0; c < 256; c++) {
+		for (x = 0; x < 8; x++)
+			mask_alpha_table[c][x] = (c & (0x80 >> x) ? 0 : 0xFF);
+	}
+
+	rowconv.bgr_to_rgba = bgr_to_rgba_scalar;
+	rowconv.swap_rb = swap_rb_scalar;
+	rowconv.rgba_to_bgr = rgba_to_bgr_scalar;
+	rowconv.mask_to_alpha = mask_to_alpha_scalar;
+	rowconv.alpha_to_mask = alpha_to_mask_scalar;
+	rowconv.scan_alpha = scan_alpha_scalar;
+
+#if CPU_X86_SIMD
+	if (features & CPU_FEATURE_SSE2) {
+		rowconv.swap_rb = swap_rb_sse2;
+		rowconv.mask_to_alpha = mask_to_alpha_sse2;
+		rowconv.alpha_to_mask = alpha_to_mask_sse2;
+		rowconv.scan_alpha = scan_alpha_sse2;
+	}
+	if (features & CPU_FEATURE_SSSE3) {
+		rowconv.bgr_to_rgba = bgr_to_rgba_ssse3;
+		rowconv.swap_rb = swap_rb_ssse3;
+		rowconv.rgba_to_bgr = rgba_to_bgr_ssse3;
+	}
+	if (features & CPU_FEATURE_AVX2) {
+		rowconv.bgr_to_rgba = bgr_to_rgba_avx2;
+		rowconv.swap_rb = swap_rb_avx2;
+		rowconv.mask_to_alpha = mask_to_alpha_avx2;
+		rowconv.alpha_to_mask = alpha_to_mask_avx2;
+		rowconv.scan_alpha = scan_alpha_avx2;
+	}
+#endif
+#if CPU_ARM_NEON
+	if (features & CPU_FEATURE_NEON) {
+		rowconv.bgr_to_rgba = bgr_to_rgba_neon;
+		rowconv.swap_rb = swap_rb_neon;
+		rowconv.rgba_to_bgr = rgba_to_bgr_neon;
+		rowconv.mask_to_alpha = mask_to_alpha_neon;
+		rowconv.alpha_to_mask = alpha_to_mask_neon;
+		rowconv.scan_alpha = scan_alpha_neon;
+	}
+#endif
+}
+
+/**
+ * Initialize the lookup tables and select the fastest variant of
+ * each row conversion kernel supported by the processor. This must
+ * be called before any of the row conversion functions are used.
+ * It may be called any number of times, from any thread.
+ */
+void
+rowconv_init(void)
+{
+#if HAVE_PTHREAD
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+
+	pthread_once(&once, rowconv_setup);
+#else
+	static bool initialized = false;
+
+	if (!initialized) {
+		rowconv_setup();
+		initialized = true;
+	}
+#endif
+}
@@ -0,0 +1,827 @@
+/* writer.c - Write icon and cursor files to memory
+ *
+ * Copyright (C) 1998 Oskar Liljeblad
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <setjmp.h>		/* C89 */
+#include <stdint.h>		/* Gnulib/POSIX */
+#include <stdbool.h>		/* Gnulib/POSIX */
+#include <stdlib.h>		/* C89 */
+#include <string.h>		/* C89 */
+#include <zlib.h>		/* zlib */
+#include "gettext.h"		/* Gnulib */
+#include "xalloc.h"		/* Gnulib */
+#include "minmax.h"		/* Gnulib */
+#define _(s) gettext(s)
+#define N_(s) gettext_noop(s)
+#include "icoutils-internal.h"
+#include "win32.h"
+#include "win32-endian.h"
+
+#define report(writer, ...) ico_report((writer)->message, (writer)->message_data, __VA_ARGS__)
+
+/* An image added to a writer. RGBA images are encoded as soon as they
+ * are added, from a copy of their RGBA pixels and the palette index of
+ * each pixel if the image has no more than PALETTE_MAX colors; only
+ * the encoded image, a DIB or PNG, is kept until the file is written.
+ * PNG images keep the PNG data. An image that has been reserved but
+ * not set has no data.
+ */
+typedef struct {
+	uint32_t width;
+	uint32_t height;
+	uint32_t bit_count;
+	uint32_t palette_count;
+	uint32_t image_size;
+	uint32_t mask_size;
+	uint8_t *pixels;
+	uint8_t *indices;
+	Palette *palette;
+	uint8_t *data;
+	size_t size;
+} WriterImage;
+
+struct _IcoWriter {
+	IcoWriterOptions options;
+	IcoMessageFunc message;
+	void *message_data;
+	WriterImage *images;
+	size_t image_count;
+	size_t image_alloc;
+};
+
+/* How an RGBA image is stored, given its dimensions. */
+typedef enum {
+	STORE_DIB,
+	STORE_PNG,
+	STORE_SMALLER,
+} StoreChoice;
+
+/* Where PNG images are encoded to. Encoding is given up, without a
+ * message, as soon as the image would be larger than `limit' bytes. */
+typedef struct {
+	IcoBuffer *out;
+	size_t size;
+	size_t limit;
+	PngMessageTarget *target;
+} PngMemoryOutput;
+
+static void simple_setvec(uint8_t *data, uint32_t ofs, uint8_t size, uint32_t value);
+static void write_dib(const IcoWriter *writer, WriterImage *img, IcoBuffer *out);
+static size_t write_png(const IcoWriter *writer, WriterImage *img, size_t limit, IcoBuffer *out);
+
+/* Make room for `size' more bytes at the end of `out', and return
+ * where they start. The bytes are not initialized. */
+static uint8_t *
+extend_buffer(IcoBuffer *out, size_t size)
+{
+	uint8_t *data;
+
+	if (out->alloc - out->size < size) {
+		out->alloc = MAX(out->size + size, 2 * out->alloc);
+		out->data = xrealloc(out->data, out->alloc);
+	}
+	data = out->data + out->size;
+	out->size += size;
+	return data;
+}
+
+static void
+append_buffer(IcoBuffer *out, const void *data, size_t size)
+{
+	memcpy(extend_buffer(out, size), data, size);
+}
+
+/**
+ * Create a writer for an icon or cursor file. Images are added with
+ * ico_writer_add_rgba and ico_writer_add_png, in the order they are to
+ * appear in the file, or reserved with ico_writer_reserve and then set
+ * in any order. The file is produced by ico_writer_finish. Messages
+ * about the images are passed to `message', if not NULL.
+ */
+IcoWriter *
+ico_writer_new(const IcoWriterOptions *options, IcoMessageFunc message, void *message_data)
+{
+	IcoWriter *writer = xzalloc(sizeof(IcoWriter));
+
+	rowconv_init();
+	writer->options = *options;
+	writer->message = message;
+	writer->message_data = message_data;
+	return writer;
+}
+
+/**
+ * Free a writer and the images added to it.
+ */
+void
+ico_writer_free(IcoWriter *writer)
+{
+	size_t c;
+
+	for (c = 0; c < writer->image_count; c++)
+		free(writer->images[c].data);
+	free(writer->images);
+	free(writer);
+}
+
+/**
+ * Reserve room for `count' more images at the end of the file, and
+ * return the index of the first. The images are then given with
+ * ico_writer_set_rgba or ico_writer_set_png, or planned with
+ * ico_writer_plan_rgba or ico_writer_plan_png. Unlike other functions
+ * of a writer, these may be called for different images from different
+ * threads at the same time, until the next image is added or reserved.
+ * Every image must have been set before ico_writer_finish is called,
+ * or planned before ico_writer_start is called.
+ */
+size_t
+ico_writer_reserve(IcoWriter *writer, size_t count)
+{
+	size_t index = writer->image_count;
+
+	if (writer->image_alloc - writer->image_count < count) {
+		writer->image_alloc = MAX(writer->image_count + count, 2 * writer->image_alloc);
+		writer->images = xnrealloc(writer->images, writer->image_alloc, sizeof(WriterImage));
+	}
+	memset(writer->images + index, 0, count * sizeof(WriterImage));
+	writer->image_count += count;
+	return index;
+}
+
+/**
+ * Add an image to be stored as a DIB or as PNG, as the compression
+ * option says, given as `height' top-down rows of `stride' bytes with
+ * four bytes (red, green, blue, alpha) per pixel. The number of bits
+ * per pixel of a DIB is the least that keeps all colors and
+ * transparency, unless overridden by the bit_count option. PNG images
+ * are always stored with 32 bits per pixel. Images with no pixels, or
+ * too large to be stored as a DIB, are rejected.
+ */
+bool
+ico_writer_add_rgba(IcoWriter *writer, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride)
+{
+	return ico_writer_set_rgba(writer, ico_writer_reserve(writer, 1), width, height, rgba, stride);
+}
+
+/* Check that an RGBA image has pixels, and that it is small enough
+ * for the 32-bit size fields of a DIB even at 32 bits per pixel. This
+ * also keeps offsets into its pixels and DIB data within 32 bits.
+ */
+static bool
+check_rgba_size(const IcoWriter *writer, uint32_t width, uint32_t height)
+{
+	uint64_t size;
+
+	if (width == 0 || height == 0) {
+		report(writer, _("image has no pixels"));
+		return false;
+	}
+	size = sizeof(Win32BitmapInfoHeader) + 256 * sizeof(Win32RGBQuad)
+			+ (uint64_t) height * (ROW_BYTES((uint64_t) width * 32) + ROW_BYTES((uint64_t) width));
+	if (width > INT32_MAX/32 || height > INT32_MAX/2 || size > UINT32_MAX) {
+		report(writer, _("image too large"));
+		return false;
+	}
+	return true;
+}
+
+/* Find the number of bits per pixel and the palette of an RGBA image,
+ * and the sizes of its pixels and mask as a DIB. This keeps a copy of
+ * the pixels, to be freed with free_analysis. Messages are reported
+ * unless `quiet' is set.
+ */
+static void
+analyze_rgba(const IcoWriter *writer, WriterImage *img, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride, bool quiet)
+{
+	int32_t bit_count = writer->options.bit_count;
+	uint32_t alpha_flags = 0;
+	uint8_t min_alpha = 0xFF;
+	uint8_t max_alpha = 0;
+	bool need_transparency;
+	uint32_t last_color = 0;
+	uint32_t last_index = PALETTE_FULL;
+	uint32_t d, x;
+
+	img->width = width;
+	img->height = height;
+	img->pixels = xnmalloc(height, (size_t) width * 4);
+	for (d = 0; d < height; d++)
+		memcpy(img->pixels + (size_t) d * width * 4, rgba + d * stride, (size_t) width * 4);
+	img->palette = palette_new();
+	img->indices = xnmalloc(height, width);
+
+	/* Find the steps of transparency and count number of necessary colors
+	 * in palette, a row at a time. Once there are too many colors for a
+	 * palette, only transparency is looked at.
+	 *
+	 * Set color of fully transparent pixels to black.
+	 * On Windows Mobile, and possibly on regular Windows OSes as well,
+	 * it seems that Windows does not completely ignore RGB-values of
+	 * entirely transparent pixels as expected.
+	 */
+	for (d = 0; d < img->height; d++) {
+		uint8_t *row = img->pixels + (size_t) d * width * 4;
+		uint8_t *indices = (img->indices != NULL ? img->indices + (size_t) d * width : NULL);
+
+		alpha_flags |= rowconv.scan_alpha(row, width, &min_alpha, &max_alpha);
+		for (x = 0; indices != NULL && x < img->width; x++) {
+			uint32_t color;
+
+			color = row[4*x+0] << 16 | row[4*x+1] << 8 | row[4*x+2];
+			if (color != last_color || last_index == PALETTE_FULL) {
+			    last_color = color;
+			    last_index = palette_add(img->palette, row[4*x+0], row[4*x+1], row[4*x+2]);
+			    if (last_index == PALETTE_FULL) {
+				free(img->indices);
+				img->indices = indices = NULL;
+				break;
+			    }
+			}
+			indices[x] = last_index;
+		}
+	}
+	/* If there are more than two steps of transparency, or if the
+	 * two steps are NOT either entirely off (0) and entirely on (255),
+	 * then we will lose transparency information if bit_count is not 32.
+	 * That is, if there is a step between 0 and 255 (min_alpha <= max_alpha)
+	 * and any other step.
+	 */
+	need_transparency =
+	    min_alpha <= max_alpha
+	    &&
+	    (min_alpha != max_alpha || alpha_flags != 0);
+
+	/* Can we keep all colors in a palette? */
+	if (need_transparency) {
+		if (bit_count != -1) {
+		    if (bit_count != 32 && !quiet)
+			report(writer, _("decreasing bit depth will discard variable transparency"));
+		    /* Why 24 and not bit_count? Otherwise we might decrease below what's possible
+			   * due to number of colors in image. The real decrease happens below. */
+		    img->bit_count = 24;
+		} else {
+		    img->bit_count = 32;
+		}
+		img->palette_count = 0;
+	}
+	else if (palette_count(img->palette) <= PALETTE_MAX) {
+		for (d = 1; palette_count(img->palette) > (uint32_t)(1 << d); d <<= 1);
+		if (d == 2)	/* four colors (two bits) are not supported */
+			d = 4;
+		img->bit_count = d;
+		img->palette_count = 1 << d;
+	}
+	else {
+		img->bit_count = 24;
+		img->palette_count = 0;
+	}
+
+	/* Does the user want to change number of bits per pixel? */
+	if (bit_count != -1) {
+		if (img->bit_count == (uint32_t) bit_count) {
+			/* No operation */
+		} else if (img->bit_count < (uint32_t) bit_count) {
+			img->bit_count = bit_count;
+			img->palette_count = (bit_count > 16 ? 0 : 1 << bit_count);
+		} else if (!quiet) {
+			report(writer, _("cannot decrease bit depth from %d to %d, bit depth not changed"), img->bit_count, bit_count);
+		}
+	}
+
+	img->image_size = img->height * ROW_BYTES(img->width * img->bit_count);
+	img->mask_size = img->height * ROW_BYTES(img->width);
+	img->size = sizeof(Win32BitmapInfoHeader)
+			+ (img->bit_count <= 16 ? (1 << img->bit_count) * sizeof(Win32RGBQuad) : 0)
+			+ img->image_size
+			+ img->mask_size;
+}
+
+static void
+free_analysis(WriterImage *img)
+{
+	free(img->pixels);
+	free(img->indices);
+	palette_free(img->palette);
+	img->pixels = img->indices = NULL;
+	img->palette = NULL;
+}
+
+static StoreChoice
+choose_storage(const IcoWriter *writer, uint32_t width, uint32_t height)
+{
+	uint32_t size = MAX(width, height);
+
+	switch (writer->options.compression) {
+	case ICO_COMPRESSION_PNG:
+		return STORE_PNG;
+	case ICO_COMPRESSION_AUTO:
+		if (size < writer->options.png_min_size)
+			return STORE_DIB;
+		if (size >= writer->options.png_size)
+			return STORE_PNG;
+		return STORE_SMALLER;
+	default:
+		return STORE_DIB;
+	}
+}
+
+/* Append an analyzed image to `out' as a DIB or as PNG, and set the
+ * depth and size of the image to those of the encoding used. The size
+ * of the DIB is known from the analysis, so when the smaller encoding
+ * is to be used, the DIB is only made if the PNG image turns out no
+ * smaller. Return false if the image could not be encoded.
+ */
+static bool
+encode_rgba(const IcoWriter *writer, WriterImage *img, StoreChoice choice, IcoBuffer *out)
+{
+	size_t size;
+
+	if (choice == STORE_PNG) {
+		size = write_png(writer, img, SIZE_MAX, out);
+		if (size == 0)
+			return false;
+	} else if (choice == STORE_SMALLER) {
+		size = write_png(writer, img, img->size - 1, out);
+	} else {
+		size = 0;
+	}
+	if (size != 0) {
+		img->bit_count = 32;
+		img->size = size;
+	} else {
+		write_dib(writer, img, out);
+	}
+	return true;
+}
+
+/**
+ * Like ico_writer_add_rgba, but give the image reserved at `index'.
+ * The image is encoded before this returns.
+ */
+bool
+ico_writer_set_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride)
+{
+	WriterImage *img = &writer->images[index];
+	StoreChoice choice = choose_storage(writer, width, height);
+	IcoBuffer data = { NULL, 0, 0 };
+	bool success;
+
+	if (!check_rgba_size(writer, width, height))
+		return false;
+	analyze_rgba(writer, img, width, height, rgba, stride, choice == STORE_PNG);
+	success = encode_rgba(writer, img, choice, &data);
+	free_analysis(img);
+	if (!success) {
+		free(data.data);
+		return false;
+	}
+	img->data = data.data;
+	return true;
+}
+
+/**
+ * Find the size that the image reserved at `index' will have, like
+ * ico_writer_set_rgba, but keep nothing else. Images that may be
+ * stored as PNG are encoded to find their size. This is the first step
+ * of writing a file without keeping all images in memory: once every
+ * image has been planned, ico_writer_start appends the directory, and
+ * the images are given again, in order, to ico_writer_write_rgba and
+ * ico_writer_write_png.
+ */
+bool
+ico_writer_plan_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride)
+{
+	WriterImage *img = &writer->images[index];
+	StoreChoice choice = choose_storage(writer, width, height);
+	IcoBuffer data = { NULL, 0, 0 };
+	bool success = true;
+
+	if (!check_rgba_size(writer, width, height))
+		return false;
+	analyze_rgba(writer, img, width, height, rgba, stride, choice == STORE_PNG);
+	if (choice != STORE_DIB)
+		success = encode_rgba(writer, img, choice, &data);
+	free_analysis(img);
+	free(data.data);
+	return success;
+}
+
+/**
+ * Append the image planned at `index' to `out'. The image must be the
+ * same one that was planned; if its size turns out to be different,
+ * false is returned and nothing is appended.
+ */
+bool
+ico_writer_write_rgba(IcoWriter *writer, size_t index, uint32_t width, uint32_t height, const uint8_t *rgba, size_t stride, IcoBuffer *out)
+{
+	WriterImage *img = &writer->images[index];
+	WriterImage current;
+	size_t start = out->size;
+	bool success;
+
+	if (!check_rgba_size(writer, width, height))
+		return false;
+	memset(&current, 0, sizeof(WriterImage));
+	analyze_rgba(writer, &current, width, height, rgba, stride, true);
+	success = encode_rgba(writer, &current, choose_storage(writer, width, height), out);
+	free_analysis(&current);
+	if (!success)
+		return false;
+	if (current.width != img->width || current.height != img->height
+			|| current.bit_count != img->bit_count || current.size != img->size) {
+		report(writer, _("image has changed since it was planned"));
+		out->size = start;
+		return false;
+	}
+	return true;
+}
+
+/**
+ * Add a PNG image to be stored as it is (a "Vista icon"). The data
+ * is copied. Return false if it is not a PNG image.
+ */
+bool
+ico_writer_add_png(IcoWriter *writer, const void *data, size_t size)
+{
+	return ico_writer_set_png(writer, ico_writer_reserve(writer, 1), data, size);
+}
+
+static uint32_t
+get_be32(const uint8_t *p)
+{
+	return (uint32_t) p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+}
+
+/* Find the dimensions and depth of a PNG image from its IHDR chunk,
+ * which must come first, without decoding anything. The checks are
+ * those libpng makes of the header. Only the first ICO_PNG_HEADER_SIZE
+ * bytes of `data' are read.
+ */
+static bool
+read_png_header(const IcoWriter *writer, WriterImage *img, const void *data, size_t size)
+{
+	const uint8_t *header = data;
+	uint32_t width, height;
+	uint8_t depth, color_type;
+	bool valid_depth;
+
+	if (size < 8 || png_sig_cmp((png_bytep) data, 0, 8)) {
+		report(writer, _("not a png file"));
+		return false;
+	}
+	if (size < ICO_PNG_HEADER_SIZE || get_be32(header + 8) != 13 || memcmp(header + 12, "IHDR", 4) != 0
+			|| get_be32(header + 29) != (uint32_t) crc32(crc32(0, NULL, 0), header + 12, 17)) {
+		report(writer, _("invalid PNG header"));
+		return false;
+	}
+
+	width = get_be32(header + 16);
+	height = get_be32(header + 20);
+	depth = header[24];
+	color_type = header[25];
+	switch (color_type) {
+	case PNG_COLOR_TYPE_GRAY:
+		valid_depth = (depth == 1 || depth == 2 || depth == 4 || depth == 8 || depth == 16);
+		break;
+	case PNG_COLOR_TYPE_PALETTE:
+		valid_depth = (depth == 1 || depth == 2 || depth == 4 || depth == 8);
+		break;
+	case PNG_COLOR_TYPE_RGB:
+	case PNG_COLOR_TYPE_GRAY_ALPHA:
+	case PNG_COLOR_TYPE_RGB_ALPHA:
+		valid_depth = (depth == 8 || depth == 16);
+		break;
+	default:
+		valid_depth = false;
+		break;
+	}
+	if (width == 0 || width > PNG_UINT_31_MAX || height == 0 || height > PNG_UINT_31_MAX
+			|| !valid_depth || header[26] != PNG_COMPRESSION_TYPE_BASE
+			|| header[27] != PNG_FILTER_TYPE_BASE || header[28] > PNG_INTERLACE_ADAM7) {
+		report(writer, _("invalid PNG header"));
+		return false;
+	}
+
+	/* The depth in the directory entry is that of the image as
+	 * converted to RGBA, which is what readers do with it. */
+	img->width = width;
+	img->height = height;
+	img->bit_count = 32;
+	img->size = size;
+	return true;
+}
+
+/**
+ * Like ico_writer_add_png, but give the image reserved at `index'.
+ */
+bool
+ico_writer_set_png(IcoWriter *writer, size_t index, const void *data, size_t size)
+{
+	WriterImage *img = &writer->images[index];
+
+	if (!read_png_header(writer, img, data, size))
+		return false;
+	img->data = xmemdup(data, size);
+	return true;
+}
+
+/**
+ * Like ico_writer_plan_rgba, for a PNG image of `size' bytes to be
+ * stored as it is. Only the header of the image is read, so `data'
+ * need hold no more than the first ICO_PNG_HEADER_SIZE bytes.
+ */
+bool
+ico_writer_plan_png(IcoWriter *writer, size_t index, const void *data, size_t size)
+{
+	return read_png_header(writer, &writer->images[index], data, size);
+}
+
+/**
+ * Like ico_writer_write_rgba, for a PNG image planned with
+ * ico_writer_plan_png. If `out' is NULL, the image is only checked
+ * against the plan, as by ico_writer_plan_png, and the caller is to
+ * write its `size' bytes itself.
+ */
+bool
+ico_writer_write_png(IcoWriter *writer, size_t index, const void *data, size_t size, IcoBuffer *out)
+{
+	WriterImage *img = &writer->images[index];
+	WriterImage current;
+
+	memset(&current, 0, sizeof(WriterImage));
+	if (!read_png_header(writer, &current, data, size))
+		return false;
+	if (current.width != img->width || current.height != img->height
+			|| current.bit_count != img->bit_count || current.size != img->size) {
+		report(writer, _("image has changed since it was planned"));
+		return false;
+	}
+	if (out != NULL)
+		append_buffer(out, data, size);
+	return true;
+}
+
+static void
+write_dib(const IcoWriter *writer, WriterImage *img, IcoBuffer *out)
+{
+	Win32BitmapInfoHeader bitmap;
+	uint8_t *image_data;
+	uint8_t *mask_data;
+	uint32_t image_stride;
+	uint32_t mask_stride;
+	uint32_t d, x;
+
+	bitmap.size = sizeof(Win32BitmapInfoHeader);
+	bitmap.width = img->width;
+	bitmap.height = img->height * 2;
+	bitmap.planes = 1;							// appears to be 1 always (XXX)
+	bitmap.bit_count = img->bit_count;
+	bitmap.compression = 0;
+	bitmap.x_pels_per_meter = 0;				// should be 0 always
+	bitmap.y_pels_per_meter = 0;				// should be 0 always
+	bitmap.clr_important = 0;					// should be 0 always
+	bitmap.clr_used = img->palette_count;
+	bitmap.size_image = img->image_size;		// appears to be ok here (may be image_size+mask_size or 0, XXX)
+
+	fix_win32_bitmap_info_header_endian(&bitmap);
+	append_buffer(out, &bitmap, sizeof(Win32BitmapInfoHeader));
+
+	if (img->bit_count <= 16) {
+		Win32RGBQuad color;
+
+		color.reserved = 0;
+		while (palette_next(img->palette, &color.red, &color.green, &color.blue))
+			append_buffer(out, &color, sizeof(Win32RGBQuad));
+
+		/* Pad with empty colors. The reason we do this is because we
+		 * specify bitmap.clr_used as a base of 2. The latter is probably
+		 * not necessary according to the original specs, but many
+		 * programs that read icons assume it. Especially gdk-pixbuf.
+		 */
+		d = (1 << img->bit_count) - palette_count(img->palette);
+		memset(extend_buffer(out, d * sizeof(Win32RGBQuad)), 0, d * sizeof(Win32RGBQuad));
+	}
+
+	/* The pixels and the mask are made in the same pass over the image,
+	 * directly into the output buffer. */
+	image_data = extend_buffer(out, img->image_size + img->mask_size);
+	mask_data = image_data + img->image_size;
+	memset(image_data, 0, img->image_size + img->mask_size);
+	image_stride = img->image_size/img->height;
+	mask_stride = img->mask_size/img->height;
+	for (d = 0; d < img->height; d++) {
+		uint8_t *row = img->pixels + (size_t) (img->height - d - 1) * img->width * 4;
+		uint8_t *image_row = image_data + (size_t) d * image_stride;
+
+		if (img->bit_count == 8) {
+			memcpy(image_row, img->indices + (size_t) (img->height - d - 1) * img->width, img->width);
+		} else if (img->bit_count < 24) {
+			uint8_t *indices = img->indices + (size_t) (img->height - d - 1) * img->width;
+			for (x = 0; x < img->width; x++)
+				simple_setvec(image_row, x, img->bit_count, indices[x]);
+		} else if (img->bit_count == 24) {
+			rowconv.rgba_to_bgr(image_row, row, img->width);
+		} else if (img->bit_count == 32) {
+			rowconv.swap_rb(image_row, row, img->width);
+		}
+		rowconv.alpha_to_mask(mask_data + (size_t) d * mask_stride, row, img->width, writer->options.alpha_threshold);
+	}
+}
+
+static void
+png_write_mem(png_structp png_ptr, png_bytep data, png_size_t size)
+{
+	PngMemoryOutput *io = png_get_io_ptr(png_ptr);
+
+	if (size > io->limit - io->size) {
+		io->target->message = NULL;
+		png_error(png_ptr, "image too large");
+	}
+	append_buffer(io->out, data, size);
+	io->size += size;
+}
+
+static void
+png_flush_mem(png_structp png_ptr)
+{
+}
+
+/* Append an analyzed image to `out' as a PNG image with 8-bit RGBA
+ * pixels. Return the size of the PNG image, or zero with nothing
+ * appended if it could not be made or would be larger than `limit'.
+ */
+static size_t
+write_png(const IcoWriter *writer, WriterImage *img, size_t limit, IcoBuffer *out)
+{
+	PngMessageTarget target = { writer->message, writer->message_data };
+	PngMemoryOutput io = { out, 0, limit, &target };
+	size_t start = out->size;
+	png_structp png_ptr;
+	png_infop info_ptr;
+	uint32_t d;
+
+	png_ptr = png_create_write_struct(PNG_LIBPNG_VER_STRING, &target, png_error_message, png_warning_message);
+	if (png_ptr == NULL) {
+		report(writer, _("cannot initialize PNG library"));
+		return 0;
+	}
+	info_ptr = png_create_info_struct(png_ptr);
+	if (info_ptr == NULL) {
+		report(writer, _("cannot create PNG info structure - out of memory"));
+		png_destroy_write_struct(&png_ptr, NULL);
+		return 0;
+	}
+	if (setjmp(png_jmpbuf(png_ptr))) {
+		png_destroy_write_struct(&png_ptr, &info_ptr);
+		out->size = start;
+		return 0;
+	}
+
+	png_set_write_fn(png_ptr, &io, png_write_mem, png_flush_mem);
+	if (writer->options.png_level >= 0)
+		png_set_compression_level(png_ptr, writer->options.png_level);
+	if (writer->options.png_filters >= 0)
+		png_set_filter(png_ptr, PNG_FILTER_TYPE_BASE, writer->options.png_filters);
+	png_set_IHDR(png_ptr, info_ptr, img->width, img->height, 8,
+			PNG_COLOR_TYPE_RGB_ALPHA,
+			PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT,
+			PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png_ptr, info_ptr);
+	for (d = 0; d < img->height; d++)
+		png_write_row(png_ptr, img->pixels + (size_t) d * img->width * 4);
+	png_write_end(png_ptr, info_ptr);
+	png_destroy_write_struct(&png_ptr, &info_ptr);
+	return io.size;
+}
+
+/**
+ * Append the icon or cursor file with all images added so far to
+ * `out'.
+ */
+void
+ico_writer_finish(IcoWriter *writer, IcoBuffer *out)
+{
+	size_t c;
+
+	ico_writer_start(writer, out);
+	for (c = 0; c < writer->image_count; c++)
+		ico_writer_write_image(writer, c, out);
+}
+
+/**
+ * Append the image set at `index' to `out'. This is what
+ * ico_writer_finish does for every image after the directory; doing
+ * it one image at a time lets images that have been set be mixed with
+ * planned images written by other means.
+ */
+void
+ico_writer_write_image(IcoWriter *writer, size_t index, IcoBuffer *out)
+{
+	append_buffer(out, writer->images[index].data, writer->images[index].size);
+}
+
+/**
+ * Append the header and directory of the icon or cursor file to `out',
+ * for images that have been set or planned. The file is completed by
+ * appending each image in order: planned images with
+ * ico_writer_write_rgba or ico_writer_write_png, and images that have
+ * been set with ico_writer_write_image.
+ */
+void
+ico_writer_start(IcoWriter *writer, IcoBuffer *out)
+{
+	Win32CursorIconFileDir dir;
+	uint32_t dib_start;
+	size_t c;
+
+	dir.reserved = 0;
+	dir.type = (writer->options.cursor ? 2 : 1);
+	dir.count = writer->image_count;
+	fix_win32_cursor_icon_file_dir_endian(&dir);
+	append_buffer(out, &dir, sizeof(Win32CursorIconFileDir));
+
+	dib_start = sizeof(Win32CursorIconFileDir) + writer->image_count * sizeof(Win32CursorIconFileDirEntry);
+	for (c = 0; c < writer->image_count; c++) {
+		WriterImage *img = &writer->images[c];
+		Win32CursorIconFileDirEntry entry;
+
+		/* If one of the dimensions is larger or equal to 256, both icon dimensions have
+		   to be stored as 0 in the entry. */
+		if ((img->width >= 256) || (img->height >= 256))
+		{
+			entry.width = 0;
+			entry.height = 0;
+		}
+		else
+		{
+			entry.width = img->width;
+			entry.height = img->height;
+		}
+		entry.reserved = 0;
+		if (!writer->options.cursor) {
+			entry.hotspot_x = 1;	            /* color planes for icons */
+			entry.hotspot_y = img->bit_count; /* bit_count for icons */
+		} else {
+			entry.hotspot_x = writer->options.hotspot_x;
+			entry.hotspot_y = writer->options.hotspot_y;
+		}
+		entry.dib_offset = dib_start;
+		entry.color_count = (img->bit_count >= 8 ? 0 : 1 << img->bit_count);
+		entry.dib_size = img->size;
+
+		dib_start += entry.dib_size;
+
+		fix_win32_cursor_icon_file_dir_entry_endian(&entry);
+		append_buffer(out, &entry, sizeof(Win32CursorIconFileDirEntry));
+	}
+}
+
+static void
+simple_setvec(uint8_t *data, uint32_t ofs, uint8_t size, uint32_t value)
+{
+	switch (size) {
+	case 1:
+		data[ofs/8] |= (value & 1) << (7 - ofs%8);
+		break;
+	case 2:
+		data[ofs/4] |= (value & 3) << ((3 - ofs%4) << 1);
+		break;
+	case 4:
+		data[ofs/2] |= (value & 15) << ((1 - ofs%2) << 2);
+		break;
+	case 8:
+		data[ofs] = value;
+		break;
+	case 16:
+		data[2*ofs] = value;
+		data[2*ofs+1] = (value >> 8);
+		break;
+	case 24:
+		data[3*ofs] = value;
+		data[3*ofs+1] = (value >> 8);
+		data[3*ofs+2] = (value >> 16);
+		break;
+	case 32:
+		data[4*ofs] = value;
+		data[4*ofs+1] = (value >> 8);
+		data[4*ofs+2] = (value >> 16);
+		data[4*ofs+3] = (value >> 24);
+		break;
+	}
+}
@@ -27,10 +27,10 @@
 
 
 # Specification in the form of a command-line invocation:
-#   gnulib-tool --import --dir=. --lib=libgnu --source-base=lib --m4-base=m4 --doc-base=. --tests-base=test --aux-dir=build-aux --no-conditional-dependencies --no-libtool --macro-prefix=gl byteswap configmake dirname dup2 getline getopt-gnu gettext gettimeofday lstat malloc-gnu memchr minmax progname stdbool stdint strcase strdup-posix strerror strndup strstr vasprintf version-etc xalloc xalloc-die xvasprintf
+#   gnulib-tool --import --dir=. --local-dir=gl --lib=libgnu --source-base=lib --m4-base=m4 --doc-base=. --tests-base=test --aux-dir=build-aux --no-conditional-dependencies --no-libtool --macro-prefix=gl byteswap configmake dirname dup2 getline getopt-gnu gettext gettimeofday lstat malloc-gnu memchr minmax progname stdbool stdint strcase strdup-posix strerror strndup strstr vasprintf version-etc xalloc xalloc-die xvasprintf
 
 # Specification in the form of a few gnulib-tool.m4 macro invocations:
-gl_LOCAL_DIR([])
+gl_LOCAL_DIR([gl])
 gl_MODULES([
   byteswap
   configmake
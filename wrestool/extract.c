@@ -21,6 +21,7 @@
 #define _(s) gettext(s)
 #define N_(s) gettext_noop(s)
 #include "xalloc.h"			/* Gnulib */
+#include "xvasprintf.h"			/* Gnulib */
 #include "common/error.h"
 #include "common/intutil.h"
 #include "win32.h"
@@ -40,14 +41,38 @@ extract_resources_callback (WinLibrary *fi, WinResource *wr,
 	bool free_it;
 	void *memory;
 	const char *outname;
-	FILE *out;
+	FILE *out = NULL;
 
+	STATS_BEGIN(STATS_DECODE);
 	memory = extract_resource(fi, wr, &size, &free_it, type_wr->id, (lang_wr == NULL ? NULL : lang_wr->id), arg_raw);
+	STATS_END(STATS_DECODE);
 	free_it = false;
 	if (memory == NULL) {
 		/* extract resource has printed error */
 		return;
 	}
+	STATS_ADD(STATS_ENTRIES, 1);
+	STATS_BEGIN(STATS_WRITE);
+	TRACE_BEGIN("write");
+
+	/* add to the store, which keeps a single copy of equal resources */
+	if (arg_store != NULL) {
+		const char *type = type_wr->id;
+		const char *name = name_wr->id;
+		const char *lang = (lang_wr == NULL ? NULL : lang_wr->id);
+		char key[STORE_KEY_LENGTH + 1];
+		char *fields;
+
+		STRIP_RES_ID_FORMAT(type);
+		STRIP_RES_ID_FORMAT(name);
+		STRIP_RES_ID_FORMAT(lang);
+		store_key(memory, size, 0, key);
+		fields = xasprintf("%s\t%s\t%s\t%s", fi->name, type, name,
+				(lang == NULL ? "-" : lang));
+		store_add(arg_store, key, get_extract_extension(type_wr->id), memory, size, fields);
+		free(fields);
+		goto cleanup;
+	}
 
 	/* determine where to extract to */
 	outname = get_destination_name(fi, type_wr->id, name_wr->id, (lang_wr == NULL ? NULL : lang_wr->id));
@@ -62,13 +87,16 @@ extract_resources_callback (WinLibrary *fi, WinResource *wr,
 	}
 
 	/* write the actual data */
-	fwrite(memory, size, 1, out);
+	if (fwrite(memory, size, 1, out) == 1)
+		STATS_ADD(STATS_BYTES_WRITTEN, size);
 	
 	cleanup:
 	if (free_it)
 		free(memory);
 	if (out != NULL && out != stdout)
 		fclose(out);
+	TRACE_END("write");
+	STATS_END(STATS_WRITE);
 }
 
 /* extract_resource:
@@ -95,13 +123,14 @@ extract_resource (WinLibrary *fi, WinResource *wr, size_t *size,
 			*free_it = true;
 			return extract_bitmap_resource(fi, wr, size);
 		}
-		if (intval == (int) RT_GROUP_ICON) {
-			*free_it = true;
-			return extract_group_icon_cursor_resource(fi, wr, lang, size, true);
-		}
-		if (intval == (int) RT_GROUP_CURSOR) {
+		if (intval == (int) RT_GROUP_ICON || intval == (int) RT_GROUP_CURSOR) {
+			void *memory;
+
 			*free_it = true;
-			return extract_group_icon_cursor_resource(fi, wr, lang, size, false);
+			TRACE_BEGIN("extract_group_icon_cursor_resource");
+			memory = extract_group_icon_cursor_resource(fi, wr, lang, size, intval == (int) RT_GROUP_ICON);
+			TRACE_END("extract_group_icon_cursor_resource");
+			return memory;
 		}
 	}
 
@@ -275,6 +304,12 @@ extract_bitmap_resource(WinLibrary *fi, WinResource *wr, size_t *ressize)
     size_t size;
 
     resentry=(uint8_t *)(get_resource_entry(fi,wr,&size));
+    if (resentry == NULL)
+        return NULL;
+    if (size < sizeof(info)) {
+        warn(_("%s: bitmap resource too small"), fi->name);
+        return NULL;
+    }
 
     /* Bitmap file consists of:
      * 1) File header (14 bytes)
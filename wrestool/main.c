@@ -40,11 +40,16 @@
 
 enum {
     OPT_VERSION = 1000,
-    OPT_HELP
+    OPT_HELP,
+    OPT_STORE,
+    OPT_STORE_SHA256,
+    OPT_STATS,
+    OPT_TRACE
 };
 
 const char version_etc_copyright[] = "Copyright (C) 1998 Oskar Liljeblad";
 bool arg_raw;
+ContentStore *arg_store;
 static FILE *verbose_file;
 static int arg_verbosity;
 static const char *arg_output;
@@ -52,6 +57,11 @@ static const char *arg_type;
 static const char *arg_name;
 static const char *arg_language;
 static int arg_action;
+static const char *arg_store_dir;
+static bool arg_store_sha256;
+static bool arg_stats;
+static StatsFormat arg_stats_format = STATS_FORMAT_TEXT;
+static const char *arg_trace;
 static const char *res_types[] = {
     /* 0x01: */
     "cursor", "bitmap", "icon", "menu", "dialog", "string",
@@ -65,7 +75,6 @@ static const char *res_types[] = {
 #define RES_TYPE_COUNT ((int)(sizeof(res_types)/sizeof(char *)))
 
 static const char *res_type_string_to_id (const char *);
-static const char *get_extract_extension (const char *);
 
 /* res_type_id_to_string:
  *   Translate a numeric resource type to it's corresponding string type.
@@ -110,7 +119,7 @@ res_type_string_to_id (const char *type)
  *   Return extension for files of a certain resource type
  *
  */
-static const char *
+const char *
 get_extract_extension (const char *type)
 {
     uint16_t value;
@@ -193,6 +202,13 @@ display_help(void)
     printf(_("\nMiscellaneous:\n"));
     printf(_("  -o, --output=PATH       where to place extracted files\n"));
     printf(_("  -R, --raw               do not parse resource contents\n"));
+    printf(_("      --store=DIR         add extracted resources to a content-addressed\n"
+             "                          store in DIR, keeping one copy of each\n"));
+    printf(_("      --store-sha256      record SHA-256 digests in the store index\n"));
+    printf(_("      --stats[=FORMAT]    print time spent and counters on exit, per\n"
+             "                          file and in total, as text or json\n"));
+    printf(_("      --trace=FILE        write a Chrome trace of the time spent on each\n"
+             "                          file and resource to FILE\n"));
     printf(_("  -v, --verbose           explain what is being done\n"));
     printf(_("      --help              display this help and exit\n"));
     printf(_("      --version           output version information and exit\n"));
@@ -235,6 +251,10 @@ main (int argc, char **argv)
 	    { "extract",	no_argument,		NULL, 'x' },
 	    { "list",		no_argument,		NULL, 'l' },
 	    { "verbose",	no_argument,		NULL, 'v' },
+	    { "store",		required_argument,	NULL, OPT_STORE },
+	    { "store-sha256",	no_argument,		NULL, OPT_STORE_SHA256 },
+	    { "stats",		optional_argument,	NULL, OPT_STATS },
+	    { "trace",		required_argument,	NULL, OPT_TRACE },
 	    { "version",	no_argument,		NULL, OPT_VERSION },
 	    { "help",		no_argument,		NULL, OPT_HELP },
 	    { 0, 0, 0, 0 }
@@ -253,6 +273,14 @@ main (int argc, char **argv)
 	    case 'l': arg_action = ACTION_LIST; break;
 	    case 'v': arg_verbosity++; break;
 	    case 'o': arg_output = optarg; break;
+	    case OPT_STORE: arg_store_dir = optarg; break;
+	    case OPT_STORE_SHA256: arg_store_sha256 = true; break;
+	    case OPT_STATS:
+		if (optarg != NULL && !stats_parse_format(optarg, &arg_stats_format))
+		    die(_("invalid stats value: %s"), optarg);
+		arg_stats = true;
+		break;
+	    case OPT_TRACE: arg_trace = optarg; break;
 	    case OPT_VERSION:
 		version_etc(stdout, PROGRAM, PACKAGE, VERSION, "Oskar Liljeblad", NULL);
 		return 0;
@@ -275,6 +303,21 @@ main (int argc, char **argv)
 		warn(_("--name has no effect without --type"));
 	}
 
+	if (arg_stats && !stats_enable())
+	    die(_("--stats is not supported by this build"));
+	if (arg_trace != NULL && !trace_open(arg_trace))
+	    return 1;
+
+	if (arg_store_dir != NULL) {
+	    if (arg_output != NULL)
+		die(_("--store cannot be used with --output"));
+	    if (arg_action == ACTION_EXTRACT) {
+		arg_store = store_open(arg_store_dir, arg_store_sha256);
+		if (arg_store == NULL)
+		    return 1;
+	    }
+	}
+
 	/* translate --type option from resource type string to integer */
 	arg_type = res_type_string_to_id(arg_type);
 
@@ -287,10 +330,14 @@ main (int argc, char **argv)
 	/* for each file */
 	for (c = optind ; c < argc ; c++) {
 		WinLibrary fi;
+		Stats file_stats;
 		
 		/* initiate stuff */
 		fi.file = NULL;
 		fi.memory = NULL;
+		memset(&file_stats, 0, sizeof(Stats));
+		stats_set_current(&file_stats);
+		TRACE_BEGIN_FILE("file", argv[c]);
 
 		/* get file size */
 		fi.name = argv[c];
@@ -313,16 +360,26 @@ main (int argc, char **argv)
 		
 		/* read all of file */
 		fi.memory = xmalloc(fi.total_size);
+		STATS_BEGIN(STATS_READ);
+		TRACE_BEGIN("read");
 		if (fread(fi.memory, fi.total_size, 1, fi.file) != 1) {
 			die_errno("%s", fi.name);
 			goto cleanup;
 		}
+		TRACE_END("read");
+		STATS_END(STATS_READ);
+		STATS_ADD(STATS_BYTES_READ, fi.total_size);
 
 		/* identify file and find resource table */
+		STATS_BEGIN(STATS_RESOURCES);
+		TRACE_BEGIN("read_library");
 		if (!read_library (&fi)) {
 			/* error reported by read_library */
+			TRACE_END("read_library");
+			STATS_END(STATS_RESOURCES);
 			goto cleanup;
 		}
+		TRACE_END("read_library");
 
 	//	verbose_printf("file is a %s\n",
 	//		fi.is_PE_binary ? "Windows NT `PE' binary" : "Windows 3.1 `NE' binary");
@@ -339,6 +396,7 @@ main (int argc, char **argv)
 			do_resources (&fi, arg_type, arg_name, arg_language, extract_resources_callback);
 			/* errors will be printed by the callback */
 		}
+		STATS_END(STATS_RESOURCES);
 
 		/* free stuff and close file */
 		cleanup:
@@ -346,7 +404,19 @@ main (int argc, char **argv)
 			fclose(fi.file);
 		if (fi.memory != NULL)
 			free(fi.memory);
+		TRACE_END("file");
+		stats_set_current(NULL);
+		if (arg_stats && argc - optind > 1)
+			stats_print(stderr, fi.name, &file_stats, arg_stats_format);
 	}
 
-	return 0;
+	if (arg_store != NULL && !store_close(arg_store))
+		c = 1;
+	else
+		c = 0;
+	if (arg_stats)
+		stats_print(stderr, NULL, stats_total(), arg_stats_format);
+	if (arg_trace != NULL && !trace_close())
+		c = 1;
+	return c;
 }
@@ -64,7 +64,9 @@ do_resources (WinLibrary *fi, const char *type, const char *name, const char *la
 	lang_wr = type_wr + 2;
 	memset(type_wr, 0, sizeof(WinResource)*3);
 
+	TRACE_BEGIN("do_resources_recurs");
 	do_resources_recurs(fi, NULL, type_wr, name_wr, lang_wr, type, name, lang, cb);
+	TRACE_END("do_resources_recurs");
 
 	free(type_wr);
 }
@@ -87,28 +89,32 @@ do_resources_recurs (WinLibrary *fi, WinResource *base, WinResource *type_wr,
 	wr = list_resources (fi, base, &rescnt);
 	if (wr == NULL)
 		return;
-	if (!check_offset(fi->memory, fi->total_size, fi->name, &wr[0], sizeof(WinResource)))
+	if (rescnt == 0) {
+		free(wr);
 		return;
+	}
 
 	/* process each resource listed */
 	for (c = 0 ; c < rescnt ; c++) {
-		if (!check_offset(fi->memory, fi->total_size, fi->name, &wr[c], sizeof(WinResource)))
-			break;
 		/* (over)write the corresponding WinResource holder with the current */
 		memcpy(WINRESOURCE_BY_LEVEL(wr[c].level), wr+c, sizeof(WinResource));
 
 		/* go deeper unless there is something that does NOT match */
 		if (LEVEL_MATCHES(type) && LEVEL_MATCHES(name) && LEVEL_MATCHES(lang)) {
-			if (wr->is_directory)
+			if (wr->is_directory) {
+				TRACE_BEGIN("do_resources_recurs");
 				do_resources_recurs (fi, wr+c, type_wr, name_wr, lang_wr, type, name, lang, cb);
-			else
+				TRACE_END("do_resources_recurs");
+			} else {
 				cb(fi, wr+c, type_wr, name_wr, lang_wr);
+			}
 		}
 	}
 
 	/* since we're moving back one level after this, unset the
 	 * WinResource holder used on this level */
 	memset(WINRESOURCE_BY_LEVEL(wr[0].level), 0, sizeof(WinResource));
+	free(wr);
 }
 
 void
@@ -130,6 +136,7 @@ print_resources_callback (WinLibrary *fi, WinResource *wr,
 	if (offset == NULL)
 		return;
 
+	STATS_ADD(STATS_ENTRIES, 1);
 	printf(_("--type=%s --name=%s%s%s [%s%s%soffset=0x%x size=%zu]\n"),
 	  get_resource_id_quoted(type_wr),
 	  get_resource_id_quoted(name_wr),
@@ -539,13 +546,14 @@ find_with_resource_array(WinLibrary *fi, WinResource *wr, const char *id)
 		}
 	}
 
+	free(wr);
 	return NULL;
 }
 
 WinResource *
 find_resource (WinLibrary *fi, const char *type, const char *name, const char *language, int *level)
 {
-	WinResource *wr;
+	WinResource *wr, *parent;
 
 	*level = 0;
 	if (type == NULL)
@@ -557,13 +565,17 @@ find_resource (WinLibrary *fi, const char *type, const char *name, const char *l
 	*level = 1;
 	if (name == NULL)
 		return wr;
-	wr = find_with_resource_array(fi, wr, name);
+	parent = wr;
+	wr = find_with_resource_array(fi, parent, name);
+	free(parent);
 	if (wr == NULL || !wr->is_directory)
 		return wr;
 
 	*level = 2;
 	if (language == NULL)
 		return wr;
-	wr = find_with_resource_array(fi, wr, language);
+	parent = wr;
+	wr = find_with_resource_array(fi, parent, language);
+	free(parent);
 	return wr;
 }
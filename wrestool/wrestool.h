@@ -28,6 +28,9 @@
 #include <errno.h>		/* C89 */
 #include <getopt.h>		/* GNU Libc/Gnulib */
 #include "common/common.h"
+#include "common/stats.h"
+#include "common/store.h"
+#include "common/trace.h"
 //#include "../common/win32.h"
 //#include "../common/fileread.h"
 //#include "../common/util.h"
@@ -39,6 +42,7 @@
 
 extern char *prgname;
 extern bool arg_raw;
+extern ContentStore *arg_store;
 
 /*
  * Structures 
@@ -100,6 +104,7 @@ void print_resources_callback (WinLibrary *, WinResource *, WinResource *, WinRe
 /* main.c */
 const char *res_type_id_to_string (int);
 const char *get_destination_name (WinLibrary *, const char *, const char *, const char *);
+const char *get_extract_extension (const char *);
 
 /* extract.c */
 void *extract_resource (WinLibrary *, WinResource *, size_t *, bool *, char *, char *, bool);